@@ -1,28 +1,87 @@
+#include <coroutine>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <algorithm>
 #include <iostream>
 #include <cstring>
 #include <cassert>
-#include <syscall.h>
-#include <fcntl.h> /* флажки чтения и записи */
-#include <sys/types.h> /* определения типов */
-#include <sys/stat.h> /* структура, возвращаемая stat */
-#include "dirent.h"
+#include <climits>
+#include <ctime>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "window.h"
+#include "mainloop.h"
+#include "task.h"
+#include "threadpool.h"
+#include "dirscan.h"
+#include "collate.h"
+#include "fileprobe.h"
+#include "dirwatch.h"
+#include "dirindex.h"
+#include "imagecache.h"
 #include "image.h"
+#include "tiledimage.h"
+#include "pngread.h"
 #include "text.h"
+#include "edit.h"
 #include "list.h"
 #include "scroll.h"
+#include "virtuallist.h"
+#include "textsearch.h"
 #include "GUI.h"
 
 #define WIN_WIDTH   800
 #define WIN_HEIGHT  500
 #define PATH_HEIGHT 20
+#define FILTER_HEIGHT   24
 #define LISTSIZE    200
 #define BARSIZE     12
 #define MAX_PATH    1024
 #define START_PREVIEW_SIZE  120
 #define GAP         10
+#define PREFETCH_ROWS   2       // образцы создаются заранее на столько строк выше и ниже видимой области
+#define RELEASE_ROWS    6       // и удаляются, если удалились от нее больше чем на столько строк
+#define PLACEHOLDER_COLOR   RGB(0.8, 0.8, 0.8)  // фон образца, пока картинка не загружена
+#define TILED_MIN_PIXELS    (4096*4096) // картинки больше - отображаются плитками (TiledImage)
+#define SURFACE_MAX_SIDE    32767       // наибольшая сторона поверхности cairo
+#define UPDATE_BATCH        1024        // элементов списка, разбираемых за шаг обновления таблицы
+#define INDEX_MAX_AGE       3600        // индекс старше (секунды) перестраивается в фоне при запуске
+
+// элемент каталога
+typedef struct _ITEM
+{
+    char     *name;     // отдельный блок памяти: адрес не меняется, пока элемент в каталоге
+    uint32_t lower;     // смещение имени в нижнем регистре в области имен (см. CollateFold)
+    uint32_t length;    // длина имени, байты
+    uint8_t  type;      // DIRSCAN_*
+    uint8_t  format;    // FILETYPE_*
+} ITEM;
+
+// прочитанный каталог: элементы в порядке показа и область их имен в нижнем регистре
+typedef struct _LISTING
+{
+    std::vector<ITEM> items;
+    std::vector<char> lower;
+} LISTING;
+
+// изменение каталога, ожидающее применения к списку
+typedef struct _ENTRYCHANGE
+{
+    uint8_t     event;      // DIRWATCH_*
+    uint8_t     type;       // DIRSCAN_*, определяется в пуле потоков
+    uint8_t     format;     // FILETYPE_*, определяется в пуле потоков
+    bool        bExists;    // элемент (с новым именем) существует
+    std::string name;
+    std::string newName;    // только для DIRWATCH_RENAMED
+} ENTRYCHANGE;
 
 
 class Table;
@@ -39,21 +98,64 @@ public:
     void OnSizeChanged();
     void OnNotify(Window *child, uint32_t type, const Point &position);
 
-    void CreateList(const char *);
-    void DisplayImage(IMAGEINFO ii);
+    Task<void> CreateList(const char *);   // чтение каталога без блокировки интерфейса
+    Task<void> ApplyChanges();              // применение изменений каталога к списку (см. dirwatch.h)
+    Task<void> OpenIndex();                 // открытие индекса дерева (см. dirindex.h) и чтение каталога
+    Task<void> UpdateIndex(bool bFiles=false); // построение индекса в пуле потоков; bFiles - см. DirIndexBuild
+    void DisplayImage(const char *filename);    // крупная картинка (загружается в пуле потоков)
+    void CloseImage();
+    uint32_t GetRowCount();                     // количество строк списка (элементов, прошедших фильтр)
+    uint8_t GetFileType(uint32_t row);          // тип содержимого элемента строки (FILETYPE_*, см. fileprobe.h)
+    const char *GetRowName(uint32_t row);       // имя элемента строки; действительно, пока элемент в каталоге
 
 private:
+    void OnDirChanged(const DIRCHANGE *changes, uint32_t n);
+    void SetFilter(const char *text);           // фильтр строк: подстрока имени; '^' в начале - начало имени
+    void FilterRows(bool bNarrow);              // отбор строк списка; bNarrow - перебираются только прежние строки
+    bool Matches(const ITEM &item);             // имя элемента проходит фильтр
+    bool FindEntry(const char *name, bool bDir, uint32_t *pos);   // false - элемента нет, pos - место для вставки
+    void AddEntry(const char *name, uint8_t type, uint8_t format);
+    void DeleteEntry(const char *name);
+    void CompactLower();                        // удаление из области имен имен удаленных элементов
+    void SetListing(LISTING *pListing);         // новые элементы списка; nullptr - список пуст
+    void ClearItems();
+    void ChangeDir(const char *dir);            // переход в каталог со сбросом фильтра
+
     Text *m_pText;
-    List *m_pList;
+    Edit *m_pFilter;
+    VirtualList *m_pList;
     Table *m_pTable;
-    Scroll *m_pListScroll, *m_pTableScroll;
     Image *m_pImage;
+    TiledImage *m_pTiled; // очень большая картинка
+    IMAGEINFO m_ii;     // крупная картинка
+    uint32_t m_nDisplay; // номер загрузки крупной картинки
     char m_path[MAX_PATH];
-    char **m_names;
-    uint16_t m_n;
+    uint32_t m_nList;   // номер чтения каталога
+    DirWatch m_watch;   // изменения текущего каталога
+    std::vector<ENTRYCHANGE> m_changes; // изменения, ожидающие применения
+    bool m_bListed;     // список каталога прочитан - изменения можно применять
+    bool m_bApplying;   // изменения применяются (ApplyChanges)
+    std::vector<ITEM> m_items;      // элементы каталога в порядке показа
+    std::vector<char> m_lower;      // имена элементов в нижнем регистре подряд - по ней ищет фильтр
+    uint32_t m_lowerGarbage;        // байтов m_lower, занятых именами удаленных элементов
+    std::vector<uint32_t> m_rows;   // номера элементов, прошедших фильтр, по возрастанию
+    std::string m_filter;           // образец фильтра в нижнем регистре
+    bool m_bPrefix;                 // образец сравнивается с началом имени
+    char m_root[PATH_MAX];          // корень индекса - каталог, открытый при запуске
+    std::shared_ptr<struct _DIRINDEX> m_index;  // индекс; nullptr - еще не построен
+    bool m_bIndexing;               // индекс строится (UpdateIndex)
+    bool m_bTiled;      // крупная картинка отображается плитками
     bool m_bMode;       // true - отображается крупная картинка, false - отображаются панели списка и образцов
 };
 
+// состояние загрузки картинки образца
+enum PreviewState
+{
+    PREVIEW_WAITING,    // ожидает загрузки
+    PREVIEW_LOADING,    // загружается в пуле потоков
+    PREVIEW_READY,      // загружена (или загрузить не удалось)
+};
+
 class Preview :public Window
 {
 public:
@@ -63,8 +165,15 @@ public:
     void OnCreate();
     bool OnLeftMouseButtonDoubleClick(const Point &position);
     void SetPreviewSize(uint16_t nPreviewSize);
+    void SetImage(IMAGEINFO ii);            // картинка загружена; nullptr - загрузить не удалось
+    const char *GetFilename();
+    Rect &GetImageSize();                   // размер области картинки
+
+    uint8_t m_state;
 
 private:
+    void UpdateStyle();
+
     const char  *m_filename;
     IMAGEINFO m_ii;
     Image *m_pImage;
@@ -75,52 +184,79 @@ private:
 class Table : public Window
 {
 public:
-    Table(List *pFileList, MainWindow *pMainWindow);
+    Table(MainWindow *pMainWindow);
     ~Table();
 
+    void OnCreate();
     void OnDraw(Context *cr);
     void OnSizeChanged();
-    Rect &GetDataRect();
+    void OnNotify(Window *child, uint32_t type, const Point &position);
+    bool OnScroll(uint64_t value);
 
     void Update();      // обновление списка файлов
+    void Filter();      // отбор клеток по строкам списка после смены фильтра; созданные образцы сохраняются
+    void OnEntryInserted(uint32_t row); // в список вставлена строка row
+    void OnEntryDeleting(uint32_t row); // из списка удаляется строка row
+    void OnEntriesChanged();            // изменения списка закончены
     uint16_t GetPreviewSize();
     void SetPreviewSize(uint16_t nPreviewSize);
 
 private:
-    void Reposition();  // назначение положения образцов
+    bool UpdateStep(uint32_t nUpdate);  // разбор очередной порции списка; false - список разобран
+    void StartDecodes();                // запуск загрузки ближайших к видимой области образцов
+    void Reposition();                  // число столбцов и шкала прокрутки после изменения размеров или клеток
+    void UpdateVisible();               // создание образцов у видимой области и удаление удаленных от нее
+    uint32_t GetRowCount();             // строк таблицы
+    uint32_t GetVisibleRows();          // строк, видимых целиком (хотя бы одна)
+    void SetTop(int64_t top);           // первая видимая строка
+    Point GetCellPosition(uint32_t i);  // положение видимой клетки таблицы в окне
     void ClearPreviews(); // удаление всех образцов
+    void InsertCell(uint32_t i, const char *filename);
+    void DeleteCell(uint32_t i);
 
     uint16_t m_nPreviewSize;
-    uint16_t m_nPreviews;
-    List *m_pFileList;
+    uint32_t m_nCells;  // количество картинок в списке
+    uint16_t m_nColumns; // количество столбцов таблицы
     MainWindow *m_pMainWindow;
-    Preview **m_pPreviews;
-    Rect  m_TableSize;
+    const char **m_pFiles; // имена картинок
+    Preview **m_pPreviews; // образцы картинок; nullptr - образец не создан
+    uint32_t m_from, m_to;  // образцы созданы только у клеток [m_from, m_to) - у видимой области
+    uint32_t m_top;     // первая видимая строка таблицы
+    double   m_dy;      // накопленная плавная прокрутка меньше строки, пиксели
+    uint32_t m_nUpdate; // номер обновления списка файлов
+    uint32_t m_nNext;   // следующая разбираемая строка списка
+    uint16_t m_nDecoding; // количество загружаемых картинок
+    std::deque<std::shared_ptr<Window*>> m_pending;  // образцы, ожидающие загрузки; видимые - в начале
+    VerticalScrollBar *m_pVBar;
 };
 
 MainWindow::MainWindow()
 {
     m_ClassName = __FUNCTION__;
-    m_names = nullptr;
-    m_n = 0;
+    m_nList = 0;
+    m_bListed = false;
+    m_bApplying = false;
+    m_lowerGarbage = 0;
+    m_bPrefix = false;
+    m_bIndexing = false;
+    m_root[0] = 0;
+    m_path[0] = 0;
+    m_ii = nullptr;
+    m_nDisplay = 0;
     SetBackColor(RGB_WHITE);
     m_pList = nullptr;
     m_pTable = nullptr;
+    m_bTiled = false;
     m_bMode = false;
 }
 
 MainWindow::~MainWindow()
 {
-    if(m_n>0)
+    if(m_ii)
     {
-        for(uint16_t i=0; i< m_n; i++)
-        {
-            free(m_names[i]);
-        }
-        free(m_names);
-        m_names = nullptr;
-        m_n = 0;
+        theGUI->DeletePNG(m_ii);
     }
+    ClearItems();
 }
 
 void MainWindow::OnCreate()
@@ -135,25 +271,41 @@ void MainWindow::OnCreate()
     m_pText->SetAlignment(TEXT_ALIGNH_LEFT|TEXT_ALIGNV_CENTER);
 	AddChild(m_pText, Point(0,0), Rect(w,PATH_HEIGHT));
 
-	// панель выбора каталога
-	m_pListScroll = new Scroll;
-	AddChild(m_pListScroll, Point(0,PATH_HEIGHT), Rect(LISTSIZE,h-PATH_HEIGHT));
-	m_pList = new List();
-    m_pListScroll->SetDataWindow(m_pList);
+    // фильтр списка
+    m_pFilter = new Edit;
+    m_pFilter->SetFrameWidth(1);
+    AddChild(m_pFilter, Point(0,PATH_HEIGHT), Rect(LISTSIZE,FILTER_HEIGHT));
+
+	// панель выбора каталога: строки берутся из элементов, прошедших фильтр
+	m_pList = new VirtualList;
+    m_pList->SetSource([this](uint32_t row, LISTROW *pRow)
+        {
+            const ITEM &item = m_items[m_rows[row]];
+            pRow->text = item.name;
+            pRow->style = item.type == DIRSCAN_DIR ? TEXT_STYLE_BOLD : 0;
+        });
+	AddChild(m_pList, Point(0,PATH_HEIGHT+FILTER_HEIGHT), Rect(LISTSIZE,h-(PATH_HEIGHT+FILTER_HEIGHT)));
 
-    // панель превью
-	m_pTableScroll = new Scroll;
-	AddChild(m_pTableScroll, Point(LISTSIZE+BARSIZE,PATH_HEIGHT), Rect(w-(LISTSIZE+BARSIZE),h-PATH_HEIGHT));
-	m_pTable = new Table(m_pList,this);
-    m_pTableScroll->SetDataWindow(m_pTable);
+    // панель превью; прокручивается сама по строкам (см. Table::SetTop)
+	m_pTable = new Table(this);
+	AddChild(m_pTable, Point(LISTSIZE+BARSIZE,PATH_HEIGHT), Rect(w-(LISTSIZE+BARSIZE),h-PATH_HEIGHT));
 
     // крупная картинка
     m_pImage = new Image;
     m_pImage->Hide();
     m_pImage->SetStyle(IMAGE_SCALE_FIT|IMAGE_ALIGNH_CENTER|IMAGE_ALIGNV_CENTER);
     AddChild(m_pImage, Point(0,0), mysize);
+    m_pTiled = new TiledImage;
+    m_pTiled->Hide();
+    m_pTiled->SetBackColor(RGB_WHITE);
+    AddChild(m_pTiled, Point(0,0), mysize);
 
-    CreateList(".");
+    // каталог, записанный в индексе, показывается из индекса
+    if(!realpath(".", m_root))
+    {
+        strcpy(m_root, ".");
+    }
+    OpenIndex();
 
     CaptureKeyboard(this);
 }
@@ -174,18 +326,27 @@ void MainWindow::OnSizeChanged()
 	m_pText->SetPosition(Point(0,0));
 	m_pText->SetSize(Rect(w,PATH_HEIGHT));
 
-	m_pListScroll->SetPosition(Point(0,PATH_HEIGHT));
-	m_pListScroll->SetSize(Rect(LISTSIZE,h-PATH_HEIGHT));
+	m_pFilter->SetPosition(Point(0,PATH_HEIGHT));
+	m_pFilter->SetSize(Rect(LISTSIZE,FILTER_HEIGHT));
+	m_pList->SetPosition(Point(0,PATH_HEIGHT+FILTER_HEIGHT));
+	m_pList->SetSize(Rect(LISTSIZE,h-(PATH_HEIGHT+FILTER_HEIGHT)));
 
 	assert(w > LISTSIZE+BARSIZE);
-	m_pTableScroll->SetPosition(Point(LISTSIZE+BARSIZE,PATH_HEIGHT));
-	m_pTableScroll->SetSize(Rect(w-(LISTSIZE+BARSIZE),h-PATH_HEIGHT));
+	m_pTable->SetPosition(Point(LISTSIZE+BARSIZE,PATH_HEIGHT));
+	m_pTable->SetSize(Rect(w-(LISTSIZE+BARSIZE),h-PATH_HEIGHT));
 
 	m_pImage->SetSize(mysize);
+	m_pTiled->SetSize(mysize);
 }
 
 bool MainWindow::OnKeyPress(uint64_t keyval)
 {
+    // масштаб и прокрутка большой картинки
+    if(m_bMode && m_bTiled && m_pTiled->OnKeyPress(keyval))
+    {
+        return true;
+    }
+
     switch(keyval)
     {
     case 'q':
@@ -208,12 +369,14 @@ bool MainWindow::OnKeyPress(uint64_t keyval)
         }
         return true;
     case KEY_Esc:
-        m_pImage->Hide();
-        m_pText->Show();
-        m_pListScroll->Show();
-        m_pTableScroll->Show();
-        m_bMode = false;
-        ReDraw();
+        CloseImage();
+        return true;
+    case '/':
+        // ввод фильтра; Enter и Esc возвращают клавиатуру главному окну
+        if(!m_bMode)
+        {
+            CaptureKeyboard(m_pFilter);
+        }
         return true;
     case 'p':
     case 'P':
@@ -227,185 +390,617 @@ bool MainWindow::OnKeyPress(uint64_t keyval)
 
 void MainWindow::OnNotify(Window *child, uint32_t type, const Point &position)
 {
-    if(child == m_pListScroll && type == EVENT_LIST_LMB_CLICK)
+    if(child == m_pFilter && type == EVENT_EDIT_CHANGED)
+    {
+        SetFilter(m_pFilter->GetText());
+    }
+    if(child == m_pFilter && type == EVENT_EDIT_RETURN)
+    {
+        CaptureKeyboard(this);
+    }
+    if(child == m_pList && type == EVENT_LIST_LMB_CLICK)
     {
 //std::cout << "List element " << m_pList->GetSelection() << " was clicked" << std::endl;
     }
-    if(child == m_pListScroll && type == EVENT_LIST_LMB_DOUBLECLICK)
+    if(child == m_pList && type == EVENT_LIST_LMB_DOUBLECLICK)
     {
 //std::cout << "List element " << m_pList->GetSelection() << " was double clicked" << std::endl;
 
-        int16_t i = m_pList->GetSelection();
-        if(m_pList->GetValue(i))
+        int32_t row = m_pList->GetSelection();
+        if(row >= 0 && m_items[m_rows[row]].type == DIRSCAN_DIR)
         {
+            const char *dir = m_items[m_rows[row]].name;
             char name[MAX_PATH];
-            if (strlen(m_path)+strlen(m_names[i]) + 2 > sizeof(name))
+            if (strlen(m_path)+strlen(dir) + 2 > sizeof(name))
             {
-                std::cerr << "Name " << m_path << "/" << m_names[i] << "is too long" << std::endl;
+                std::cerr << "Name " << m_path << "/" << dir << "is too long" << std::endl;
             }
             else
             {
-                chdir(m_names[i]);
-                CreateList(".");
+                ChangeDir(dir);
             }
             CaptureKeyboard(this);
         }
     }
 }
 
-void MainWindow::DisplayImage(IMAGEINFO ii)
+// в новом каталоге фильтр сбрасывается
+void MainWindow::ChangeDir(const char *dir)
+{
+    chdir(dir);
+    m_pFilter->SetText("");
+    m_pFilter->ReDraw();
+    m_filter.clear();
+    m_bPrefix = false;
+    CreateList(".");
+}
+
+void MainWindow::DisplayImage(const char *filename)
 {
-    m_pImage->SetImage(ii);
-    m_pImage->Show();
     m_pText->Hide();
-    m_pListScroll->Hide();
-    m_pTableScroll->Hide();
+    m_pFilter->Hide();
+    m_pList->Hide();
+    m_pTable->Hide();
     m_bMode = true;
+
+    // очень большую картинку одной поверхностью не показать (или она займет слишком много памяти) -
+    // показываем плитками; размер известен из заголовка
+    uint32_t w, h;
+    m_bTiled = PNGGetSize(filename, &w, &h)
+        && ((uint64_t) w*h > TILED_MIN_PIXELS || w > SURFACE_MAX_SIDE || h > SURFACE_MAX_SIDE);
+    if(m_bTiled)
+    {
+        m_pTiled->Show();
+        m_pTiled->Load(filename);
+        ReDraw();
+        return;
+    }
+
+    m_pImage->SetImage(nullptr);
+    m_pImage->Show();
+    ReDraw();
+
+    // образцы уменьшены при чтении - крупную картинку читаем заново (повторно открытая картинка берется из кэша)
+    uint32_t nDisplay = ++m_nDisplay;
+    std::string name(filename);
+    RunInBackground([name]() { return ImageCacheLoad(theGUI, name.c_str()); },
+        [this, nDisplay](IMAGEINFO &ii)
+        {
+            // картинка уже закрыта - ссылку освободит release
+            if(nDisplay != m_nDisplay || !ii)
+            {
+                return;
+            }
+            m_ii = ii;
+            ii = nullptr;
+            m_pImage->SetImage(m_ii);
+            m_pImage->ReDraw();
+        },
+        [](IMAGEINFO &ii) { ImageRelease(ii); });
+}
+
+void MainWindow::CloseImage()
+{
+    ++m_nDisplay;
+    m_pImage->SetImage(nullptr);
+    if(m_ii)
+    {
+        theGUI->DeletePNG(m_ii);
+        m_ii = nullptr;
+    }
+
+    m_pImage->Hide();
+    m_pTiled->Close();
+    m_pTiled->Hide();
+    m_bTiled = false;
+    m_pText->Show();
+    m_pFilter->Show();
+    m_pList->Show();
+    m_pTable->Show();
+    m_bMode = false;
     ReDraw();
 }
 
-Table::Table(List *pFileList, MainWindow *pMainWindow)
+Table::Table(MainWindow *pMainWindow)
 {
     m_ClassName = __FUNCTION__;
-    m_pFileList = pFileList;
     m_pMainWindow = pMainWindow;
     m_nPreviewSize = START_PREVIEW_SIZE;
-    m_nPreviews = 0;
+    m_nCells = 0;
+    m_nColumns = 1;
+    m_pFiles = nullptr;
     m_pPreviews = nullptr;
-    m_TableSize = Rect(0,0);
+    m_from = m_to = 0;
+    m_top = 0;
+    m_dy = 0;
+    m_nUpdate = 0;
+    m_nNext = 0;
+    m_nDecoding = 0;
+    m_pVBar = new VerticalScrollBar;
 }
 
 Table::~Table()
 {
-    if(m_nPreviews>0)
+    if(m_nCells>0)
     {
+        free(m_pFiles);
         free(m_pPreviews);
+        m_pFiles = nullptr;
         m_pPreviews = nullptr;
-        m_nPreviews = 0;
+        m_nCells = 0;
     }
+}
 
-    SetOrigin(Point(0,0));
+void Table::OnCreate()
+{
+    Rect is = GetInteriorSize();
+    AddChild(m_pVBar, Point(is.GetWidth()-SCROLLBAR_SIZE,0), Rect(SCROLLBAR_SIZE,is.GetHeight()));
+    m_pVBar->SetTotal(0);
+    m_pVBar->SetDataOrigin(0);
 }
 
 void Table::OnDraw(Context *cr)
 {
     cr->SetColor(m_backColor);
-    cr->FillRectangle(Point(0,0),m_TableSize);
+    cr->FillRectangle(Point(0,0),GetInteriorSize());
 }
 
 void Table::OnSizeChanged()
 {
+    Rect is = GetInteriorSize();
+    m_pVBar->SetSize(Rect(SCROLLBAR_SIZE,is.GetHeight()));
+    m_pVBar->SetPosition(Point(is.GetWidth()-SCROLLBAR_SIZE,0));
     Reposition();
 }
 
+void Table::OnNotify(Window *child, uint32_t type, const Point &position)
+{
+    if(child == m_pVBar && type == EVENT_SCROLLING)
+    {
+        m_top = m_pVBar->GetDataOrigin()/(m_nPreviewSize + GAP);
+        UpdateVisible();
+        ReDraw();
+    }
+}
+
+bool Table::OnScroll(uint64_t value)
+{
+    SCROLLINFO si = (SCROLLINFO) value;
+
+    switch(si->direction)
+    {
+    case _SCROLLINFO::SCROLL_UP:
+        m_dy -= SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_DOWN:
+        m_dy += SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_SMOOTH:
+        m_dy -= si->dy;
+        break;
+    default:
+        return true;
+    }
+
+    // прокрутка по целым строкам, остаток накапливается
+    int32_t step = m_nPreviewSize + GAP;
+    int32_t nRows = (int32_t)(m_dy/step);
+    if(nRows)
+    {
+        m_dy -= nRows*step;
+        SetTop((int64_t) m_top + nRows);
+        ReDraw();
+    }
+    if(si->stop)
+    {
+        m_dy = 0;
+    }
+    return true;
+}
+
 void Table::Update()
 {
     ClearPreviews();
+    Reposition();
 
-    uint16_t n = m_pFileList->GetNumberOfElements();
-    for(uint16_t i=0; i<n; i++)
+    // список разбирается порциями в паузах главного цикла; задание прежнего обновления
+    // завершится, увидев новый номер
+    uint32_t nUpdate = ++m_nUpdate;
+    m_nNext = 0;
+    RunWhenIdle([this, nUpdate]() { return UpdateStep(nUpdate); });
+}
+
+void Table::Filter()
+{
+    // прежние образцы по имени: адрес имени не меняется, пока элемент в каталоге
+    std::unordered_map<const char *, Preview *> previews;
+    for(uint32_t i=m_from; i<m_to; i++)
     {
-        // очередной элемент
-        Window *pElement = m_pFileList->GetElement(i);
+        if(m_pPreviews[i])
+        {
+            previews[m_pFiles[i]] = m_pPreviews[i];
+        }
+    }
 
-        // пропускаем каталоги
-        if(!m_pFileList->GetValue(i))
+    // начатое обновление больше не нужно: клетки строятся здесь по всему списку
+    ++m_nUpdate;
+    uint32_t n = m_pMainWindow->GetRowCount();
+    uint32_t nCells = 0;
+    for(uint32_t i=0; i<n; i++)
+    {
+        nCells += m_pMainWindow->GetFileType(i) == FILETYPE_PNG;
+    }
+    if(nCells)
+    {
+        m_pFiles = (const char **) realloc(m_pFiles, nCells*sizeof(const char *));
+        m_pPreviews = (Preview **) realloc(m_pPreviews, nCells*sizeof(Preview *));
+    }
+    else
+    {
+        free(m_pFiles);
+        free(m_pPreviews);
+        m_pFiles = nullptr;
+        m_pPreviews = nullptr;
+    }
+    m_nCells = 0;
+    for(m_nNext=0; m_nNext<n; m_nNext++)
+    {
+        if(m_pMainWindow->GetFileType(m_nNext) != FILETYPE_PNG)
+        {
+            continue;
+        }
+        const char *filename = m_pMainWindow->GetRowName(m_nNext);
+        auto it = previews.find(filename);
+        m_pFiles[m_nCells] = filename;
+        m_pPreviews[m_nCells++] = it != previews.end() ? it->second : nullptr;
+        if(it != previews.end())
         {
-            // текст
-            Text *pText = reinterpret_cast<Text *>(pElement);
-            char *filename = pText->GetText();
+            previews.erase(it);
+        }
+    }
 
-            // откроем файл
-            int file = open(filename, O_RDONLY);
+    // образцы строк, не прошедших фильтр
+    for(auto &p : previews)
+    {
+        DeleteChild(p.second);
+    }
 
-            // прочитаем сигнатуру и закроем файл
-            unsigned char sign[8];
-            read(file,&sign,8);
-            close(file);
+    // сохраненные образцы могли оказаться в любых клетках: их удалит UpdateVisible
+    m_from = 0;
+    m_to = m_nCells;
+    m_top = 0;
+    Reposition();
+}
 
-            // определяем тип файла
-            if((sign[0]==0x89) && (sign[1]==0x50) && (sign[2]==0x4e) && (sign[3]==0x47)
-                 && (sign[4]==0x0d) && (sign[5]==0x0a) && (sign[6]==0x1a) && (sign[7]==0x0a))
-            {
-                // png
-                Preview *pPreview = new Preview(filename,m_pMainWindow);
-                AddChild(pPreview,Point (50,50), Rect(m_nPreviewSize, m_nPreviewSize));
+bool Table::UpdateStep(uint32_t nUpdate)
+{
+    if(nUpdate != m_nUpdate)
+    {
+        return false;
+    }
 
-                // расширим массив адресов образцов и занесем туда адрес только что сзданного
-                if(m_nPreviews)
-                {
-                    m_pPreviews = (Preview **) realloc(m_pPreviews,(m_nPreviews+1)*sizeof(Preview *));
-                }
-                else
-                {
-                    m_pPreviews = (Preview **) malloc(sizeof(Preview *));
-                }
-                m_pPreviews[m_nPreviews++] = pPreview;
-            }
+    // тип файлов определен при чтении каталога (см. fileprobe.h) - здесь обращений к диску нет
+    uint32_t n = m_pMainWindow->GetRowCount();
+    uint32_t nEnd = min(n, m_nNext + UPDATE_BATCH);
+    uint32_t nCells = m_nCells;
+    for(; m_nNext<nEnd; m_nNext++)
+    {
+        if(m_pMainWindow->GetFileType(m_nNext) != FILETYPE_PNG)
+        {
+            continue;
+        }
+
+        // png: добавляем клетку таблицы; образец создается, когда клетка окажется у видимой области
+        if(m_nCells)
+        {
+            m_pFiles = (const char **) realloc(m_pFiles,(m_nCells+1)*sizeof(const char *));
+            m_pPreviews = (Preview **) realloc(m_pPreviews,(m_nCells+1)*sizeof(Preview *));
+        }
+        else
+        {
+            m_pFiles = (const char **) malloc(sizeof(const char *));
+            m_pPreviews = (Preview **) malloc(sizeof(Preview *));
         }
+        m_pFiles[m_nCells] = m_pMainWindow->GetRowName(m_nNext);
+        m_pPreviews[m_nCells++] = nullptr;
     }
 
-    // расставим образцы по своим местам
-    Reposition();
+    // клетки добавлены в конец: прежние остаются на местах
+    if(m_nCells != nCells)
+    {
+        Reposition();
+    }
+
+    return m_nNext < n;
 }
 
-void Table::Reposition()
+void Table::OnEntryInserted(uint32_t row)
 {
-    Rect is = GetInteriorSize();
-    uint16_t x = GAP, y = GAP, k = 0, w = is.GetWidth();
+    // пока список разбирается (UpdateStep), строки после разобранных он разберет сам
+    uint32_t n = m_pMainWindow->GetRowCount();
+    if(row >= m_nNext && m_nNext < n-1)
+    {
+        return;
+    }
+    ++m_nNext;
+    if(m_pMainWindow->GetFileType(row) != FILETYPE_PNG)
+    {
+        return;
+    }
+
+    // клетка - после клеток картинок, стоящих в списке раньше
+    uint32_t nCell = 0;
+    for(uint32_t j=0; j<row; j++)
+    {
+        nCell += m_pMainWindow->GetFileType(j) == FILETYPE_PNG;
+    }
+    InsertCell(nCell, m_pMainWindow->GetRowName(row));
+}
+
+void Table::OnEntryDeleting(uint32_t row)
+{
+    if(row >= m_nNext)
+    {
+        return;
+    }
+    --m_nNext;
+    if(m_pMainWindow->GetFileType(row) != FILETYPE_PNG)
+    {
+        return;
+    }
 
-    for(uint16_t i=0; i<m_nPreviews; i++)
+    // клетка ссылается на имя элемента
+    const char *filename = m_pMainWindow->GetRowName(row);
+    for(uint32_t j=0; j<m_nCells; j++)
     {
-        // строка заполнена?
-        if(x+m_nPreviewSize > w && k > 0)
+        if(m_pFiles[j] == filename)
         {
-            // переход на новую строку таблицы
-            x = GAP;
-            y += m_nPreviewSize + GAP;
-            k = 0;
+            DeleteCell(j);
+            break;
         }
+    }
+}
+
+void Table::OnEntriesChanged()
+{
+    // новые образцы создаются у видимой области, их картинки загружаются в пуле потоков
+    Reposition();
+}
 
-        // положение образца
-        m_pPreviews[i]->SetPosition(Point(x, y));
-        x += m_nPreviewSize + GAP;
-        ++k;
+void Table::InsertCell(uint32_t i, const char *filename)
+{
+    if(m_nCells)
+    {
+        m_pFiles = (const char **) realloc(m_pFiles,(m_nCells+1)*sizeof(const char *));
+        m_pPreviews = (Preview **) realloc(m_pPreviews,(m_nCells+1)*sizeof(Preview *));
+    }
+    else
+    {
+        m_pFiles = (const char **) malloc(sizeof(const char *));
+        m_pPreviews = (Preview **) malloc(sizeof(Preview *));
+    }
+    memmove(m_pFiles+i+1, m_pFiles+i, (m_nCells-i)*sizeof(const char *));
+    memmove(m_pPreviews+i+1, m_pPreviews+i, (m_nCells-i)*sizeof(Preview *));
+    m_pFiles[i] = filename;
+    m_pPreviews[i] = nullptr;
+    ++m_nCells;
+
+    // клетки с образцами сдвигаются
+    if(i < m_from)
+    {
+        ++m_from;
     }
+    if(i < m_to)
+    {
+        ++m_to;
+    }
+}
 
-    if(k>0)
+void Table::DeleteCell(uint32_t i)
+{
+    // загрузка картинки удаленного образца завершится впустую (см. StartDecodes)
+    if(m_pPreviews[i])
+    {
+        DeleteChild(m_pPreviews[i]);
+    }
+    if(i < m_from)
+    {
+        --m_from;
+    }
+    if(i < m_to)
     {
-        y += m_nPreviewSize + GAP;
+        --m_to;
     }
-    y = max(is.GetHeight(),y);
-    w = max(w,m_nPreviewSize + 2*GAP);
 
-    // размер документа для прокрутки
-    if((m_TableSize.GetWidth() != w) || (m_TableSize.GetHeight() != y))
+    --m_nCells;
+    if(m_nCells == 0)
     {
-        m_TableSize = Rect(w,y);
-        GetParent()->OnDataRectChanged(this,m_TableSize);
+        free(m_pFiles);
+        free(m_pPreviews);
+        m_pFiles = nullptr;
+        m_pPreviews = nullptr;
+        return;
     }
+    memmove(m_pFiles+i, m_pFiles+i+1, (m_nCells-i)*sizeof(const char *));
+    memmove(m_pPreviews+i, m_pPreviews+i+1, (m_nCells-i)*sizeof(Preview *));
 }
 
-void Table::ClearPreviews()
+void Table::StartDecodes()
 {
-    if(m_nPreviews>0)
+    // не больше одной картинки на поток пула
+    uint16_t nMax = ThreadPool::Get()->GetThreadCount();
+
+    while(m_nDecoding < nMax && !m_pending.empty())
     {
-        for(uint16_t i=0; i<m_nPreviews; i++)
+        // очередной ожидающий образец; удаленные и уже загружаемые пропускаются
+        std::shared_ptr<Window*> preview = m_pending.front();
+        m_pending.pop_front();
+        Preview *pNext = reinterpret_cast<Preview *>(*preview);
+        if(!pNext || pNext->m_state != PREVIEW_WAITING)
+        {
+            continue;
+        }
+
+        // загрузка в пуле потоков; образец к ее окончанию мог быть удален
+        pNext->m_state = PREVIEW_LOADING;
+        ++m_nDecoding;
+        std::string filename(pNext->GetFilename());
+        Rect is = pNext->GetImageSize();
+        uint16_t w = is.GetWidth(), h = is.GetHeight();
+        RunInBackground([filename, w, h]() { return ImageCacheLoad(theGUI, filename.c_str(), w, h); },
+            [this, preview](IMAGEINFO &ii)
+            {
+                --m_nDecoding;
+                if(*preview)
+                {
+                    reinterpret_cast<Preview *>(*preview)->SetImage(ii);
+                    ii = nullptr;
+                }
+                StartDecodes();
+            },
+            [](IMAGEINFO &ii) { ImageRelease(ii); });
+    }
+}
+
+uint32_t Table::GetRowCount()
+{
+    return (m_nCells + m_nColumns - 1)/m_nColumns;
+}
+
+uint32_t Table::GetVisibleRows()
+{
+    return max(GetInteriorSize().GetHeight()/(m_nPreviewSize + GAP), 1);
+}
+
+void Table::SetTop(int64_t top)
+{
+    // последняя страница заполнена целиком
+    int64_t maxTop = (int64_t) GetRowCount() - GetVisibleRows();
+    top = min(top, maxTop);
+    m_top = max(top, 0);
+    m_pVBar->SetDataOrigin(min((uint64_t) m_top*(m_nPreviewSize + GAP), INT32_MAX));
+    UpdateVisible();
+}
+
+Point Table::GetCellPosition(uint32_t i)
+{
+    return Point(GAP + (i % m_nColumns)*(m_nPreviewSize + GAP), GAP + (i / m_nColumns - m_top)*(m_nPreviewSize + GAP));
+}
+
+void Table::Reposition()
+{
+    Rect is = GetInteriorSize();
+    uint16_t w = is.GetWidth() > SCROLLBAR_SIZE ? is.GetWidth()-SCROLLBAR_SIZE : 0;
+
+    // сколько образцов помещается в строке (хотя бы один)
+    m_nColumns = max(w/(m_nPreviewSize + GAP), 1);
+
+    // высота документа для шкалы прокрутки; положение в нем - номер строки (32 бита)
+    m_pVBar->SetTotal(min((uint64_t) GetRowCount()*(m_nPreviewSize + GAP) + GAP, INT32_MAX));
+    SetTop(m_top);    ReDraw();
+}
+
+// образцы есть только у клеток [m_from, m_to), поэтому перебираются только клетки у видимой области
+void Table::UpdateVisible()
+{
+    m_to = min(m_to, m_nCells);
+    m_from = min(m_from, m_to);
+
+    // строки таблицы, видимые в окне (последняя может быть видна частично)
+    int32_t step = m_nPreviewSize + GAP;
+    int64_t first = m_top;
+    int64_t last = first + (GetInteriorSize().GetHeight() + step - 1)/step;
+
+    // клетки, у которых создаются образцы, и клетки, у которых они сохраняются
+    auto cell = [this](int64_t row) { return (uint32_t) min((uint64_t) max(row, 0)*m_nColumns, m_nCells); };
+    uint32_t createFrom = cell(first - PREFETCH_ROWS), createTo = cell(last + PREFETCH_ROWS);
+    uint32_t keepFrom = cell(first - RELEASE_ROWS), keepTo = cell(last + RELEASE_ROWS);
+
+    // новый отрезок клеток с образцами: сохраняемая часть прежнего вместе с создаваемыми
+    uint32_t from = max(m_from, keepFrom), to = min(m_to, keepTo);
+    if(from >= to || to < createFrom || from > createTo)
+    {
+        from = createFrom;
+        to = createTo;
+    }
+    else
+    {
+        from = min(from, createFrom);
+        to = max(to, createTo);
+    }
+
+    // образцы далеко от видимой области удаляются вместе с картинками
+    for(uint32_t i=m_from; i<m_to; i++)
+    {
+        if(m_pPreviews[i] && (i < from || i >= to))
         {
             DeleteChild(m_pPreviews[i]);
+            m_pPreviews[i] = nullptr;
         }
+    }
 
-        free(m_pPreviews);
-        m_pPreviews = nullptr;
-        m_nPreviews = 0;
+    // видимые образцы загружаются раньше созданных заранее
+    std::vector<std::shared_ptr<Window*>> visible;
+    for(uint32_t i=from; i<to; i++)
+    {
+        int64_t row = i/m_nColumns;
+        bool bVisible = row >= first && row < last;
+        if(!m_pPreviews[i] && i >= createFrom && i < createTo)
+        {
+            m_pPreviews[i] = new Preview(m_pFiles[i],m_pMainWindow);
+            AddChild(m_pPreviews[i], Point(0,0), Rect(m_nPreviewSize, m_nPreviewSize));
+            if(bVisible)
+            {
+                visible.push_back(m_pPreviews[i]->GetLifetime());
+            }
+            else
+            {
+                m_pending.push_back(m_pPreviews[i]->GetLifetime());
+            }
+        }
+
+        // положение в окне - только у видимых образцов, остальные скрыты
+        if(m_pPreviews[i] && bVisible)
+        {
+            m_pPreviews[i]->SetPosition(GetCellPosition(i));
+            m_pPreviews[i]->Show();
+        }
+        else if(m_pPreviews[i])
+        {
+            m_pPreviews[i]->Hide();
+        }
     }
+    m_from = from;
+    m_to = to;
+    m_pending.insert(m_pending.begin(), visible.begin(), visible.end());
 
-    SetOrigin(Point(0,0));
+    if(!m_pending.empty())
+    {
+        StartDecodes();
+    }
 }
 
-Rect &Table::GetDataRect()
+void Table::ClearPreviews()
 {
-    return m_TableSize;
+    if(m_nCells>0)
+    {
+        for(uint32_t i=m_from; i<m_to; i++)
+        {
+            if(m_pPreviews[i])
+            {
+                DeleteChild(m_pPreviews[i]);
+            }
+        }
+
+        free(m_pFiles);
+        free(m_pPreviews);
+        m_pFiles = nullptr;
+        m_pPreviews = nullptr;
+        m_nCells = 0;
+    }
+    m_from = m_to = 0;
+    m_top = 0;
+    m_pending.clear();
 }
 
 uint16_t Table::GetPreviewSize()
@@ -417,12 +1012,21 @@ void Table::SetPreviewSize(uint16_t nPreviewSize)
 {
     m_nPreviewSize = nPreviewSize;
 
-    for(uint16_t i=0; i<m_nPreviews; i++)
+    // образцы, которые надо прочитать заново под больший размер, - снова в очередь
+    for(uint32_t i=m_from; i<m_to; i++)
     {
-        m_pPreviews[i]->SetPreviewSize(nPreviewSize);
+        if(m_pPreviews[i])
+        {
+            m_pPreviews[i]->SetPreviewSize(nPreviewSize);
+            if(m_pPreviews[i]->m_state == PREVIEW_WAITING)
+            {
+                m_pending.push_back(m_pPreviews[i]->GetLifetime());
+            }
+        }
     }
 
     Reposition();
+    StartDecodes();
 }
 
 Preview::Preview(const char *filename, MainWindow *pMainWindow)
@@ -430,45 +1034,53 @@ Preview::Preview(const char *filename, MainWindow *pMainWindow)
     m_ClassName = __FUNCTION__;
     m_filename = filename;
     m_pMainWindow = pMainWindow;
+    m_ii = nullptr;
+    m_state = PREVIEW_WAITING;
     SetFrameWidth(1);
 }
 
 Preview::~Preview()
 {
-    theGUI->DeletePNG(m_ii);
+    if(m_ii)
+    {
+        theGUI->DeletePNG(m_ii);
+    }
 }
 
 void Preview::OnCreate()
 {
-    m_ii = theGUI->LoadPNG(m_filename);
+    // до загрузки картинки (см. Table::StartDecodes) отображается заглушка
     Rect is = GetInteriorSize();
     uint16_t i_h = is.GetHeight()-PATH_HEIGHT;
 
-    m_pImage = new Image(m_ii);
+    m_pImage = new Image(nullptr);
+    m_pImage->SetBackColor(PLACEHOLDER_COLOR);
     AddChild(m_pImage, Point(0,0), Rect(is.GetWidth(),i_h));
     m_pText = new Text(m_filename);
     AddChild(m_pText,Point(0,i_h), Rect(is.GetWidth(),PATH_HEIGHT));
-
-    uint8_t style;
-    if(m_ii->height < i_h && m_ii->width < is.GetWidth())
-    {
-        style = IMAGE_SCALE_1_1|IMAGE_ALIGNH_CENTER|IMAGE_ALIGNV_CENTER;
-    }
-    else
-    {
-        style = IMAGE_SCALE_FIT|IMAGE_ALIGNH_CENTER|IMAGE_ALIGNV_CENTER;
-    }
-    m_pImage->SetStyle(style);
 }
 
 bool Preview::OnLeftMouseButtonDoubleClick(const Point &position)
 {
-    m_pMainWindow->DisplayImage(m_ii);
+    if(m_ii)
+    {
+        m_pMainWindow->DisplayImage(m_filename);
+    }
     return true;
 }
 
 void Preview::SetPreviewSize(uint16_t nPreviewSize)
 {
+    // картинка прочитана уменьшенной под прежний размер - при увеличении читаем заново
+    if(m_ii && nPreviewSize > GetSize().GetWidth())
+    {
+        Rect is = m_pImage->GetInteriorSize();
+        if(m_ii->width >= is.GetWidth() || m_ii->height >= is.GetHeight())
+        {
+            m_state = PREVIEW_WAITING;
+        }
+    }
+
     SetSize(Rect(nPreviewSize,nPreviewSize));
     Rect is = GetInteriorSize();
     uint16_t i_h = is.GetHeight()-PATH_HEIGHT;
@@ -477,8 +1089,49 @@ void Preview::SetPreviewSize(uint16_t nPreviewSize)
     m_pText->SetSize(Rect(is.GetWidth(),PATH_HEIGHT));
     m_pText->SetPosition(Point(0,i_h));
 
+    UpdateStyle();
+}
+
+void Preview::SetImage(IMAGEINFO ii)
+{
+    m_state = PREVIEW_READY;
+    if(!ii)
+    {
+        std::cerr << "Cannot load " << m_filename << std::endl;
+        return;
+    }
+
+    if(m_ii)
+    {
+        theGUI->DeletePNG(m_ii);
+    }
+    m_ii = ii;
+    m_pImage->SetImage(m_ii);
+    m_pImage->SetBackColor(GetBackColor());
+    UpdateStyle();
+    m_pImage->ReDraw();
+}
+
+const char *Preview::GetFilename()
+{
+    return m_filename;
+}
+
+Rect &Preview::GetImageSize()
+{
+    return m_pImage->GetInteriorSize();
+}
+
+void Preview::UpdateStyle()
+{
+    if(!m_ii)
+    {
+        return;
+    }
+
+    Rect is = m_pImage->GetInteriorSize();
     uint8_t style;
-    if(m_ii->height < i_h && m_ii->width < is.GetWidth())
+    if(m_ii->height < is.GetHeight() && m_ii->width < is.GetWidth())
     {
         style = IMAGE_SCALE_1_1|IMAGE_ALIGNH_CENTER|IMAGE_ALIGNV_CENTER;
     }
@@ -491,8 +1144,14 @@ void Preview::SetPreviewSize(uint16_t nPreviewSize)
 
 int main(int argc, char **argv)
 {
+    // просматриваемый каталог - он же корень индекса
+    if(argc > 1 && chdir(argv[1]) != 0)
+    {
+        std::cerr << "Cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+
     MainWindow *pWindow = new MainWindow;
-//    pWindow->m_filename = argc>0 ? argv[1] : nullptr;
 
     int res = Run(argc, argv, pWindow, WIN_WIDTH, WIN_HEIGHT);
 
@@ -501,195 +1160,574 @@ int main(int argc, char **argv)
     return res;
 }
 
-void mysort(char **strings, uint16_t n);
-bool gt(char *s1, char *s2);
-uint32_t GetSymbolUTF8(char *s, uint16_t *p);
+static LISTING *NewListing(uint32_t n, size_t size)
+{
+    LISTING *pListing = new LISTING;
+    pListing->items.resize(n);
+    pListing->lower.resize(size);
+    return pListing;
+}
 
-void MainWindow::CreateList(const char * dir)
+// элемент i; имя копируется, имя в нижнем регистре дописывается в область с места *pOffset
+static void SetListingItem(LISTING *pListing, uint32_t i, uint32_t *pOffset,
+                           const char *name, uint32_t length, uint8_t type, uint8_t format)
 {
-    chdir(dir);
-    strcpy(m_path, get_current_dir_name());
-    m_pText->SetText(m_path);
-    m_pList->Clear();
+    ITEM &item = pListing->items[i];
+    item.name = strdup(name);
+    item.lower = *pOffset;
+    item.length = length;
+    item.type = type;
+    item.format = format;
+    CollateFold(name, length, pListing->lower.data() + *pOffset);
+    *pOffset += length;
+}
 
-    if(m_n>0)
+// чтение каталога path в пуле потоков: элементы в порядке показа с типами (каталог, PNG)
+// и имена в нижнем регистре для фильтра
+static LISTING *ReadDirectory(const std::string &path)
+{
+    DIRSCAN ds = DirScan(path.c_str(), DIRSCAN_PROBE|DIRSCAN_SKIP_DOT);
+    if(!ds)
     {
-        for(uint16_t i=0; i< m_n; i++)
+        std::cerr << "Cannot open " << path << std::endl;
+        return nullptr;
+    }
+
+    // сортировка: каталоги первыми, без учета регистра, числа по значению
+    DirScanSort(ds);
+
+    size_t size = 0;
+    for(uint32_t i=0; i<ds->n; i++)
+    {
+        size += ds->entries[i].length;
+    }
+    LISTING *pListing = NewListing(ds->n, size);
+    uint32_t offset = 0;
+    for(uint32_t i=0; i<ds->n; i++)
+    {
+        const DIRENTRY &e = ds->entries[i];
+        SetListingItem(pListing, i, &offset, e.name, e.length, e.type, e.format);
+    }
+    DirScanFree(ds);
+    return pListing;
+}
+
+// элементы каталога entry из индекса - без обращений к диску, кроме отображенного индекса
+static LISTING *ReadIndex(const std::shared_ptr<struct _DIRINDEX> &index, uint32_t entry)
+{
+    const INDEXENTRY &d = index->entries[entry];
+    size_t size = 0;
+    for(uint32_t i=0; i<d.n; i++)
+    {
+        size += index->entries[d.first + i].length;
+    }
+    LISTING *pListing = NewListing(d.n, size);
+    uint32_t offset = 0;
+    for(uint32_t i=0; i<d.n; i++)
+    {
+        const INDEXENTRY &e = index->entries[d.first + i];
+        SetListingItem(pListing, i, &offset, index->names + e.name, e.length, e.type, e.format);
+    }
+    return pListing;
+}
+
+// переход в dir и полный путь текущего каталога в path; если текущий каталог удален (например,
+// удалили наблюдаемый каталог), переходим в ближайший существующий каталог выше прежнего пути path
+static void ChangeCurrentDir(const char *dir, char *path, size_t size)
+{
+    chdir(dir);
+    char *cwd = get_current_dir_name();
+    while(!cwd && strcmp(path, "/"))
+    {
+        char *slash = strrchr(path, '/');
+        if(slash && slash != path)
+        {
+            *slash = 0;
+        }
+        else
+        {
+            strcpy(path, "/");
+        }
+        if(chdir(path) == 0)
         {
-            free(m_names[i]);
+            cwd = get_current_dir_name();
         }
-        free(m_names);
-        m_names = nullptr;
-        m_n = 0;
     }
+    if(cwd)
+    {
+        snprintf(path, size, "%s", cwd);
+        free(cwd);
+    }
+}
 
-    // см. dirwalk() в книге Керниган, Ричи "Язык программирования Си", раздел 8.6
-    char name[MAX_PATH];
-    struct dirent *dp;
-    DIR *dfd;
+static void FreeListing(LISTING *pListing)
+{
+    if(!pListing)
+    {
+        return;
+    }
+    for(ITEM &item : pListing->items)
+    {
+        free(item.name);
+    }
+    delete pListing;
+}
+
+uint32_t MainWindow::GetRowCount()
+{
+    return m_rows.size();
+}
+
+uint8_t MainWindow::GetFileType(uint32_t row)
+{
+    return m_items[m_rows[row]].format;
+}
 
-    if ((dfd = opendir(m_path)) == NULL)
+const char *MainWindow::GetRowName(uint32_t row)
+{
+    return m_items[m_rows[row]].name;
+}
+
+void MainWindow::ClearItems()
+{
+    for(ITEM &item : m_items)
+    {
+        free(item.name);
+    }
+    m_items.clear();
+    m_lower.clear();
+    m_lowerGarbage = 0;
+}
+
+void MainWindow::SetListing(LISTING *pListing)
+{
+    // строки списка и клетки таблицы ссылаются на элементы - убираются раньше них
+    m_rows.clear();
+    m_pList->SetRowCount(0);
+    m_pTable->Update();
+    ClearItems();
+    if(!pListing)
     {
-        std::cerr << "Cannot open " << dir << std::endl;;
         return;
     }
-    while ((dp = readdir(dfd)) != NULL)
+
+    m_items.swap(pListing->items);
+    m_lower.swap(pListing->lower);
+    delete pListing;
+
+    // строки списка - по текущему фильтру; образцы разбираются в паузах главного цикла
+    FilterRows(false);
+    m_pTable->Update();
+}
+
+Task<void> MainWindow::OpenIndex()
+{
+    // индекс проверяется целиком при открытии - в пуле потоков
+    std::string root(m_root);
+    DIRINDEX index = co_await Background([root]() { return DirIndexOpen(root.c_str()); });
+    if(index)
+    {
+        m_index.reset(index, DirIndexClose);
+    }
+
+    CreateList(".");
+
+    // индекса нет или он устарел - строится в фоне с проверкой всех файлов; до этого каталоги
+    // читаются с диска
+    if(!m_index || time(nullptr) - m_index->built > INDEX_MAX_AGE)
     {
-        if(!strcmp(dp->d_name, "."))
+        UpdateIndex(true);
+    }
+}
+
+Task<void> MainWindow::UpdateIndex(bool bFiles)
+{
+    if(m_bIndexing)
+    {
+        co_return;
+    }
+    m_bIndexing = true;
+
+    // с прежним индексом перечитываются только изменившиеся каталоги (и с bFiles - изменившиеся файлы)
+    std::string root(m_root);
+    std::shared_ptr<struct _DIRINDEX> previous = m_index;
+    bool bBuilt = co_await Background([root, previous, bFiles]() { return DirIndexBuild(root.c_str(), previous.get(), bFiles); });
+    if(bBuilt)
+    {
+        DIRINDEX index = co_await Background([root]() { return DirIndexOpen(root.c_str()); });
+        if(index)
         {
-            continue;
+            // прежний индекс закрывается, когда его перестанут читать (ReadIndex)
+            m_index.reset(index, DirIndexClose);
+        }
+    }
+    m_bIndexing = false;
+}
+
+Task<void> MainWindow::CreateList(const char * dir)
+{
+    ChangeCurrentDir(dir, m_path, sizeof(m_path));
+    m_pText->SetText(m_path);
+    SetListing(nullptr);
+
+    // изменения каталога наблюдаются с начала чтения и применяются, когда список готов:
+    // ничего не теряется, а повторы безвредны
+    m_changes.clear();
+    m_bListed = false;
+    m_watch.Start(m_path, [this](const DIRCHANGE *changes, uint32_t n) { OnDirChanged(changes, n); });
+
+    // каталог читается в пуле потоков; если за это время начато чтение другого каталога,
+    // результат отбрасывается
+    uint32_t nList = ++m_nList;
+    std::string path(m_path);
+
+    // каталог из индекса показывается сразу, а затем проверяется: если с построения индекса
+    // в нем добавлялись или удалялись элементы (изменилось время изменения каталога),
+    // он перечитывается с диска, а индекс обновляется в фоне
+    uint32_t entry;
+    char real[PATH_MAX];
+    std::shared_ptr<struct _DIRINDEX> index = m_index;
+    if(index && realpath(m_path, real) && DirIndexLookup(index.get(), real, &entry))
+    {
+        int64_t mtime = index->entries[entry].mtime;
+        LISTING *pListing = co_await Background([index, entry]() { return ReadIndex(index, entry); });
+        if(nList != m_nList)
+        {
+            FreeListing(pListing);
+            co_return;
         }
-        if (strlen(dir)+strlen(dp->d_name) + 2 > sizeof(name))
+        SetListing(pListing);
+        m_bListed = true;
+        if(!m_changes.empty() && !m_bApplying)
         {
-            std::cerr << "Name " << dir << "/" << dp->d_name << "is too long" << std::endl;
+            ApplyChanges();
         }
-        else {
-            if(m_n==0)
-            {
-                m_names = (char**) malloc(sizeof(char*));
-            }
-            else
+
+        bool bChanged = co_await Background([path, mtime]()
             {
-                m_names = (char**) realloc(m_names, (m_n+1)*sizeof(char*));
-            }
-            m_names[m_n] = (char*) malloc(strlen(dp->d_name)+1);
-            strcpy(m_names[m_n],dp->d_name);
-            ++m_n;
+                struct stat st;
+                return stat(path.c_str(), &st) != 0 || (int64_t) st.st_mtim.tv_sec*1000000000 + st.st_mtim.tv_nsec != mtime;
+            });
+        if(nList != m_nList || !bChanged)
+        {
+            co_return;
         }
+        UpdateIndex();
+
+        // изменения, поступившие с этого момента, применяются к прочитанному списку
+        m_bListed = false;
     }
-    closedir(dfd);
 
-    // сортировка
-    mysort(m_names, m_n);
+    LISTING *pListing = co_await Background([path]() { return ReadDirectory(path); });
 
-    // добавляю в список
-    for(uint16_t i=0; i<m_n; i++)
+    if(nList != m_nList || !pListing)
     {
-        Text *pText = new Text(m_names[i]);
-        struct stat stbuf;
-        void *value = 0;
-        char name[MAX_PATH];
-        if (strlen(m_path)+strlen(m_names[i]) + 2 > sizeof(name))
+        FreeListing(pListing);
+        co_return;
+    }
+
+    SetListing(pListing);
+
+    m_bListed = true;
+    if(!m_changes.empty() && !m_bApplying)
+    {
+        ApplyChanges();
+    }
+}
+
+
+void MainWindow::SetFilter(const char *text)
+{
+    bool bPrefix = text[0] == '^';
+    std::string filter(bPrefix ? text+1 : text);
+    CollateFold(filter.data(), filter.size(), filter.data());
+
+    // имя, проходящее новый фильтр, проходило и прежний, если прежний образец содержится в новом
+    // (образец начала имени - если новый образец тоже начала имени и начинается с прежнего):
+    // тогда перебираются только прежние строки
+    bool bNarrow = (!m_bPrefix && filter.find(m_filter) != std::string::npos)
+        || (m_bPrefix && bPrefix && filter.compare(0, m_filter.size(), m_filter) == 0);
+    m_filter = std::move(filter);
+    m_bPrefix = bPrefix;
+    FilterRows(bNarrow);
+
+    // клетки таблицы - по новым строкам; загруженные образцы не перечитываются
+    m_pTable->Filter();
+}
+
+bool MainWindow::Matches(const ITEM &item)
+{
+    if(m_filter.empty())
+    {
+        return true;
+    }
+    const char *lower = m_lower.data() + item.lower;
+    if(m_bPrefix)
+    {
+        return item.length >= m_filter.size() && !memcmp(lower, m_filter.data(), m_filter.size());
+    }
+    return SearchText(lower, item.length, m_filter.data(), m_filter.size()) != nullptr;
+}
+
+void MainWindow::FilterRows(bool bNarrow)
+{
+    if(bNarrow)
+    {
+        uint32_t k = 0;
+        for(uint32_t i : m_rows)
         {
-            std::cerr << "Name " << m_path << "/" << m_names[i] << "is too long" << std::endl;
+            if(Matches(m_items[i]))
+            {
+                m_rows[k++] = i;
+            }
         }
-        else
+        m_rows.resize(k);
+    }
+    else
+    {
+        m_rows.clear();
+        for(uint32_t i=0; i<m_items.size(); i++)
         {
-            strcpy(name,m_path);
-            strcat(name,"/");
-            strcat(name,m_names[i]);
-
-            if(stat(name, &stbuf) != -1 && (stbuf.st_mode & S_IFMT) == S_IFDIR)
+            if(Matches(m_items[i]))
             {
-                value = (void *)1;
-                pText->SetFont(NULL, -1, TEXT_STYLE_BOLD, -1);
+                m_rows.push_back(i);
             }
         }
-        m_pList->Insert(m_n, pText, value);
     }
 
-    // обновим образцы
-    m_pTable->Update();
+    // список рисует только видимые строки
+    m_pList->SetRowCount(m_rows.size());
+    m_pList->SetSelection(-1);
+    m_pList->ScrollTo(0);
 }
 
-// сортировка массива строк
-void mysort(char **strings, uint16_t n)
+void MainWindow::OnDirChanged(const DIRCHANGE *changes, uint32_t n)
 {
-    for(uint16_t i=0; i<n; i++)
+    for(uint32_t i=0; i<n; i++)
     {
-        for(uint16_t j=0; j<n-i-1; j++)
+        const DIRCHANGE &c = changes[i];
+        if(c.event == DIRWATCH_RESCAN)
+        {
+            // события потеряны: перечитываем каталог (текущий каталог следует за ним и при перемещении)
+            CreateList(".");
+            return;
+        }
+
+        // запись в файл, который еще ожидает применения, ничего не меняет: тип определится позже
+        if(c.event == DIRWATCH_WRITTEN)
         {
-            if(gt(strings[j],strings[j+1]))
+            bool bPending = false;
+            for(size_t j=m_changes.size(); j>0 && !bPending; j--)
             {
-                char *tmp = strings[j];
-                strings[j] = strings[j+1];
-                strings[j+1] = tmp;
+                const ENTRYCHANGE &p = m_changes[j-1];
+                bPending = (p.event == DIRWATCH_ADDED || p.event == DIRWATCH_WRITTEN) && p.name == c.name;
             }
+            if(bPending)
+            {
+                continue;
+            }
+        }
+
+        ENTRYCHANGE ec;
+        ec.event = c.event;
+        ec.type = DIRSCAN_OTHER;
+        ec.format = FILETYPE_UNKNOWN;
+        ec.bExists = false;
+        ec.name = c.name;
+        if(c.newName)
+        {
+            ec.newName = c.newName;
         }
+        m_changes.push_back(std::move(ec));
+    }
+
+    if(m_bListed && !m_bApplying)
+    {
+        ApplyChanges();
     }
 }
 
-// сравнение двух строк UTF8
-bool gt(char *s1, char *s2)
+// тип и содержимое добавленных и измененных элементов - в пуле потоков, одним пакетом
+static void ProbeChanges(const std::string &path, std::vector<ENTRYCHANGE> &changes)
 {
-    uint16_t p1 = 0, p2 = 0;
-
-    // пока строки не закончились
-    while(s1[p1] && s2[p2])
+    int dirfd = open(path.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(dirfd < 0)
     {
-        // достаем символы
-        uint32_t c1 = GetSymbolUTF8(s1,&p1);
-        uint32_t c2 = GetSymbolUTF8(s2,&p2);
+        return;
+    }
 
-        // сравниваем
-        if(c1 > c2)
+    std::vector<const char *> names;
+    std::vector<ENTRYCHANGE *> files;
+    for(ENTRYCHANGE &c : changes)
+    {
+        if(c.event == DIRWATCH_REMOVED)
         {
-            return true;
+            continue;
         }
-        else if(c1 < c2)
+        const char *name = c.event == DIRWATCH_RENAMED ? c.newName.c_str() : c.name.c_str();
+        struct stat st;
+        c.bExists = fstatat(dirfd, name, &st, 0) == 0;
+        if(!c.bExists)
         {
-            return false;
+            continue;
+        }
+        c.type = S_ISDIR(st.st_mode) ? DIRSCAN_DIR : S_ISREG(st.st_mode) ? DIRSCAN_FILE : DIRSCAN_OTHER;
+        if(c.type == DIRSCAN_FILE)
+        {
+            names.push_back(name);
+            files.push_back(&c);
         }
     }
 
-    // какая строка длиннее - та и больше
-    if(s1[p1])
+    std::vector<uint8_t> formats(names.size());
+    FileProbe(dirfd, names.data(), names.size(), formats.data());
+    for(size_t i=0; i<files.size(); i++)
     {
-        return true;
+        files[i]->format = formats[i];
     }
-    else if(s2[p2])
+    close(dirfd);
+}
+
+Task<void> MainWindow::ApplyChanges()
+{
+    // изменения применяются порциями по одной, в порядке поступления
+    m_bApplying = true;
+    while(m_bListed && !m_changes.empty())
     {
-        return false;
+        std::vector<ENTRYCHANGE> changes;
+        changes.swap(m_changes);
+        uint32_t nList = m_nList;
+        std::string path(m_path);
+        co_await Background([path, &changes]() { ProbeChanges(path, changes); });
+
+        // пока определялись типы, мог быть открыт другой каталог
+        if(nList != m_nList)
+        {
+            continue;
+        }
+
+        for(const ENTRYCHANGE &c : changes)
+        {
+            const char *name = c.name.c_str();
+            if(c.event == DIRWATCH_WRITTEN)
+            {
+                // содержимое изменилось: образец читается заново; прочие файлы - только если изменился тип
+                uint32_t i;
+                if(FindEntry(name, c.type == DIRSCAN_DIR, &i) && c.bExists && c.format != FILETYPE_PNG
+                    && m_items[i].type == c.type && m_items[i].format == c.format)
+                {
+                    continue;
+                }
+            }
+
+            DeleteEntry(name);
+            if(c.bExists)
+            {
+                AddEntry(c.event == DIRWATCH_RENAMED ? c.newName.c_str() : name, c.type, c.format);
+            }
+        }
+        m_pTable->OnEntriesChanged();
+        ReDraw();
     }
+    m_bApplying = false;
+}
 
-    // строки равны
-    return false;
+bool MainWindow::FindEntry(const char *name, bool bDir, uint32_t *pos)
+{
+    // элементы упорядочены так же, как при чтении каталога (DirScanSort)
+    uint32_t lo = 0, hi = m_items.size();
+    while(lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo)/2;
+        if(CollateCompare(name, bDir, m_items[mid].name, m_items[mid].type == DIRSCAN_DIR) > 0)
+        {
+            lo = mid + 1;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+    *pos = lo;
+    return lo < m_items.size() && !strcmp(m_items[lo].name, name);
 }
 
-// чтение символа UTF8 из строки
-uint32_t GetSymbolUTF8(char *s, uint16_t *p)
+void MainWindow::AddEntry(const char *name, uint8_t type, uint8_t format)
 {
-    uint32_t res = 0, tmp = 0;
+    uint32_t i;
+    if(FindEntry(name, type == DIRSCAN_DIR, &i))
+    {
+        return;
+    }
 
-    if((s[*p] & 0x80) == 0x00)
+    ITEM item;
+    item.name = strdup(name);
+    item.lower = m_lower.size();
+    item.length = strlen(name);
+    item.type = type;
+    item.format = format;
+    m_lower.resize(m_lower.size() + item.length);
+    CollateFold(name, item.length, m_lower.data() + item.lower);
+    m_items.insert(m_items.begin() + i, item);
+
+    // номера элементов после вставленного увеличились
+    auto pos = std::lower_bound(m_rows.begin(), m_rows.end(), i);
+    for(auto it=pos; it!=m_rows.end(); ++it)
     {
-        // UTF-8: ASCII (8 bits)
-        res = s[*p];
-        ++*p;
+        ++*it;
     }
-    else if((s[*p] & 0xe0) == 0xc0)
+    if(Matches(m_items[i]))
     {
-        // UTF-8: 16 bits
-        res = s[*p] & 0x1f;
-        res <<= 6;
-        res |= s[*p+1] & 0x3f;
-        *p += 2;
+        uint32_t row = pos - m_rows.begin();
+        m_rows.insert(pos, i);
+        m_pList->InsertRows(row, 1);
+        m_pTable->OnEntryInserted(row);
     }
-    else if((s[*p] & 0xf0) == 0xe0)
+}
+
+void MainWindow::DeleteEntry(const char *name)
+{
+    // положение зависит от того, каталог ли это
+    uint32_t i;
+    if(!FindEntry(name, false, &i) && !FindEntry(name, true, &i))
     {
-        // UTF-8: 24 bits
-        res = s[*p] & 0x0f;
-        res <<= 12;
-        tmp = s[*p+1] & 0x3f;
-        tmp <<= 6;
-        res |= tmp;
-        res |= s[*p+2] & 0x3f;
-        *p += 3;
+        return;
     }
-    else if((s[*p] & 0xf8) == 0xf0)
+
+    auto pos = std::lower_bound(m_rows.begin(), m_rows.end(), i);
+    if(pos != m_rows.end() && *pos == i)
     {
-        // UTF-8: 32 bits
-        res = s[*p] & 0x07;
-        res <<= 18;
-        tmp = s[*p+1] & 0x3f;
-        tmp <<= 12;
-        res |= tmp;
-        tmp = s[*p+2] & 0x3f;
-        tmp <<= 6;
-        res |= tmp;
-        res |= s[*p+3] & 0x3f;
-        *p += 4;
+        // клетка таблицы ссылается на имя элемента - удаляется раньше него
+        uint32_t row = pos - m_rows.begin();
+        m_pTable->OnEntryDeleting(row);
+        pos = m_rows.erase(pos);
+        m_pList->DeleteRows(row, 1);
+    }
+    // номера элементов после удаленного уменьшились
+    for(auto it=pos; it!=m_rows.end(); ++it)
+    {
+        --*it;
     }
 
-    return res;
+    m_lowerGarbage += m_items[i].length;
+    free(m_items[i].name);
+    m_items.erase(m_items.begin() + i);
+    if(m_lowerGarbage > m_lower.size()/2)
+    {
+        CompactLower();
+    }
+}
+
+void MainWindow::CompactLower()
+{
+    std::vector<char> lower(m_lower.size() - m_lowerGarbage);
+    uint32_t offset = 0;
+    for(ITEM &item : m_items)
+    {
+        memcpy(lower.data() + offset, m_lower.data() + item.lower, item.length);
+        item.lower = offset;
+        offset += item.length;
+    }
+    m_lower.swap(lower);
+    m_lowerGarbage = 0;
 }
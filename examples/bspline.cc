@@ -1,5 +1,11 @@
 // bspline.cc
 
+#include <coroutine>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <functional>
+#include <memory>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
@@ -7,6 +13,8 @@
 #include <cassert>
 #include <vector>
 #include "window.h"
+#include "mainloop.h"
+#include "task.h"
 #include "image.h"
 #include "text.h"
 #include "button.h"
@@ -157,7 +165,8 @@ public:
     bool OnKeyPress(uint64_t value);
     void OnSizeChanged();
     void OnNotify(Window *child, uint32_t type, const Point &position);
-    void LoadPoints();
+    Task<void> OnLoad();                // чтение файла полюсов без блокировки интерфейса
+    void LoadPoints(std::istream &input);
     void SetState(int state);
 
 private:
@@ -169,6 +178,7 @@ private:
     Bottom  *m_pBottom;
 
     uint16_t m_state;
+    bool    m_bLoading;     // файл полюсов читается
 public:
     Drawing *m_pDrawing;
     char m_filename[FILENAME_LENGTH+1];
@@ -347,6 +357,7 @@ MainWindow::MainWindow()
 
     m_npoints = 0;
     m_state = STATE_FILE;
+    m_bLoading = false;
     strcpy(m_filename,"bspline.points");
     m_degree = 3;
     m_pBspline = nullptr;
@@ -480,13 +491,10 @@ void MainWindow::OnNotify(Window *child, uint32_t type, const Point &position)
     if(child == m_pDlg1 && type == EVENT_LOAD)
     {
         // загрузим точки
-        LoadPoints();
-        if(m_npoints>2)
+        if(!m_bLoading)
         {
-            SetState(STATE_PARAMS);
-            ReDraw();
+            OnLoad();
         }
-        CaptureKeyboard(this);
     }
     else if(child == m_pDlg1 && type == EVENT_INTERACTIVE_START)
     {
@@ -558,15 +566,33 @@ void MainWindow::OnNotify(Window *child, uint32_t type, const Point &position)
     }
 }
 
-void MainWindow::LoadPoints()
+Task<void> MainWindow::OnLoad()
 {
-    std::ifstream input(m_filename,std::ios::in);
-    if(!input.good())
+    // файл читается в пуле потоков, продолжение - в главном потоке
+    m_bLoading = true;
+    std::optional<std::string> data = co_await ReadFile(m_filename);
+    m_bLoading = false;
+
+    if(data)
+    {
+        std::istringstream input(*data);
+        LoadPoints(input);
+    }
+    else
     {
         std::cerr << "Файл " << m_filename << " не открыт" << std::endl;
-        return;
     }
 
+    if(m_npoints>2)
+    {
+        SetState(STATE_PARAMS);
+        ReDraw();
+    }
+    CaptureKeyboard(this);
+}
+
+void MainWindow::LoadPoints(std::istream &input)
+{
     double x, y;
     int n = 0;
     while(input >> x >> y)
@@ -591,7 +617,6 @@ void MainWindow::LoadPoints()
         m_points[i][0] = x;
         m_points[i][1] = y;
     }
-    input.close();
     std::cout << "Из файла " << m_filename << " прочитано " << n << " точек" << std::endl;
 }
 
@@ -0,0 +1,152 @@
+#include <iostream>
+#include <cstring>
+
+#include "window.h"
+#include "textedit.h"
+#include "GUI.h"
+
+#define WIN_WIDTH   800
+#define WIN_HEIGHT  500
+#define BUFSIZE     (1<<16)
+#define KEY_SAVE    0x13        // Ctrl+S
+
+// Редактор текстового файла: Ctrl+S - запись, Esc - выход из редактирования, затем q - выход,
+// Enter - возврат к редактированию.
+
+class MainWindow : public Window
+{
+public:
+    MainWindow() : m_bWarned(false) {}
+    ~MainWindow() {}
+
+    void OnCreate();
+    bool OnKeyPress(uint64_t value);
+    void OnSizeChanged();
+    void OnNotify(Window *child, uint32_t type, const Point &position);
+
+public:
+    char *m_filename;
+
+private:
+    bool Load();
+    bool Save();
+
+    TextEdit *m_pEdit;
+    bool      m_bWarned;    // о несохраненном тексте предупредили, следующее q - выход
+};
+
+void MainWindow::OnCreate()
+{
+    m_pEdit = new TextEdit;
+    m_pEdit->SetFont("Monospace", 12);
+    AddChild(m_pEdit, Point(0,0), GetInteriorSize());
+    if(!Load())
+    {
+        std::cout << "Не удалось открыть файл " << (m_filename ? m_filename : "") << std::endl;
+    }
+    CaptureKeyboard(m_pEdit);
+}
+
+void MainWindow::OnSizeChanged()
+{
+    m_pEdit->SetSize(GetInteriorSize());
+}
+
+void MainWindow::OnNotify(Window *child, uint32_t type, const Point &position)
+{
+    if(child == m_pEdit && type == EVENT_TEXTEDIT_KEY)
+    {
+        OnKeyPress(position.GetX());
+    }
+}
+
+bool MainWindow::OnKeyPress(uint64_t keyval)
+{
+    switch(keyval)
+    {
+    case 'q':
+        if(m_pEdit->IsModified() && !m_bWarned)
+        {
+            std::cout << "Текст изменен: Ctrl+S - записать, q - выход без записи" << std::endl;
+            m_bWarned = true;
+            return true;
+        }
+        DeleteMe();
+        return true;
+    case KEY_SAVE:
+        if(!Save())
+        {
+            std::cout << "Не удалось записать файл " << (m_filename ? m_filename : "") << std::endl;
+        }
+        return true;
+    case KEY_Return:
+        // возврат к редактированию; после новых изменений предупредить снова
+        m_bWarned = false;
+        CaptureKeyboard(m_pEdit);
+        return true;
+    default:
+        return true;
+    }
+}
+
+// файл читается целиком, кусками по BUFSIZE
+bool MainWindow::Load()
+{
+    FILE *in = m_filename ? fopen(m_filename,"r") : nullptr;
+    if(!in)
+    {
+        return false;
+    }
+    size_t size = 0, bufsize = BUFSIZE;
+    char *buf = (char *) malloc(bufsize);
+    size_t s;
+    while((s = fread(buf+size, sizeof(char), BUFSIZE, in)) > 0)
+    {
+        size += s;
+        if(size+BUFSIZE > bufsize)
+        {
+            bufsize *= 2;
+            buf = (char *) realloc(buf, bufsize);
+        }
+    }
+    fclose(in);
+    bool res = m_pEdit->SetText(buf, size);
+    free(buf);
+    return res;
+}
+
+bool MainWindow::Save()
+{
+    FILE *out = m_filename ? fopen(m_filename,"w") : nullptr;
+    if(!out)
+    {
+        return false;
+    }
+    char *buf = (char *) malloc(BUFSIZE);
+    uint32_t size = m_pEdit->GetTextSize();
+    bool res = true;
+    for(uint32_t position=0; position<size && res; position+=BUFSIZE)
+    {
+        uint32_t s = m_pEdit->GetText(position, BUFSIZE, buf);
+        res = fwrite(buf, sizeof(char), s, out) == s;
+    }
+    free(buf);
+    res = fclose(out) == 0 && res;
+    if(res)
+    {
+        m_pEdit->SetModified(false);
+    }
+    return res;
+}
+
+int main(int argc, char **argv)
+{
+    MainWindow *pWindow = new MainWindow;
+    pWindow->m_filename = argc>1 ? argv[1] : nullptr;
+
+    int res = Run(argc, argv, pWindow, WIN_WIDTH, WIN_HEIGHT);
+
+    delete pWindow;
+
+    return res;
+}
@@ -32,6 +32,7 @@ public:
 private:
     Text *m_pHeader, *m_pA, *m_pB, *m_pC, *m_pSolution;
     Edit *m_pValueA, *m_pValueB, *m_pValueC;
+    TextButton *m_pSolve, *m_pClose;
 };
 
 void MainWindow::OnDraw(Context *cr)
@@ -93,8 +94,10 @@ void MainWindow::OnCreate()
     m_pSolution->SetAlignment(TEXT_ALIGNH_CENTER|TEXT_ALIGNV_CENTER);
     m_pSolution->SetWrap(true);
 
-    AddChild(new TextButton("Решить",EVENT_SOLVE), Point(150, 310), Rect(100,30));
-    AddChild(new TextButton("Закрыть",EVENT_CLOSE), Point(350, 310), Rect(100,30));
+    m_pSolve = new TextButton("Решить",EVENT_SOLVE);
+    AddChild(m_pSolve, Point(150, 310), Rect(100,30));
+    m_pClose = new TextButton("Закрыть",EVENT_CLOSE);
+    AddChild(m_pClose, Point(350, 310), Rect(100,30));
 
     CaptureKeyboard(this);
 }
@@ -107,11 +110,12 @@ bool MainWindow::OnLeftMouseButtonClick(const Point &position)
 
 void MainWindow::OnNotify(Window *child, uint32_t type, const Point &position)
 {
-    if(type == EVENT_CLOSE)
+    // номера событий кнопок совпадают с номерами событий полей ввода (EVENT_EDIT_*)
+    if(child == m_pClose && type == EVENT_CLOSE)
     {
         DeleteMe();
     }
-    else if(type == EVENT_SOLVE)
+    else if(child == m_pSolve && type == EVENT_SOLVE)
     {
         Solve();
     }
@@ -1,61 +1,233 @@
 #include <iostream>
 #include <cstring>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <functional>
+#include <unistd.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
 
 #include "window.h"
 #include "text.h"
-#include "scroll.h"
+#include "edit.h"
+#include "mainloop.h"
+#include "textsearch.h"
+#include "utf8.h"
 #include "GUI.h"
 
-#define WIN_WIDTH   800
-#define WIN_HEIGHT  500
-#define BUFSIZE     4096
+#define WIN_WIDTH       800
+#define WIN_HEIGHT      500
+#define BUFSIZE         4096
+#define SEARCH_HEIGHT   24          // строка поиска внизу окна
+#define STATUS_WIDTH    300         // состояние поиска справа от нее
+#define SEARCH_BLOCK    (4<<20)     // часть файла, после которой найденное передается в главный поток
+#define SEARCH_MAX_HITS (1<<20)     // больше не ищется
+
+// view [-f] файл
+// -f: слежение за файлом (как tail -f): дописанное в файл добавляется в конец текста
+// Поиск: / - подстрока, r - регулярное выражение (POSIX), Enter - начать, n и N - к следующему
+// и предыдущему найденному. Файл читается и ищется в пуле потоков по частям, найденное
+// подсвечивается по мере поступления.
+
+// найденное: смещение и длина - в байтах, номер строки и столбца (в символах) - с нуля
+typedef struct _SEARCHHIT
+{
+    uint64_t offset;
+    uint32_t length;
+    uint32_t line;
+    uint32_t column;
+} SEARCHHIT;
+
+typedef std::function<void(std::vector<SEARCHHIT> &hits)> SEARCHFN;
 
 char *GetFile(const char *filename);
+static void ReplaceInvalid(char *s, uint32_t length);
+static void SearchFile(int fd, size_t size, const std::string &pattern, const regex_t *re,
+    const std::atomic<bool> &stop, SEARCHFN fn);
 
 class MainWindow : public Window
 {
 public:
-    MainWindow() {}
-    ~MainWindow() {}
+    MainWindow() { m_bFollow = false; m_fd = m_inotify = -1; m_source = 0; m_nSearch = 0; m_current = -1; m_bLimited = false; }
+    ~MainWindow();
 
     void OnCreate();
     bool OnKeyPress(uint64_t value);
     void OnSizeChanged();
+    void OnNotify(Window *child, uint32_t type, const Point &position);
 
 public:
     char *m_filename;
+    bool m_bFollow;
 
 private:
+    bool StartFollow(off_t offset);
+    void OnFileChanged();
+    void StartSearch(const char *pattern, bool bRegex);
+    void CancelSearch();
+    void AddHits(std::vector<SEARCHHIT> &hits);
+    void GoToHit(int32_t index);
+    void ShowStatus(const char *message=nullptr);
+
     Text *m_pText;
-    Scroll *m_pScroll;
+    Edit *m_pSearch;
+    Text *m_pStatus;
+    bool m_bRegex;                      // строка поиска - регулярное выражение
+    uint32_t m_nSearch;                 // номер поиска: найденное прежними отбрасывается
+    std::shared_ptr<std::atomic<bool>> m_stop;  // прекратить текущий поиск
+    bool m_bSearching;
+    bool m_bLimited;                    // файл длиннее UINT32_MAX: ищется только его начало
+    std::vector<SEARCHHIT> m_hits;
+    int32_t m_current;                  // текущее найденное; -1 - нет
+    int m_fd, m_inotify;                // читаемый файл и наблюдение inotify за ним
+    uint32_t m_source;                  // наблюдение главного цикла за m_inotify
+    off_t m_offset;                     // прочитано из файла
+    char m_buf[BUFSIZE+4];              // в начале - неполный символ UTF-8 из прошлого чтения
+    uint32_t m_pending;
 };
 
+MainWindow::~MainWindow()
+{
+    if(m_stop)
+    {
+        *m_stop = true;
+    }
+    UnwatchFd(m_source);
+    if(m_inotify >= 0)
+    {
+        close(m_inotify);
+    }
+    if(m_fd >= 0)
+    {
+        close(m_fd);
+    }
+}
+
 void MainWindow::OnCreate()
 {
 	Rect mysize = GetInteriorSize();
 
-	m_pScroll = new Scroll;
-	AddChild(m_pScroll, Point(0,0), mysize);
+    m_pSearch = new Edit;
+    m_pSearch->SetFrameWidth(1);
+    AddChild(m_pSearch, Point(0,mysize.GetHeight()-SEARCH_HEIGHT), Rect(mysize.GetWidth()-STATUS_WIDTH,SEARCH_HEIGHT));
+    m_pStatus = new Text;
+    m_pStatus->SetAlignment(TEXT_ALIGNH_LEFT|TEXT_ALIGNV_CENTER);
+    AddChild(m_pStatus, Point(mysize.GetWidth()-STATUS_WIDTH,mysize.GetHeight()-SEARCH_HEIGHT), Rect(STATUS_WIDTH,SEARCH_HEIGHT));
+    m_bRegex = false;
+    m_bSearching = false;
 
+    // прокрутка по строкам: 16-битного положения окна в Scroll не хватает для длинных журналов
 	m_pText = new Text();
     m_pText->SetFont("Monospace", 14, -1, -1);
     m_pText->SetAlignment(TEXT_ALIGNH_LEFT|TEXT_ALIGNV_TOP);
     m_pText->SetWrap(false);
-    m_pScroll->SetDataWindow(m_pText);
-//    m_pScroll->SetBackColor(RGB_WHITE);
+    m_pText->SetLineScroll(true);
+    AddChild(m_pText, Point(0,0), Rect(mysize.GetWidth(), mysize.GetHeight()-SEARCH_HEIGHT));
 //    m_pText->SetBackColor(RGB_WHITE);
     CaptureKeyboard(this);
 
     char *buf = GetFile(m_filename);
     m_pText->SetText(buf);
+    if(m_bFollow && StartFollow(strlen(buf)))
+    {
+        m_pText->ScrollToEnd();
+    }
     free(buf);
 }
 
+// слежение за файлом начиная со смещения offset
+bool MainWindow::StartFollow(off_t offset)
+{
+    m_fd = m_filename ? open(m_filename, O_RDONLY|O_CLOEXEC) : -1;
+    m_inotify = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if(m_fd < 0 || m_inotify < 0 || inotify_add_watch(m_inotify, m_filename, IN_MODIFY) < 0)
+    {
+        std::cout << "Слежение за файлом невозможно" << std::endl;
+        return false;
+    }
+    m_offset = offset;
+    m_pending = 0;
+    m_source = WatchFd(m_inotify, [this]() { OnFileChanged(); });
+    return true;
+}
+
+// дописанное в файл добавляется в текст: размечаются только новые строки
+void MainWindow::OnFileChanged()
+{
+    // события нужны только как сигнал: читаются все сразу
+    char events[BUFSIZE];
+    while(read(m_inotify, events, sizeof(events)) > 0)
+    {
+    }
+
+    struct stat st;
+    if(fstat(m_fd, &st) == 0 && st.st_size < m_offset)
+    {
+        // файл укорочен или перезаписан: читается сначала, найденное прежде неверно
+        CancelSearch();
+        ShowStatus("");
+        m_offset = 0;
+        m_pending = 0;
+        m_pText->SetText("");
+    }
+
+    ssize_t n;
+    bool bAppended = false;
+    while((n = pread(m_fd, m_buf+m_pending, BUFSIZE, m_offset)) > 0)
+    {
+        m_offset += n;
+        uint32_t size = m_pending + n;
+
+        // неполный символ в конце ждет следующей записи
+        uint32_t complete = size;
+        for(uint32_t back=1; back<=3 && back<=size; back++)
+        {
+            uint8_t s = UTF8SymbolSize(m_buf[size-back]);
+            if(s)
+            {
+                complete = s > back ? size-back : size;
+                break;
+            }
+        }
+
+        // байты не UTF-8 заменяются по одному: смещения в тексте остаются смещениями в файле
+        if(!m_pText->AppendText(m_buf, complete))
+        {
+            ReplaceInvalid(m_buf, complete);
+            m_pText->AppendText(m_buf, complete);
+        }
+        bAppended = true;
+        m_pending = size - complete;
+        memmove(m_buf, m_buf+complete, m_pending);
+    }
+    if(bAppended)
+    {
+        m_pText->ReDraw();
+    }
+}
+
 void MainWindow::OnSizeChanged()
 {
 	Rect mysize = GetInteriorSize();
 
-	m_pScroll->SetSize(mysize);
+	m_pText->SetSize(Rect(mysize.GetWidth(), mysize.GetHeight()-SEARCH_HEIGHT));
+    m_pSearch->SetPosition(Point(0,mysize.GetHeight()-SEARCH_HEIGHT));
+    m_pSearch->SetSize(Rect(mysize.GetWidth()-STATUS_WIDTH,SEARCH_HEIGHT));
+    m_pStatus->SetPosition(Point(mysize.GetWidth()-STATUS_WIDTH,mysize.GetHeight()-SEARCH_HEIGHT));
+    m_pStatus->SetSize(Rect(STATUS_WIDTH,SEARCH_HEIGHT));
+}
+
+void MainWindow::OnNotify(Window *child, uint32_t type, const Point &position)
+{
+    if(child == m_pSearch && type == EVENT_EDIT_RETURN)
+    {
+        CaptureKeyboard(this);
+        StartSearch(m_pSearch->GetText(), m_bRegex);
+    }
 }
 
 bool MainWindow::OnKeyPress(uint64_t keyval)
@@ -69,16 +241,185 @@ bool MainWindow::OnKeyPress(uint64_t keyval)
     case 'P':
         theGUI->Print();
         return true;
+    case '/':
+    case 'r':
+        // ввод строки поиска; Enter начинает поиск, Esc возвращает клавиатуру главному окну
+        m_bRegex = keyval == 'r';
+        ShowStatus(m_bRegex ? "регулярное выражение" : "подстрока");
+        CaptureKeyboard(m_pSearch);
+        return true;
+    case 'n':
+        if(!m_hits.empty())
+        {
+            GoToHit((m_current+1) % m_hits.size());
+        }
+        return true;
+    case 'N':
+        if(!m_hits.empty())
+        {
+            GoToHit(m_current > 0 ? m_current-1 : m_hits.size()-1);
+        }
+        return true;
     default:
         ;
     }
     return true;
 }
 
+// поиск по файлу в пуле потоков; найденное передается порциями в главный поток
+void MainWindow::StartSearch(const char *pattern, bool bRegex)
+{
+    CancelSearch();
+    if(!*pattern || !m_filename)
+    {
+        ShowStatus("");
+        return;
+    }
+
+    // выражение разбирается сразу: ошибка видна до начала поиска
+    std::shared_ptr<regex_t> re;
+    if(bRegex)
+    {
+        regex_t *compiled = new regex_t;
+        if(regcomp(compiled, pattern, REG_EXTENDED|REG_NEWLINE) != 0)
+        {
+            delete compiled;
+            ShowStatus("ошибка в выражении");
+            return;
+        }
+        re = std::shared_ptr<regex_t>(compiled, [](regex_t *p) { regfree(p); delete p; });
+    }
+
+    int fd = open(m_filename, O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        ShowStatus("не найдено");
+        return;
+    }
+    // смещения в тексте 32-битные: дальше UINT32_MAX найденное не показать
+    size_t size = st.st_size;
+    m_bLimited = size > UINT32_MAX;
+    if(m_bLimited)
+    {
+        size = UINT32_MAX;
+    }
+    posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+
+    uint32_t nSearch = m_nSearch;
+    std::shared_ptr<std::atomic<bool>> stop = m_stop = std::make_shared<std::atomic<bool>>(false);
+    std::shared_ptr<Window*> self = GetLifetime();
+    std::string text(pattern);
+    m_bSearching = true;
+    ShowStatus();
+
+    RunInBackground([this, self, nSearch, fd, size, text, re, stop]()
+        {
+            SearchFile(fd, size, text, re.get(), *stop, [this, self, nSearch](std::vector<SEARCHHIT> &hits)
+            {
+                std::shared_ptr<std::vector<SEARCHHIT>> batch = std::make_shared<std::vector<SEARCHHIT>>(std::move(hits));
+                InvokeOnMainThread([this, self, nSearch, batch]()
+                {
+                    if(*self && nSearch == m_nSearch)
+                    {
+                        AddHits(*batch);
+                    }
+                });
+            });
+            close(fd);
+        },
+        [this, nSearch]()
+        {
+            if(nSearch == m_nSearch)
+            {
+                m_bSearching = false;
+                ShowStatus();
+            }
+        });
+}
+
+// найденное прежним поиском отбрасывается, сам поиск прекращается при следующей проверке
+void MainWindow::CancelSearch()
+{
+    if(m_stop)
+    {
+        *m_stop = true;
+        m_stop = nullptr;
+    }
+    ++m_nSearch;
+    m_bSearching = false;
+    m_hits.clear();
+    m_current = -1;
+    m_pText->ClearHighlights();
+    m_pText->ReDraw();
+}
+
+void MainWindow::AddHits(std::vector<SEARCHHIT> &hits)
+{
+    std::vector<TEXTRANGE> ranges(hits.size());
+    for(size_t i=0; i<hits.size(); i++)
+    {
+        // поиск не идет дальше UINT32_MAX (см. StartSearch)
+        ranges[i] = TEXTRANGE{(uint32_t) hits[i].offset, hits[i].length};
+    }
+    m_pText->AddHighlights(ranges.data(), ranges.size());
+    m_hits.insert(m_hits.end(), hits.begin(), hits.end());
+
+    // первое найденное показывается сразу
+    if(m_current < 0)
+    {
+        GoToHit(0);
+        return;
+    }
+    ShowStatus();
+    m_pText->ReDraw();
+}
+
+void MainWindow::GoToHit(int32_t index)
+{
+    m_current = index;
+    m_pText->SetCurrentHighlight(index);
+    m_pText->ScrollToOffset(m_hits[index].offset);
+    m_pText->ReDraw();
+    ShowStatus();
+}
+
+void MainWindow::ShowStatus(const char *message)
+{
+    char status[128];
+    if(message)
+    {
+        snprintf(status, sizeof(status), "%s", message);
+    }
+    else if(m_hits.empty())
+    {
+        snprintf(status, sizeof(status), "%s%s", m_bSearching ? "поиск..." : "не найдено",
+            m_bLimited ? " в первых 4 Гб" : "");
+    }
+    else
+    {
+        const SEARCHHIT &hit = m_hits[max(m_current, 0)];
+        snprintf(status, sizeof(status), "%d из %zu%s%s: строка %u, столбец %u", max(m_current, 0)+1, m_hits.size(),
+            m_bSearching ? "..." : "", m_bLimited ? " в первых 4 Гб" : "", hit.line+1, hit.column+1);
+    }
+    m_pStatus->SetText(status);
+    m_pStatus->ReDraw();
+}
+
 int main(int argc, char **argv)
 {
     MainWindow *pWindow = new MainWindow;
-    pWindow->m_filename = argc>0 ? argv[1] : nullptr;
+    int arg = 1;
+    if(argc > 1 && strcmp(argv[1], "-f") == 0)
+    {
+        pWindow->m_bFollow = true;
+        ++arg;
+    }
+    pWindow->m_filename = argc>arg ? argv[arg] : nullptr;
 
     int res = Run(argc, argv, pWindow, WIN_WIDTH, WIN_HEIGHT);
 
@@ -87,6 +428,153 @@ int main(int argc, char **argv)
     return res;
 }
 
+// поиск pattern (или выражения re) в первых size байтах файла; найденное передается в fn после
+// каждой части размером около SEARCH_BLOCK. Файл читается по частям, а не отображается в память:
+// укороченный во время поиска файл (например, при ротации журнала) только прекращает поиск.
+// Части кончаются переводом строки: найденное не переходит через строку
+static void SearchFile(int fd, size_t size, const std::string &pattern, const regex_t *re,
+    const std::atomic<bool> &stop, SEARCHFN fn)
+{
+    // после прочитанного - нуль: regexec может искать конец строки и с REG_STARTEND
+    size_t bufsize = SEARCH_BLOCK;
+    char *buf = (char *) malloc(bufsize+1);
+    if(!buf)
+    {
+        return;
+    }
+
+    std::vector<SEARCHHIT> hits;
+    size_t nHits = 0;
+    size_t base = 0, filled = 0;            // смещение начала буфера в файле и прочитано в буфер
+    size_t counted = 0;                     // переводы строки и символы строки подсчитаны до counted в буфере
+    uint32_t line = 0, column = 0;
+    auto add = [&](size_t offset, size_t length)
+    {
+        // больше SEARCH_MAX_HITS не ищется
+        if(nHits == SEARCH_MAX_HITS)
+        {
+            return false;
+        }
+        ++nHits;
+
+        // найденное идет по возрастанию: столбец считается от прежнего найденного в той же строке
+        line += CountByte(buf+counted, offset-counted, '\n');
+        const char *nl = (const char *) memrchr(buf+counted, '\n', offset-counted);
+        if(nl)
+        {
+            counted = nl-buf+1;
+            column = 0;
+        }
+        column += UTF8Count(buf+counted, offset-counted);
+        counted = offset;
+        hits.push_back(SEARCHHIT{base+offset, (uint32_t) length, line, column});
+        return true;
+    };
+
+    bool bFull = false;
+    while(!stop && !bFull)
+    {
+        ssize_t n = pread(fd, buf+filled, min(bufsize-filled, size-base-filled), base+filled);
+        if(n < 0)
+        {
+            break;
+        }
+        filled += n;
+        buf[filled] = 0;
+
+        // часть - до последнего перевода строки; в конце файла (или укороченного файла) - все прочитанное
+        bool bEnd = n == 0 || base+filled == size;
+        size_t end = filled;
+        if(!bEnd)
+        {
+            const char *nl = (const char *) memrchr(buf, '\n', filled);
+            if(!nl)
+            {
+                if(filled < bufsize)
+                {
+                    continue;
+                }
+                // строка длиннее буфера: буфер увеличивается
+                char *larger = (char *) realloc(buf, 2*bufsize+1);
+                if(!larger)
+                {
+                    break;
+                }
+                buf = larger;
+                bufsize *= 2;
+                continue;
+            }
+            end = nl-buf+1;
+        }
+
+        if(re)
+        {
+            // смещения regoff_t 32-битные: выражение ищется от начала части
+            regoff_t from = 0, length = end;
+            regmatch_t m;
+            while(from < length && !bFull)
+            {
+                m.rm_so = from;
+                m.rm_eo = length;
+                if(regexec(re, buf, 1, &m, REG_STARTEND) != 0)
+                {
+                    break;
+                }
+                if(m.rm_eo > m.rm_so)
+                {
+                    bFull = !add(m.rm_so, m.rm_eo - m.rm_so);
+                }
+                from = max(m.rm_eo, m.rm_so+1);
+            }
+        }
+        else
+        {
+            const char *p = buf, *e = buf+end;
+            while(!bFull && (p = SearchText(p, e-p, pattern.data(), pattern.size())))
+            {
+                bFull = !add(p-buf, pattern.size());
+                p += pattern.size();
+            }
+        }
+
+        if(!hits.empty())
+        {
+            fn(hits);
+            hits.clear();
+        }
+        if(bEnd)
+        {
+            break;
+        }
+
+        // часть кончается переводом строки: следующая начинается с новой строки
+        line += CountByte(buf+counted, end-counted, '\n');
+        counted = 0;
+        column = 0;
+        memmove(buf, buf+end, filled-end);
+        filled -= end;
+        base += end;
+    }
+    free(buf);
+}
+
+// замена байтов, не образующих символов UTF-8, на '?'
+static void ReplaceInvalid(char *s, uint32_t length)
+{
+    for(uint32_t pos=0; pos<length; )
+    {
+        uint8_t size = UTF8SymbolSize(s[pos]);
+        if(size && pos+size <= length && UTF8Validate(s+pos, size))
+        {
+            pos += size;
+        }
+        else
+        {
+            s[pos++] = '?';
+        }
+    }
+}
+
 // возвращает буфер, содержащий считанный в виде строки файл
 // эта функция не пригодна для считывания двоичных файлов!
 char *GetFile(const char *filename)
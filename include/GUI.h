@@ -30,11 +30,17 @@ public:
         uint16_t *height, uint16_t *advance);
     virtual void GetFontInfo(const char *fontface, const uint16_t fontsize, const uint32_t style,
         int16_t *ascent, int16_t *descent, uint16_t *linespacing, uint16_t *maxadvance);
+    virtual void GetTextAdvances(const char *fontface, const uint16_t fontsize, const uint32_t style,
+        const uint32_t *codes, uint32_t n, float *advances);
     virtual void Polyline(const uint16_t n, const Point p[]);
     virtual void FillPolyline(const uint16_t n, const Point p[]);
     IMAGEINFO LoadPNG(const char *filename);
+    IMAGEINFO LoadPNG(const char *filename, uint16_t maxWidth, uint16_t maxHeight);
     virtual void DeletePNG(IMAGEINFO imageptr);
-    virtual void Image(const IMAGEINFO imageptr, const Point &position, double scaleX, double scaleY);
+    virtual IMAGEINFO ScaleImage(const IMAGEINFO ii, uint16_t width, uint16_t height, uint8_t filter);
+    virtual IMAGEINFO CreateImage(uint32_t *pixels, uint16_t width, uint16_t height);
+    virtual void Image(const IMAGEINFO imageptr, const Point &position, double scaleX, double scaleY, uint8_t filter=IMAGE_FILTER_GOOD);
+    virtual void StretchImage(const IMAGEINFO ii, int32_t x, int32_t y, uint32_t width, uint32_t height, uint8_t filter);
 
 private:
     cairo_t  *m_cr;
@@ -54,6 +60,7 @@ public:
 
     int Run(int arc, char **argv, Window *wnd, uint16_t w, uint16_t h);
     bool NotifyWindow(uint32_t type, const Point &p, uint64_t value, Window *pTarget=nullptr);
+    void ProcessRequests();                 // перерисовка и завершение по запросам окон
 
     void ReDraw();
     void CreateTimeout(Window *pWindow, uint32_t timeout);
@@ -90,3 +97,10 @@ gboolean on_key_press_event(GtkWidget *widget, GdkEventKey *event, gpointer user
 gboolean on_motion_notify_event(GtkWidget *widget, GdkEventMotion *event, gpointer user_data);
 gboolean on_scroll_event(GtkWidget *widget, GdkEventScroll *event, gpointer user_data);
 gboolean on_timeout(gpointer user_data);
+gboolean on_invoke(gpointer user_data);
+void on_invoke_destroy(gpointer user_data);
+gboolean on_idle(gpointer user_data);
+gboolean on_posted_prepare(GSource *source, gint *timeout);
+gboolean on_posted_check(GSource *source);
+gboolean on_posted_dispatch(GSource *source, GSourceFunc callback, gpointer user_data);
+bool deliver_posted_event(Window *pTarget, uint32_t type, const Point &position, uint64_t value);
@@ -0,0 +1,38 @@
+// alloctrack.h
+
+// Учет выделений памяти (отладочный режим, сборка с -DGUI_ALLOC_TRACKING).
+// Перехватываются malloc/calloc/realloc и operator new; выделения главного потока
+// подсчитываются отдельно для каждого кадра (отрисовки) и для каждого обработчика событий.
+// При превышении заданного бюджета выводится диагностика и срабатывает assert.
+
+#define ALLOC_SCOPE_FRAME   EVENT_LASTNUMBER        // область учета "отрисовка кадра";
+                                                    // области 0..EVENT_LASTNUMBER-1 - обработчики событий по их типам
+#define ALLOC_SCOPES        (EVENT_LASTNUMBER+1)    // количество областей учета
+#define ALLOC_UNLIMITED     UINT64_MAX              // бюджет не ограничен
+
+typedef struct _ALLOCSTAT
+{
+    uint64_t calls;     // сколько раз область была выполнена
+    uint64_t count;     // количество выделений (всего)
+    uint64_t bytes;     // объем выделенной памяти (всего)
+    uint64_t maxCount;  // наибольшее количество выделений за одно выполнение
+    uint64_t maxBytes;  // наибольший объем за одно выполнение
+} ALLOCSTAT;
+
+#ifdef GUI_ALLOC_TRACKING
+    #define ALLOC_TRACK_BEGIN(scope)    AllocTrackBegin(scope)
+    #define ALLOC_TRACK_END(scope)      AllocTrackEnd(scope)
+    #define ALLOC_TRACK_REPORT()        AllocTrackPrint()
+#else
+    #define ALLOC_TRACK_BEGIN(scope)
+    #define ALLOC_TRACK_END(scope)
+    #define ALLOC_TRACK_REPORT()
+#endif
+
+// бюджет на одно выполнение области; по умолчанию берется из переменных окружения
+// GUI_ALLOC_BUDGET_FRAME и GUI_ALLOC_BUDGET_HANDLER в виде "количество[,байты]"
+void AllocTrackSetBudget(uint32_t scope, uint64_t count, uint64_t bytes);
+void AllocTrackBegin(uint32_t scope);               // начало кадра или обработчика
+void AllocTrackEnd(uint32_t scope);                 // окончание: проверка бюджета и накопление статистики
+ALLOCSTAT AllocTrackGetStat(uint32_t scope);        // накопленная статистика области
+void AllocTrackPrint();                             // вывод статистики в stderr
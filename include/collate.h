@@ -0,0 +1,20 @@
+// collate.h
+
+// Порядок имен файлов для показа: каталоги первыми, без учета регистра (латиница, Latin-1,
+// греческий, кириллица; ё - как е), числа - по значению (IMG_9 раньше IMG_10). Для каждого имени один раз
+// строится ключ, который сравнивается memcmp: буквы приведены к строчным (UTF-8 сохраняет порядок
+// кодов символов), последовательность цифр заменена на '0', количество значащих цифр и сами цифры.
+// Имена с равными ключами (IMG_01 и img_1) упорядочиваются strcmp.
+// Большие массивы сортируются параллельно в пуле потоков: части - std::sort, затем попарное слияние.
+// Все функции можно вызывать из любого потока, в том числе из рабочего потока пула.
+
+#define COLLATE_KEY_SIZE(length)    (2*(length)+2)  // наибольшая длина ключа имени из length байт
+#define COLLATE_PARALLEL_MIN        16384           // с этого количества имен сортировка параллельная
+
+uint32_t CollateKey(const char *name, uint32_t length, bool bDir, uint8_t *key);  // длина ключа
+// регистр приводится так же, как в ключе; длина не меняется, folded - length байт
+void     CollateFold(const char *name, uint32_t length, char *folded);
+int      CollateCompare(const char *name1, bool bDir1, const char *name2, bool bDir2);    // <0, 0, >0
+
+// order[i] - номер i-го по порядку имени; bDirs == nullptr - каталогов нет
+void     CollateOrder(const char *const *names, const bool *bDirs, uint32_t n, uint32_t *order);
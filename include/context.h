@@ -29,6 +29,10 @@
 #define IMAGE_ALIGNV_BOTTOM     0x40
 #define IMAGE_ALIGNV_CENTER     0x80
 
+// фильтры масштабирования картинок
+#define IMAGE_FILTER_FAST       0x00    // быстрый, для перерисовки во время изменений
+#define IMAGE_FILTER_GOOD       0x01    // качественный
+
 
 class Context
 {
@@ -57,10 +61,16 @@ public:
         uint16_t *height, uint16_t *advance) = 0;
     virtual void GetFontInfo(const char *fontface, const uint16_t fontsize, const uint32_t style,
         int16_t *ascent, int16_t *descent, uint16_t *linespacing, uint16_t *maxadvance) = 0;
+    virtual void GetTextAdvances(const char *fontface, const uint16_t fontsize, const uint32_t style,
+        const uint32_t *codes, uint32_t n, float *advances) = 0;    // ширина символов Unicode по отдельности, из любого потока
     virtual void Polyline(const uint16_t n, const Point p[]) = 0;
     virtual void FillPolyline(const uint16_t n, const Point p[]) = 0;
-    virtual IMAGEINFO LoadPNG(const char *filename) = 0;
-    virtual void DeletePNG(IMAGEINFO ii) = 0;
-    virtual void Image(const IMAGEINFO ii, const Point &position, double scaleX, double scaleY) = 0;
+    virtual IMAGEINFO LoadPNG(const char *filename) = 0;     // можно вызывать из любого потока
+    virtual IMAGEINFO LoadPNG(const char *filename, uint16_t maxWidth, uint16_t maxHeight) = 0; // уменьшенная при чтении картинка (через кэш образцов, см. thumbcache.h)
+    virtual void DeletePNG(IMAGEINFO ii) = 0;               // освобождение ссылки на картинку (см. imagecache.h), из любого потока
+    virtual IMAGEINFO ScaleImage(const IMAGEINFO ii, uint16_t width, uint16_t height, uint8_t filter) = 0; // новая картинка заданного размера, из любого потока
+    virtual IMAGEINFO CreateImage(uint32_t *pixels, uint16_t width, uint16_t height) = 0; // картинка из точек ARGB32 (шаг width*4, освобождаются free), из любого потока
+    virtual void Image(const IMAGEINFO ii, const Point &position, double scaleX, double scaleY, uint8_t filter=IMAGE_FILTER_GOOD) = 0;
+    virtual void StretchImage(const IMAGEINFO ii, int32_t x, int32_t y, uint32_t width, uint32_t height, uint8_t filter) = 0; // картинка, растянутая на прямоугольник (м.б. за пределами окна)
 };
 
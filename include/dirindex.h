@@ -0,0 +1,52 @@
+// dirindex.h
+
+// Индекс дерева каталогов: для каждого элемента - имя, размер, время изменения, тип, тип содержимого
+// и размер картинки (PNG). Дерево обходится по уровням: каталоги одного уровня читаются параллельно
+// в пуле потоков (ParallelFor) порциями по DIRINDEX_BATCH, чтобы не задерживать другие задания пула.
+// Индекс записывается в файл $XDG_CACHE_HOME/gui3/index/<хэш пути>.idx (по умолчанию ~/.cache/gui3)
+// и открывается отображением в память - без чтения и разбора.
+// Элементы каталога лежат в индексе подряд в порядке показа (DirScanSort), первый элемент индекса - корень.
+// При построении с прежним индексом каталог, время изменения которого не изменилось, не перечитывается:
+// его файлы берутся из прежнего индекса без обращения к диску, проверяются только вложенные каталоги.
+// С bFiles у файлов таких каталогов проверяются размер и время изменения (изменение содержимого файла
+// не меняет времени изменения каталога). Тип содержимого и размер картинки определяются заново только
+// для изменившихся файлов.
+// Символические ссылки на каталоги в индекс входят, но не обходятся.
+// Все функции можно вызывать из любого потока, в том числе из рабочего потока пула.
+// Перед подключением нужен dirscan.h.
+
+#define DIRINDEX_MAGIC      "GUI3IDX1"  // заголовок файла индекса
+#define DIRINDEX_MAGIC_SIZE 8
+#define DIRINDEX_UNLISTED   UINT32_MAX  // first каталога, содержимое которого не записано
+#define DIRINDEX_BATCH      64          // каталогов, читаемых параллельно за один раз
+
+typedef struct _INDEXENTRY
+{
+    uint64_t size;          // размер файла
+    int64_t  mtime;         // время изменения, нс
+    uint32_t name;          // смещение имени в области имен (с завершающим нулем)
+    uint32_t first;         // каталог: номер первого элемента; DIRINDEX_UNLISTED - не записан
+    uint32_t n;             // каталог: количество элементов
+    uint32_t width, height; // размер картинки; 0 - неизвестен
+    uint16_t length;        // длина имени
+    uint8_t  type;          // DIRSCAN_*
+    uint8_t  format;        // FILETYPE_* (см. fileprobe.h)
+} INDEXENTRY;
+
+typedef struct _DIRINDEX
+{
+    const INDEXENTRY *entries;  // entries[0] - корень
+    uint32_t   n;
+    const char *names;          // область имен
+    const char *root;           // полный путь корня, с завершающим нулем
+    int64_t    built;           // время построения, с
+    void       *map;            // отображение файла индекса
+    size_t     mapSize;
+} *DIRINDEX;
+
+DIRINDEX DirIndexOpen(const char *root);                     // nullptr - индекса нет или он поврежден
+bool     DirIndexBuild(const char *root, DIRINDEX previous, bool bFiles=false); // обход дерева и запись индекса; previous может быть nullptr
+void     DirIndexClose(DIRINDEX index);
+
+// элемент каталога path (полный путь внутри корня); false - каталога нет в индексе или он не записан
+bool     DirIndexLookup(DIRINDEX index, const char *path, uint32_t *entry);
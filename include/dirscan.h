@@ -0,0 +1,38 @@
+// dirscan.h
+
+// Чтение каталога крупными порциями (getdents64). Тип элемента берется из d_type,
+// если файловая система его сообщает, иначе - fstatat относительно открытого каталога
+// (символические ссылки раскрываются, как у stat). Имена хранятся подряд в одной области памяти.
+// С флагом DIRSCAN_PROBE тип содержимого обычных файлов определяется по первым байтам
+// одним пакетом для всего каталога (FileProbe, см. fileprobe.h).
+// Можно вызывать из любого потока.
+
+#define DIRSCAN_BATCH       (256*1024)  // буфер getdents64, байты
+
+// тип элемента
+#define DIRSCAN_OTHER       0x00
+#define DIRSCAN_FILE        0x01
+#define DIRSCAN_DIR         0x02
+
+// флаги DirScan
+#define DIRSCAN_PROBE       0x01        // определять тип содержимого файлов
+#define DIRSCAN_SKIP_DOT    0x02        // пропускать "."
+
+typedef struct _DIRENTRY
+{
+    char     *name;         // в области имен, с завершающим нулем
+    uint16_t length;
+    uint8_t  type;          // DIRSCAN_FILE, DIRSCAN_DIR, DIRSCAN_OTHER
+    uint8_t  format;        // FILETYPE_* (см. fileprobe.h), только с DIRSCAN_PROBE
+} DIRENTRY;
+
+typedef struct _DIRSCAN
+{
+    DIRENTRY *entries;      // в порядке каталога
+    uint32_t n;
+    char     *names;        // область имен
+} *DIRSCAN;
+
+DIRSCAN DirScan(const char *path, uint8_t flags);     // nullptr - каталог не открыть
+void    DirScanSort(DIRSCAN ds);                      // порядок для показа (см. collate.h)
+void    DirScanFree(DIRSCAN ds);
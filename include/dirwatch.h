@@ -0,0 +1,52 @@
+// dirwatch.h
+
+// Наблюдение за изменениями в каталоге (inotify). Дескриптор inotify обслуживается главным
+// циклом (WatchFd, см. mainloop.h): когда появляются события, они читаются все сразу и
+// передаются обработчику одной порцией. Перемещение внутри каталога (пара IN_MOVED_FROM и
+// IN_MOVED_TO с общим cookie) передается как переименование. Если очередь событий переполнилась
+// или сам каталог удален или перемещен, передается DIRWATCH_RESCAN - каталог нужно перечитать целиком.
+// Используется только из главного потока. Перед подключением нужен <functional>.
+
+#define DIRWATCH_BUFFER     (64*1024)   // буфер чтения событий, байты
+
+// изменение в каталоге
+enum DirWatchEvents
+{
+    DIRWATCH_ADDED = 1,     // элемент создан или перемещен в каталог
+    DIRWATCH_REMOVED,       // элемент удален или перемещен из каталога
+    DIRWATCH_RENAMED,       // элемент переименован: name - прежнее имя, newName - новое
+    DIRWATCH_WRITTEN,       // файл закрыт после записи - содержимое могло измениться
+    DIRWATCH_RESCAN,        // события потеряны - каталог нужно перечитать
+};
+
+typedef struct _DIRCHANGE
+{
+    uint8_t    event;       // DIRWATCH_*
+    bool       bDir;        // элемент - каталог
+    const char *name;
+    const char *newName;    // только для DIRWATCH_RENAMED
+} DIRCHANGE;
+
+// changes действительны только во время вызова обработчика
+typedef std::function<void(const DIRCHANGE *changes, uint32_t n)> DIRWATCHFN;
+
+class DirWatch
+{
+public:
+    DirWatch();
+    ~DirWatch();
+
+    bool Start(const char *path, DIRWATCHFN fn);    // false - наблюдение невозможно (нет inotify, нет каталога)
+    void Stop();
+    bool IsWatching() { return m_wd >= 0; }
+
+private:
+    void OnReadable();      // чтение и разбор накопившихся событий
+
+    int        m_fd;        // дескриптор inotify
+    int        m_wd;        // наблюдаемый каталог
+    uint32_t   m_source;    // наблюдение главного цикла за m_fd
+    char       *m_buf;
+    DIRCHANGE  *m_changes;  // не больше, чем событий помещается в буфере
+    DIRWATCHFN m_fn;
+};
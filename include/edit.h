@@ -2,6 +2,13 @@
 #define FONTFACE_SIZE       100
 #define POINTER_TIMEOUT     500
 
+// оповещения родителя от поля ввода
+enum EditEventTypes
+{
+    EVENT_EDIT_CHANGED = 1,     // текст изменен вводом
+    EVENT_EDIT_RETURN,          // нажата клавиша Enter
+};
+
 class Edit : public Window
 {
 public:
@@ -33,9 +40,6 @@ private:
     void Insert(uint64_t code, uint8_t s);
     void Delete();
     uint32_t GetByteIndex(uint32_t position);
-    void CopyUnicodeSymbol(uint32_t &position);         // копирование одного символа UTF-8 из m_text в m_shadow
-    uint8_t GetUnicodeSymbolSize(uint8_t firstbyte);    // определение размера символа UTF-8 по первому байту
-    bool CheckUTF8(const char *s);                       // проверка, состоит ли строка из допустимых символов UTF-8
 
 private:
     char *m_text, *m_shadow;                    // теневая копия содержит только символы до указателя (курсора)
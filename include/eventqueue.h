@@ -0,0 +1,28 @@
+// eventqueue.h
+
+// Отправка событий окнам из любого потока. События помещаются в очередь без блокировок
+// (много производителей - один потребитель) и разбираются главным циклом один раз за итерацию.
+// Одинаковые идемпотентные события (изменение размера и типы с флагом POSTED_COALESCE - например,
+// запрос перерисовки) того же окна, накопившиеся за итерацию, объединяются: окно получает одно
+// событие с последними значениями position и value. Остальные (клавиши, щелчки) доставляются все
+// и по порядку. Окно задается его GetLifetime(), полученным в главном потоке: события уничтоженным
+// окнам отбрасываются, даже если по тому же адресу уже создано другое окно.
+
+#define POSTED_BATCH_MAX    1024    // наибольшее количество различных событий, доставляемых за одну итерацию
+#define POSTED_DRAIN_MAX    16384   // наибольшее количество событий, забираемых из очереди за одну итерацию
+#define POSTED_COALESCE     0x80000000  // флаг типа: одинаковые события можно объединять; окну тип передается без флага
+
+typedef struct _POSTEDEVENT
+{
+    std::atomic<struct _POSTEDEVENT*> next;
+    std::shared_ptr<Window*> target;
+    uint32_t type;
+    Point    position;
+    uint64_t value;
+} POSTEDEVENT;
+
+typedef bool (*EVENTSINK)(Window *pTarget, uint32_t type, const Point &position, uint64_t value);
+
+void PostEvent(const std::shared_ptr<Window*> &target, uint32_t type, const Point &position, uint64_t value);  // из любого потока
+bool HasPostedEvents();                     // есть ли события в очереди
+void DispatchPostedEvents(EVENTSINK sink);  // разбор очереди; только из главного потока
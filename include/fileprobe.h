@@ -0,0 +1,28 @@
+// fileprobe.h
+
+// Определение типа файлов по первым байтам для многих файлов сразу.
+// Открытие, чтение и закрытие файлов ставятся в очередь io_uring пакетами по PROBE_DEPTH файлов,
+// так что время определяется глубиной очереди ввода-вывода, а не задержкой каждого обращения.
+// Если io_uring недоступен (старое ядро, запрет seccomp, GUI_IOURING=0), файлы проверяются
+// параллельно в пуле потоков; туда же уходят оставшиеся файлы, если пакету не хватило дескрипторов
+// (EMFILE, ENFILE). Можно вызывать из любого потока, в том числе из рабочего потока пула.
+
+#define PROBE_BYTES     16      // читаемое начало файла
+#define PROBE_DEPTH     256     // файлов в одном пакете io_uring
+
+// тип файла
+enum FileType
+{
+    FILETYPE_UNKNOWN = 0,       // не распознан или не прочитан
+    FILETYPE_PNG,
+    FILETYPE_JPEG,
+    FILETYPE_GIF,
+    FILETYPE_BMP,
+    FILETYPE_WEBP,
+    FILETYPE_TIFF,
+};
+
+uint8_t FileTypeBySignature(const uint8_t *head, size_t size);     // тип по первым size байтам
+
+// types[i] - тип файла names[i] (путь относительно каталога dirfd или AT_FDCWD)
+void    FileProbe(int dirfd, const char *const *names, uint32_t n, uint8_t *types);
@@ -0,0 +1,16 @@
+// idle.h
+
+// Планировщик работы в паузах главного цикла. Возобновляемое задание - функция, выполняющая
+// одну небольшую порцию работы и возвращающая true, пока работа не закончена. Задания
+// выполняются по очереди, с приоритетом ниже ввода и отрисовки, не дольше заданного
+// интервала (по умолчанию IDLE_SLICE_US) за одну итерацию главного цикла.
+// Задание окна (Window::RunWhenIdle) снимается, если окно уничтожено.
+
+#define IDLE_SLICE_US       2000        // интервал работы за одну итерацию главного цикла, мкс
+
+typedef std::function<bool()> IDLESTEP;
+
+void     ScheduleIdle(IDLESTEP step, std::shared_ptr<Window*> owner=nullptr);  // только из главного потока
+void     SetIdleSlice(uint32_t us);
+uint32_t GetIdleSlice();
+bool     RunIdleSlice();                // выполнение заданий в течение интервала; true - работа осталась
@@ -1,3 +1,7 @@
+#define IMAGE_MIPS          8       // наибольшее количество уменьшенных вдвое копий картинки
+#define IMAGE_SETTLE_MS     150     // пауза после изменения размера вывода до качественного масштабирования
+#define IMAGE_SCALED_MAX    (4096*4096) // наибольший размер (в точках) сохраняемой масштабированной картинки
+
 class Image : public Window
 {
 public:
@@ -14,7 +18,17 @@ public:
     uint8_t GetStyle();
 
 private:
+    void ClearScaled();                                 // удаление масштабированных копий
+    IMAGEINFO GetMip(uint16_t width, uint16_t height);  // наименьшая готовая копия не меньше заданного размера
+    void RequestMips(Context *cr);                      // построение уменьшенных копий в фоне
+    void RequestScale(Context *cr, uint16_t width, uint16_t height); // качественное масштабирование после паузы
+
     IMAGEINFO m_image;
+    IMAGEINFO m_scaled;                 // картинка, масштабированная до размера вывода
+    IMAGEINFO m_mips[IMAGE_MIPS];       // копии, уменьшенные в 2, 4, 8... раз; строятся в фоне при первом уменьшении
+    bool      m_bMips;                  // построение копий запрошено
+    uint16_t  m_scaledWidth, m_scaledHeight; // размер запрошенного масштабирования
+    uint32_t  m_nScale;                 // номер запроса масштабирования
     double    m_scaleX, m_scaleY;
     uint8_t   m_style;
 };
@@ -0,0 +1,36 @@
+// imagecache.h
+
+// Ссылки на картинки и общий кэш картинок.
+// Картинка (IMAGEINFO) удаляется при освобождении последней ссылки: Context::LoadPNG возвращает
+// картинку с одной ссылкой, Context::DeletePNG (или ImageRelease) освобождает ссылку,
+// окно Image держит свою ссылку на отображаемую картинку.
+// Кэш хранит картинки по пути к файлу, времени его изменения и размеру, до которого картинка
+// уменьшена при чтении; повторная загрузка возвращает ту же картинку с новой ссылкой.
+// Неиспользуемые картинки вытесняются в порядке давности использования, когда объем всех
+// картинок в памяти превышает бюджет (GUI_IMAGECACHE_MB, по умолчанию IMAGECACHE_MB). В объеме
+// учитываются и картинки вне кэша: используемые, масштабированные и уменьшенные копии (см. image.h);
+// используемые картинки остаются в кэше, пока их не освободят.
+// Все функции можно вызывать из любого потока.
+
+#define IMAGECACHE_MB   64      // бюджет кэша по умолчанию, Мб
+
+typedef struct _IMAGECACHESTAT
+{
+    uint64_t hits;          // картинка найдена в кэше
+    uint64_t misses;        // картинка прочитана из файла
+    uint64_t evictions;     // картинка вытеснена из кэша
+    uint64_t bytes;         // объем картинок в кэше
+    uint64_t resident;      // объем всех картинок в памяти (сравнивается с бюджетом)
+    uint64_t budget;        // бюджет кэша
+    uint32_t count;         // количество картинок в кэше
+} IMAGECACHESTAT;
+
+IMAGEINFO ImageAddRef(IMAGEINFO ii);            // новая ссылка на картинку
+void      ImageRelease(IMAGEINFO ii);           // освобождение ссылки
+void      ImageBytesChanged(int64_t bytes);     // учет памяти картинок: вызывается при создании (+) и удалении (-) поверхности
+
+// загрузка через кэш; maxWidth, maxHeight - см. Context::LoadPNG, 0 - без уменьшения; nullptr - ошибка
+IMAGEINFO ImageCacheLoad(Context *cr, const char *filename, uint16_t maxWidth=0, uint16_t maxHeight=0);
+void      ImageCacheSetBudget(uint64_t bytes);
+void      ImageCacheGetStat(IMAGECACHESTAT *stat);
+void      ImageCacheClear();                    // вытеснение всех неиспользуемых картинок
@@ -0,0 +1,11 @@
+// mainloop.h
+
+// Обращения к главному циклу приложения из кода, не зависящего от GTK.
+// Реализация - в GUI.cc.
+
+void InvokeOnMainThread(std::function<void()> fn);          // выполнить fn в главном потоке; можно вызывать из любого потока
+void InvokeAfter(uint32_t ms, std::function<void()> fn);    // выполнить fn в главном потоке через ms миллисекунд
+void WakeMainLoop();                                        // пробудить главный цикл; можно вызывать из любого потока
+void RequestIdle();                                         // запросить вызов RunIdleSlice в паузах главного цикла; только из главного потока
+uint32_t WatchFd(int fd, std::function<void()> fn);           // вызывать fn в главном потоке, когда из fd можно читать; только из главного потока
+void     UnwatchFd(uint32_t id);                              // снять наблюдение, установленное WatchFd
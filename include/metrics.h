@@ -0,0 +1,96 @@
+// metrics.h
+
+// Метрики приложения: счетчики, показатели (gauge) и гистограммы с фиксированными
+// границами интервалов. Обновление - атомарные операции без блокировок, из любого потока.
+// Снимок в текстовом формате Prometheus публикуется фоновым потоком через локальный
+// сокет Unix (GUI_METRICS_SOCKET=путь) и/или периодически перезаписываемый файл
+// (GUI_METRICS_FILE=путь, период GUI_METRICS_PERIOD в секундах).
+
+#define METRICS_MAX             64      // максимальное количество метрик
+#define HISTOGRAM_MAX_BUCKETS   16      // максимальное количество интервалов гистограммы
+#define METRICS_PERIOD          10      // период перезаписи файла по умолчанию, с
+
+enum MetricType
+{
+    METRIC_COUNTER = 1,
+    METRIC_GAUGE,
+    METRIC_HISTOGRAM,
+};
+
+class Metric
+{
+public:
+    Metric(const char *name, const char *help, MetricType type);
+
+    const char *GetName() const { return m_name; }
+    const char *GetHelp() const { return m_help; }
+    MetricType GetType() const { return m_type; }
+
+private:
+    const char *m_name;
+    const char *m_help;
+    MetricType m_type;
+};
+
+// монотонно возрастающий счетчик
+class Counter : public Metric
+{
+public:
+    Counter(const char *name, const char *help) : Metric(name, help, METRIC_COUNTER), m_value(0) {}
+
+    void     Add(uint64_t n=1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t Get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value;
+};
+
+// текущее значение, которое может как расти, так и уменьшаться
+class Gauge : public Metric
+{
+public:
+    Gauge(const char *name, const char *help) : Metric(name, help, METRIC_GAUGE), m_value(0) {}
+
+    void    Set(int64_t v) { m_value.store(v, std::memory_order_relaxed); }
+    void    Add(int64_t n) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    int64_t Get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<int64_t> m_value;
+};
+
+// гистограмма: bounds - возрастающие верхние границы интервалов (последний интервал - +Inf)
+class Histogram : public Metric
+{
+public:
+    Histogram(const char *name, const char *help, const uint64_t *bounds, uint16_t nBounds);
+
+    void     Observe(uint64_t value);
+    uint16_t GetBucketCount() const { return m_nBounds; }
+    uint64_t GetBound(uint16_t i) const { return m_bounds[i]; }
+    uint64_t GetBucket(uint16_t i) const { return m_buckets[i].load(std::memory_order_relaxed); }  // i==m_nBounds - +Inf
+    uint64_t GetCount() const { return m_count.load(std::memory_order_relaxed); }
+    uint64_t GetSum() const { return m_sum.load(std::memory_order_relaxed); }
+
+private:
+    const uint64_t *m_bounds;
+    uint16_t m_nBounds;
+    std::atomic<uint64_t> m_buckets[HISTOGRAM_MAX_BUCKETS+1];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_sum;
+};
+
+// метрики библиотеки
+extern Histogram metricFrameTime;           // время отрисовки кадра, мкс
+extern Counter   metricEventsDispatched;    // количество обработанных событий
+extern Counter   metricTimersFired;         // количество сработавших таймеров
+extern Counter   metricImagesLoaded;        // количество загруженных картинок
+extern Gauge     metricImageBytes;          // объем памяти, занятой поверхностями картинок, байты
+extern Counter   metricImageCacheHits;      // картинки, найденные в кэше картинок
+extern Counter   metricImageCacheMisses;    // картинки, загруженные в кэш картинок
+extern Counter   metricImageCacheEvictions; // картинки, вытесненные из кэша картинок
+extern Gauge     metricImageCacheBytes;     // объем картинок в кэше картинок, байты
+
+void MetricsStart();                        // запуск публикации (по переменным окружения)
+void MetricsStop();                         // остановка публикации
+void MetricsSnapshot(std::string &out);     // снимок всех метрик в формате Prometheus
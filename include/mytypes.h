@@ -126,6 +126,8 @@ typedef struct _IMAGEINFO
     IMAGEPTR imageptr;
     int32_t  width;
     int32_t  height;
+    std::atomic<int32_t> refs;                  // количество ссылок (см. imagecache.h)
+    void     (*destroy)(struct _IMAGEINFO *ii); // удаление картинки при освобождении последней ссылки
 } * IMAGEINFO;
 
 typedef struct _SCROLLINFO
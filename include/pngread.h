@@ -0,0 +1,21 @@
+// pngread.h
+
+// Построчное чтение PNG через libpng. Строки выдаются в формате cairo ARGB32
+// (32 бита на точку, альфа-канал в старшем байте, цвет умножен на альфу).
+// PNGLoadScaled уменьшает картинку при чтении: в памяти находятся только одна строка
+// исходной картинки и результат, поэтому образец большой картинки стоит столько же,
+// сколько образец маленькой (кроме картинок с чересстрочной разверткой - их приходится
+// читать целиком). Все функции можно вызывать из любого потока.
+
+typedef struct _PNGREADER *PNGREADER;
+
+bool      PNGGetSize(const char *filename, uint32_t *width, uint32_t *height);  // размер по заголовку, без декодирования
+
+PNGREADER PNGOpen(const char *filename, uint32_t *width, uint32_t *height);    // nullptr - не PNG или ошибка чтения
+bool      PNGReadRow(PNGREADER reader, uint32_t *row);                          // очередная строка из width точек
+void      PNGClose(PNGREADER reader);
+
+// картинка, уменьшенная (с сохранением пропорций) до размера не больше maxWidth x maxHeight;
+// результат размещен malloc, строки идут подряд (шаг width*4 байт); nullptr - ошибка
+uint32_t *PNGLoadScaled(const char *filename, uint32_t maxWidth, uint32_t maxHeight,
+                        uint32_t *width, uint32_t *height);
@@ -0,0 +1,261 @@
+// task.h
+
+// Сопрограммы C++20, работающие в главном потоке. Сопрограмма типа Task<T> запускается сразу
+// при вызове и приостанавливается на co_await; ожидаемые объекты (Delay, Background, ReadFile)
+// возобновляют ее в главном цикле, поэтому после co_await можно обращаться к окнам.
+// Сопрограмма-метод окна (или функция, первый параметр которой - окно) привязана к этому окну:
+// если окно уничтожено, она не возобновляется, а уничтожается вместе с ожидающими ее сопрограммами.
+// Если объект Task уничтожен до завершения сопрограммы, она продолжает работу и уничтожается сама.
+// Перед подключением нужны <coroutine>, <optional>, <string>, <type_traits> и mainloop.h.
+
+void RunInPool(std::function<void()> job);                                   // задание в ThreadPool::Get()
+bool ReadWholeFile(const std::string &filename, std::string &data);         // чтение файла целиком
+
+class TaskPromiseBase
+{
+public:
+    TaskPromiseBase();
+    template<class C, class... A>
+    TaskPromiseBase(C &object, A&&...);
+
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    void unhandled_exception() { std::terminate(); }
+
+    bool IsCancelled();                 // уничтожено ли окно-владелец сопрограммы или ожидающих ее
+    void Resume();                      // возобновление из главного цикла с проверкой владельца
+
+    std::coroutine_handle<>  m_handle;       // сама сопрограмма
+    std::coroutine_handle<>  m_continuation; // ожидающая сопрограмма
+    TaskPromiseBase          *m_pParent;     // обещание ожидающей сопрограммы
+    std::shared_ptr<Window*> m_owner;        // окно-владелец; nullptr - не привязана к окну
+    bool                     m_bDetached;    // объект Task уничтожен раньше сопрограммы
+    bool                     m_bCancelled;   // окно-владелец уничтожено, сопрограмма не будет возобновлена
+};
+
+template<class C, class... A>
+TaskPromiseBase::TaskPromiseBase(C &object, A&&...) : TaskPromiseBase()
+{
+    if constexpr(std::is_base_of<Window, C>::value)
+    {
+        m_owner = object.GetLifetime();
+    }
+}
+
+// завершение: переход к ожидающей сопрограмме или самоуничтожение
+class TaskFinalAwaiter
+{
+public:
+    bool await_ready() noexcept { return false; }
+    template<class P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+    {
+        TaskPromiseBase &p = h.promise();
+        if(p.m_continuation)
+        {
+            return p.m_continuation;
+        }
+        if(p.m_bDetached)
+        {
+            h.destroy();
+        }
+        return std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+};
+
+template<class T=void>
+class Task
+{
+public:
+    class promise_type : public TaskPromiseBase
+    {
+    public:
+        using TaskPromiseBase::TaskPromiseBase;
+        Task get_return_object()
+        {
+            m_handle = std::coroutine_handle<promise_type>::from_promise(*this);
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        TaskFinalAwaiter final_suspend() noexcept { return {}; }
+        void return_value(T value) { m_value = std::move(value); }
+        T m_value;
+    };
+
+    Task(Task &&other) : m_h(other.m_h) { other.m_h = nullptr; }
+    Task(const Task &) = delete;
+    ~Task();
+
+    bool IsDone() { return !m_h || m_h.done(); }
+
+    // ожидание из другой сопрограммы
+    bool await_ready() { return m_h.done(); }
+    template<class P>
+    void await_suspend(std::coroutine_handle<P> h)
+    {
+        TaskPromiseBase &p = m_h.promise();
+        p.m_continuation = h;
+        p.m_pParent = &h.promise();
+        if(!p.m_owner)
+        {
+            p.m_owner = p.m_pParent->m_owner;
+        }
+    }
+    T await_resume() { return std::move(m_h.promise().m_value); }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) : m_h(h) {}
+    std::coroutine_handle<promise_type> m_h;
+};
+
+template<>
+class Task<void>
+{
+public:
+    class promise_type : public TaskPromiseBase
+    {
+    public:
+        using TaskPromiseBase::TaskPromiseBase;
+        Task get_return_object()
+        {
+            m_handle = std::coroutine_handle<promise_type>::from_promise(*this);
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        TaskFinalAwaiter final_suspend() noexcept { return {}; }
+        void return_void() {}
+    };
+
+    Task(Task &&other) : m_h(other.m_h) { other.m_h = nullptr; }
+    Task(const Task &) = delete;
+    ~Task();
+
+    bool IsDone() { return !m_h || m_h.done(); }
+
+    bool await_ready() { return m_h.done(); }
+    template<class P>
+    void await_suspend(std::coroutine_handle<P> h)
+    {
+        TaskPromiseBase &p = m_h.promise();
+        p.m_continuation = h;
+        p.m_pParent = &h.promise();
+        if(!p.m_owner)
+        {
+            p.m_owner = p.m_pParent->m_owner;
+        }
+    }
+    void await_resume() {}
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> h) : m_h(h) {}
+    std::coroutine_handle<promise_type> m_h;
+};
+
+template<class T>
+Task<T>::~Task()
+{
+    if(!m_h)
+    {
+        return;
+    }
+    TaskPromiseBase &p = m_h.promise();
+    if(m_h.done() || p.m_continuation || p.m_bCancelled)
+    {
+        // завершена, отменена, либо уничтожается ожидающая сопрограмма - уничтожаем и эту
+        m_h.destroy();
+    }
+    else
+    {
+        p.m_bDetached = true;
+    }
+}
+
+inline Task<void>::~Task()
+{
+    if(!m_h)
+    {
+        return;
+    }
+    TaskPromiseBase &p = m_h.promise();
+    if(m_h.done() || p.m_continuation || p.m_bCancelled)
+    {
+        m_h.destroy();
+    }
+    else
+    {
+        p.m_bDetached = true;
+    }
+}
+
+// co_await Delay(ms) - продолжение через ms миллисекунд
+class Delay
+{
+public:
+    explicit Delay(uint32_t ms) : m_ms(ms) {}
+    bool await_ready() { return false; }
+    template<class P>
+    void await_suspend(std::coroutine_handle<P> h)
+    {
+        TaskPromiseBase *p = &h.promise();
+        InvokeAfter(m_ms, [p]() { p->Resume(); });
+    }
+    void await_resume() {}
+
+private:
+    uint32_t m_ms;
+};
+
+// co_await Background(job) - выполнение job в пуле потоков, результат - значение job
+template<class R>
+class Background
+{
+public:
+    explicit Background(std::function<R()> job) : m_job(std::move(job)) {}
+    bool await_ready() { return false; }
+    template<class P>
+    void await_suspend(std::coroutine_handle<P> h)
+    {
+        // пока задание выполняется, сопрограмма не может быть уничтожена: она возобновляется
+        // (или уничтожается) только из главного цикла, после завершения задания
+        TaskPromiseBase *p = &h.promise();
+        RunInPool([this, p]()
+        {
+            if constexpr(std::is_void<R>::value)
+            {
+                m_job();
+            }
+            else
+            {
+                m_result = m_job();
+            }
+            InvokeOnMainThread([p]() { p->Resume(); });
+        });
+    }
+    R await_resume()
+    {
+        if constexpr(!std::is_void<R>::value)
+        {
+            return std::move(m_result);
+        }
+    }
+
+private:
+    std::function<R()> m_job;
+    typename std::conditional<std::is_void<R>::value, char, R>::type m_result;
+};
+
+template<class F>
+Background(F) -> Background<typename std::invoke_result<F>::type>;
+
+// co_await ReadFile(filename) - содержимое файла; пусто, если файл не прочитан
+inline Background<std::optional<std::string>> ReadFile(const char *filename)
+{
+    std::string name(filename);
+    return Background<std::optional<std::string>>([name]() -> std::optional<std::string>
+    {
+        std::string data;
+        if(!ReadWholeFile(name, data))
+        {
+            return std::nullopt;
+        }
+        return data;
+    });
+}
@@ -1,16 +1,51 @@
+// Текст разбивается на строки по ширине символов из таблицы (см. Context::GetTextAdvances).
+// Абзацы (части текста между переводами строки) размечаются независимо, поэтому текст длиннее
+// TEXT_PARALLEL_SIZE размечается в пуле потоков частями по TEXT_LAYOUT_CHUNK байтов: сразу
+// размечаются только абзацы, видимые в окне, а остальные показываются по готовности разметки.
+// Дописанный в конец текст (AppendText) размечается отдельно вместе с последним абзацем прежнего,
+// остальные строки не меняются; окно, показывавшее конец текста, остается у конца.
+// Подсвечиваемые отрезки (например, найденное) добавляются по возрастанию, и для каждой видимой
+// строки подсветка находится двоичным поиском.
+// Обычно окно прокручивается родителем (Scroll), и его 16-битное положение ограничивает текст
+// несколькими тысячами строк. С SetLineScroll окно прокручивается само, как TextEdit: по целым
+// строкам со своей шкалой, номер первой видимой строки 32-битный, по горизонтали - колесом.
+
 #define FONTFACE_SIZE       100
+#define TEXT_PARALLEL_SIZE  (1<<20)     // текст длиннее размечается в пуле потоков
+#define TEXT_LAYOUT_CHUNK   (1<<18)     // часть текста для одного задания разметки
+#define TEXT_ADVANCE_TABLE  0x800       // символов в таблице ширины; ширина остальных запрашивается при разметке
+#define TEXT_NONE           UINT32_MAX  // нет смещения или подсветки
 
 #define TEXT_ALIGNH_MASK (TEXT_ALIGNH_LEFT|TEXT_ALIGNH_CENTER|TEXT_ALIGNH_RIGHT)
 #define TEXT_ALIGNV_MASK (TEXT_ALIGNV_TOP|TEXT_ALIGNV_CENTER|TEXT_ALIGNV_BOTTOM)
 
+// строка текста - отрезок m_text без перевода строки
+typedef struct _TEXTLINE
+{
+    uint32_t offset;
+    uint32_t length;
+} TEXTLINE;
+
+// подсвечиваемый отрезок текста
+typedef struct _TEXTRANGE
+{
+    uint32_t offset;
+    uint32_t length;
+} TEXTRANGE;
+
+class VerticalScrollBar;
+
 class Text : public Window
 {
 public:
     Text(const char *text=nullptr);
     ~Text();
 
+    void OnCreate();
     void OnDraw(Context *cr);
     void OnSizeChanged();
+    void OnNotify(Window *child, uint32_t type, const Point &position);
+    bool OnScroll(uint64_t value);
 
     RGB  GetTextColor();
     void SetTextColor(const RGB textColor);
@@ -23,20 +58,39 @@ public:
     void     SetWrap(bool bWrap);
     Rect     &GetDataRect();                      // возвращает размер области в пикселях, занимаемой текстом
     uint16_t GetGap() { return m_adv/5; }
+    void     SetLineScroll(bool bLineScroll);   // своя прокрутка по строкам (до добавления окна)
 
     bool     SetText(const char *text);
+    bool     AppendText(const char *text, uint32_t length);   // дописывание в конец; false - не UTF-8
     char     *GetText();
+    void     ScrollToEnd();                     // при следующей отрисовке окно покажет конец текста
+    void     ScrollToOffset(uint32_t offset);   // при следующей отрисовке окно покажет символ со смещением offset
+
+    void     AddHighlights(const TEXTRANGE *ranges, uint32_t n); // по возрастанию смещений, без пересечений
+    void     ClearHighlights();
+    void     SetCurrentHighlight(uint32_t index);   // выделяемая особо подсветка; TEXT_NONE - нет
 
 private:
-    uint8_t GetUnicodeSymbolSize(uint8_t firstbyte);    // определение размера символа UTF-8 по первому байту
-    bool    CheckUTF8(const char *s);                   // проверка, состоит ли строка из допустимых символов UTF-8
     void    PrepareLines(Context *cr, uint16_t limit);  // подготовка текста: разбиение по строкам
+    void    PrepareAdvances(Context *cr);               // таблица ширины символов для текущего шрифта
+    void    AppendLines(Context *cr, uint16_t limit);   // разметка дописанного текста
+    void    CancelLayout();                             // отмена разметки в пуле
+    uint32_t FindLine(uint32_t offset);                 // строка, содержащая смещение
+    void    DrawHighlights(Context *cr, uint32_t line, int16_t x, int64_t y, uint32_t &first);
+    void    ScrollToTarget(Context *cr, const Point &ws, int16_t startX); // ScrollToEnd, ScrollToOffset
+    void    AddLines(const TEXTLINE *lines, uint32_t n);
     void    ClearLines();
+    const char *GetLine(uint32_t offset, uint32_t length);  // строка для вывода: табуляция заменена пробелами
     void    ComputeDataRect(const uint16_t width, const uint16_t limit); // вычисление размера данных
+    uint32_t GetVisibleRows();
+    void    SetTop(int64_t top);                        // первая видимая строка при своей прокрутке
 
 private:
+    std::shared_ptr<char> m_buffer;             // текст; задание разметки держит ссылку до окончания
     char *m_text;
     uint32_t m_textSize;
+    uint32_t m_bufferSize;                      // размер буфера m_buffer
+    uint32_t m_laidOut;                         // размечен текст до этого смещения
     RGB  m_textColor;
     uint16_t m_fontSize;
     int16_t m_ascent, m_descent;                // протяженность символов вверх и вниз от базовой линии
@@ -45,8 +99,27 @@ private:
     uint8_t m_style;                            // TEXT_STYLE_BOLD, TEXT_STYLE_ITALIC
     bool m_bWrap;                               // перенос по словам
     bool m_bTextIsReady;                        // текст готов к отображению: разбит по строкам
-    uint16_t m_nlines;                          // количество строк
-    char **m_lines;                             // массив указателей на строки
+    uint32_t m_nlines, m_maxlines;              // количество строк и размер массива
+    TEXTLINE *m_lines;                          // строки - отрезки m_text
+    char *m_line;                               // буфер строки для вывода
+    uint32_t m_lineSize;
+    std::shared_ptr<float> m_advances;          // ширина символов с кодами до TEXT_ADVANCE_TABLE; nullptr - не вычислена
+    uint16_t m_textWidth;                       // ширина самой длинной строки
+    uint32_t m_nLayout;                         // номер разметки: результаты прежних отбрасываются
+    std::shared_ptr<std::atomic<bool>> m_stop;  // прекратить текущую разметку в пуле
+    bool m_bPartial;                            // размечены только видимые абзацы, остальные - в пуле
+    uint32_t m_anchor;                          // начало первого видимого абзаца при частичной разметке
+    uint16_t m_partialY;                        // положение его первой строки в окне
+    bool m_bToEnd;                              // после разметки показать конец текста
+    uint32_t m_scrollTo;                        // после разметки показать смещение; TEXT_NONE - нет
+    TEXTRANGE *m_highlights;                    // подсвечиваемые отрезки
+    uint32_t m_nHighlights, m_maxHighlights;
+    uint32_t m_currentHighlight;
+    RGB  m_highlightColor, m_currentColor;
     Rect m_textDimensions;                      // размер области с текстом
     Rect m_BackgroundSize;                      // размер текста для отрисовки фона
+    VerticalScrollBar *m_pVBar;                 // своя прокрутка по строкам; nullptr - прокручивает родитель
+    uint32_t m_top;                             // первая видимая строка при своей прокрутке
+    uint16_t m_left;                            // прокрутка по горизонтали, пиксели
+    double m_dx, m_dy;                          // накопленная плавная прокрутка меньше строки, пиксели
 };
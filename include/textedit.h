@@ -0,0 +1,93 @@
+// class TextEdit
+
+// Многострочный редактор текста UTF-8. Текст хранится в таблице кусков (piece table): исходный
+// текст и добавочный буфер не изменяются, документ - последовательность ссылок на их куски.
+// Для обоих буферов ведется указатель начал строк (смещения переводов строки), поэтому строка по
+// номеру и номер строки по положению находятся двоичным поиском. Правка меняет только таблицу
+// кусков (их количество - по числу правок, а не по размеру текста); отмена хранит удаленные куски.
+// Строки не переносятся; рисуются только видимые строки, прокрутка - по целым строкам, номер
+// первой видимой строки 32-битный (как в VirtualList), по горизонтали окно следует за указателем.
+// Клавиши: стрелки, Home, End, PgUp, PgDn, Backspace, Delete, Ctrl+Z - отмена, Ctrl+Y - повтор.
+
+#define TEXTEDIT_FONTFACE_SIZE  100
+#define TEXTEDIT_POINTER_TIMEOUT 500    // мигание указателя, мс
+#define TEXTEDIT_KEY_UNDO       0x1a    // Ctrl+Z
+#define TEXTEDIT_KEY_REDO       0x19    // Ctrl+Y
+
+// оповещения родителя
+enum TextEditEventTypes
+{
+    EVENT_TEXTEDIT_CHANGED = 1,     // текст изменен
+    EVENT_TEXTEDIT_KEY,             // необработанная управляющая клавиша, код - в position.x
+};
+
+struct TextEditData;
+
+class VerticalScrollBar;
+
+class TextEdit : public Window
+{
+public:
+    TextEdit();
+    ~TextEdit();
+
+    bool     SetText(const char *text, uint32_t length);    // новый документ; false - не UTF-8
+    uint32_t GetTextSize();                                 // размер текста в байтах
+    uint32_t GetText(uint32_t position, uint32_t length, char *buf); // копирование части текста, возврат - скопировано байтов
+    uint32_t GetLineCount();
+    bool     IsModified() const { return m_bModified; }
+    void     SetModified(bool bModified) { m_bModified = bModified; }
+    bool     Undo();
+    bool     Redo();
+
+    RGB      GetTextColor() const { return m_textColor; }
+    void     SetTextColor(const RGB textColor) { m_textColor = textColor; }
+    void     SetFont(const char *FontFace, const int16_t FontSize);
+
+    void     OnCreate();
+    void     OnDraw(Context *cr);
+    void     OnSizeChanged();
+    void     OnNotify(Window *child, uint32_t type, const Point &position);
+    bool     OnLeftMouseButtonClick(const Point &position);
+    bool     OnKeyPress(uint64_t value);
+    bool     OnKeyboardCapture(bool bCapture);
+    bool     OnTimeout();
+    bool     OnScroll(uint64_t value);
+
+private:
+    void     Insert(const char *s, uint32_t length);        // вставка в положении указателя
+    void     Delete(uint32_t position, uint32_t length, bool bBackward);
+    void     Changed();                                     // после правки: прокрутка к указателю, оповещение
+    uint32_t GetLineStart(uint32_t line);
+    uint32_t GetLineEnd(uint32_t line);                     // положение перевода строки или конца текста
+    uint32_t GetLineOf(uint32_t position);
+    uint32_t NextSymbol(uint32_t position);
+    uint32_t PrevSymbol(uint32_t position);
+    uint32_t GetColumn(uint32_t position);                  // номер символа в строке
+    uint32_t GetPosition(uint32_t line, uint32_t column);   // положение символа в строке (или ее конца)
+    const char *GetLine(uint32_t line, uint32_t end);       // строка для вывода до положения end: табуляция заменена пробелом
+    uint32_t GetVisibleRows();
+    void     SetTop(int64_t top);
+    void     ScrollToPointer();
+
+    TextEditData *m_pData;
+    uint32_t m_pointer;                         // положение указателя (курсора) в байтах
+    uint32_t m_column;                          // столбец для перемещения вверх и вниз
+    uint32_t m_top;                             // первая видимая строка
+    uint16_t m_left;                            // прокрутка по горизонтали, пиксели
+    double   m_dy;                              // накопленная плавная прокрутка меньше строки, пиксели
+    uint16_t m_rowHeight;
+    bool     m_bModified;
+    bool     m_bCoalesce;                       // следующий символ продолжает ту же отменяемую правку
+    bool     m_bFocus;
+    uint8_t  m_Pointer;                         // указатель отображается (мигание)
+    Point    m_StoredClick;                     // щелчок, обрабатываемый при отрисовке
+    bool     m_bStoredClick;
+    char     *m_line;                           // буфер строки для вывода
+    uint32_t m_lineSize;
+    RGB      m_textColor;
+    RGB      m_pointerColor;
+    char     m_fontFace[TEXTEDIT_FONTFACE_SIZE+1];
+    uint16_t m_fontSize;
+    VerticalScrollBar *m_pVBar;
+};
@@ -0,0 +1,13 @@
+// textsearch.h
+
+// Поиск подстроки в тексте. С SSE2 за шаг проверяются 16 возможных начал: сравниваются первый и
+// последний байты образца, и только совпавшие начала проверяются целиком. Чтения не выходят за
+// пределы текста (хвост проверяется по байту), поэтому текст может быть отображением файла.
+// Подсчет байтов (например, переводов строки) так же идет по 16 байтов за шаг.
+// Можно вызывать из любого потока.
+
+// первое вхождение pattern в text; nullptr - не найдено; пустой образец находится в начале
+const char *SearchText(const char *text, size_t length, const char *pattern, size_t patternLength);
+
+// количество байтов c в text
+size_t CountByte(const char *text, size_t length, char c);
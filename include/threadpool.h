@@ -0,0 +1,28 @@
+// threadpool.h
+
+// Пул рабочих потоков с перехватом заданий (work stealing): у каждого потока своя очередь,
+// освободившийся поток забирает задания из чужих очередей. Задания, поставленные из рабочего
+// потока, попадают в его собственную очередь; из остальных потоков - по очереди во все.
+
+struct ThreadPoolData;
+
+class ThreadPool
+{
+public:
+    ThreadPool(uint16_t nThreads=0);            // 0 - по количеству процессоров (или GUI_THREADS)
+    ~ThreadPool();                              // дожидается выполнения всех поставленных заданий
+
+    void     Submit(std::function<void()> job); // поставить задание в очередь; можно вызывать из любого потока
+    void     ParallelFor(uint32_t n, std::function<void(uint32_t)> fn); // fn(0) ... fn(n-1) в пуле и в вызывающем потоке; возврат - после всех
+    uint16_t GetThreadCount() const { return m_nThreads; }
+    bool     IsWorkerThread() const;            // вызвано ли из рабочего потока этого пула
+
+    static ThreadPool *Get();                   // общий пул библиотеки
+
+private:
+    void WorkerThread(uint16_t n);
+    bool GetJob(uint16_t n, std::function<void()> &job);
+
+    uint16_t       m_nThreads;
+    ThreadPoolData *m_pData;
+};
@@ -0,0 +1,32 @@
+// thumbcache.h
+
+// Кэш образцов картинок на диске ($XDG_CACHE_HOME/gui3, по умолчанию ~/.cache/gui3).
+// Образцы хранятся в формате cairo ARGB32 в одном файле-пакете, каждый с начала страницы,
+// и отображаются в память (mmap) без копирования и декодирования. Ключ - полный путь к файлу,
+// время его изменения, размер и наибольший размер образца. Кэшем могут пользоваться несколько
+// процессов одновременно. GUI_THUMBCACHE=0 отключает кэш, GUI_THUMBCACHE_MAX - наибольший
+// размер пакета в мегабайтах (по умолчанию 256, 0 - без ограничения), при превышении кэш очищается.
+// Все функции можно вызывать из любого потока. Требует <climits> (PATH_MAX).
+
+// ключ образца: состояние файла до декодирования, чтобы изменение файла во время
+// декодирования не привело к записи устаревшего образца под новым ключом
+typedef struct _THUMBKEY
+{
+    char     path[PATH_MAX];    // полный путь; пустая строка - файла нет
+    int64_t  mtime;             // время изменения файла, нс
+    uint64_t size;
+} THUMBKEY;
+
+typedef struct _THUMB
+{
+    uint32_t *pixels;       // ARGB32, шаг строк width*4 байт
+    uint32_t width, height;
+    void     *map;          // отображение файла-пакета
+    size_t   mapSize;
+} *THUMB;
+
+bool  ThumbCacheKey(const char *filename, THUMBKEY *key);
+THUMB ThumbCacheLookup(const char *filename, uint16_t maxWidth, uint16_t maxHeight, THUMBKEY *key); // nullptr - образца нет; key - для ThumbCacheStore
+void  ThumbCacheStore(const THUMBKEY *key, uint16_t maxWidth, uint16_t maxHeight,
+                      const uint32_t *pixels, uint32_t width, uint32_t height);
+void  ThumbCacheRelease(THUMB thumb);
@@ -0,0 +1,83 @@
+// tiledimage.h
+
+// Просмотр очень больших картинок (больше, чем помещается в одну поверхность cairo).
+// PNG читается построчно в пуле потоков и раскладывается на плитки TILE_SIZE x TILE_SIZE
+// во временном файле: уровень 0 - исходный размер, каждый следующий уменьшен вдвое,
+// последний помещается в одну плитку. Отрисовываются только плитки, видимые в окне,
+// с уровня, соответствующего масштабу; плитки подгружаются из файла в пуле потоков,
+// пока плитка не загружена, на ее месте рисуется плитка более крупного уровня.
+// Объем загруженных плиток ограничен (SetCacheBudget), давно не отображавшиеся плитки выгружаются.
+// Прокрутка - буксировка мышью, колесо, стрелки; масштаб - '+', '-', '0' (вписать в окно).
+
+#define TILE_SIZE           256                     // сторона плитки, точки
+#define TILE_BYTES          (TILE_SIZE*TILE_SIZE*4) // место плитки во временном файле
+#define TILE_LEVELS         24                      // наибольшее количество уровней
+#define TILE_CACHE_MB       64                      // объем загруженных плиток по умолчанию, Мб
+#define TILE_LOADS          4                       // наибольшее количество одновременно загружаемых плиток
+#define TILE_MAX_ZOOM       8.0                     // наибольшее увеличение
+#define TILE_ZOOM_STEP      1.25                    // шаг изменения масштаба
+#define TILE_PAN_STEP       64                      // шаг прокрутки стрелками, точки экрана
+#define TILE_SETTLE_MS      150                     // пауза после прокрутки до перерисовки качественным фильтром
+
+// состояние плитки
+enum TileState
+{
+    TILE_EMPTY,         // не загружена
+    TILE_LOADING,       // загружается в пуле потоков
+    TILE_READY,         // загружена
+    TILE_FAILED,        // загрузить не удалось
+};
+
+typedef struct _TILE
+{
+    IMAGEINFO ii;
+    uint32_t  used;     // номер кадра, в котором плитка отображалась последний раз
+    uint8_t   state;
+} TILE;
+
+struct _TILEPYRAMID;
+
+class TiledImage : public Window
+{
+public:
+    TiledImage();
+    ~TiledImage();
+
+    void OnDraw(Context *cr);
+    bool OnKeyPress(uint64_t keyval);
+    bool OnLeftMouseButtonClick(const Point &position);
+    bool OnMouseMove(const Point &position);
+    bool OnLeftMouseButtonRelease(const Point &position);
+    bool OnScroll(uint64_t value);
+
+    void Load(const char *filename);    // разбиение на плитки в пуле потоков; до окончания окно пустое
+    void Close();
+    bool IsLoaded();                    // плитки готовы
+    bool IsFailed();                    // картинку прочитать не удалось
+
+    void Fit();                         // масштаб, при котором картинка целиком помещается в окне
+    void Zoom(double factor);           // изменение масштаба относительно центра окна
+    void Pan(double dx, double dy);     // прокрутка на dx, dy точек экрана
+    void SetCacheBudget(uint64_t bytes);
+
+private:
+    void Changed();                                         // прокрутка или масштаб изменены
+    void LoadTile(Context *cr, uint64_t index, uint8_t level, uint32_t column, uint32_t row);
+    void DrawTile(Context *cr, uint8_t level, uint32_t column, uint32_t row, double x0, double y0, uint8_t filter);
+    void Evict();                                           // выгрузка плиток сверх бюджета
+
+    std::shared_ptr<struct _TILEPYRAMID> m_pyramid;
+    TILE      *m_tiles;                 // плитки всех уровней подряд
+    uint64_t  m_bytes;                  // объем загруженных плиток
+    uint64_t  m_budget;
+    uint32_t  m_nFrame;                 // номер кадра
+    uint32_t  m_nLoad;                  // номер загружаемой картинки
+    uint16_t  m_nLoading;               // количество загружаемых плиток
+    uint32_t  m_nChange;                // номер изменения прокрутки или масштаба
+    bool      m_bInteractive;           // идет прокрутка - рисуем быстрым фильтром
+    bool      m_bFailed;
+    double    m_zoom;                   // точек экрана на точку картинки
+    double    m_x, m_y;                 // точка картинки в центре окна
+    bool      m_bDrag;
+    int32_t   m_dragX, m_dragY;
+};
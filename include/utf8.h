@@ -0,0 +1,15 @@
+// utf8.h
+
+// Проверка и разбор текста UTF-8. Допустимы только кратчайшие формы символов до U+10FFFF без
+// суррогатов (RFC 3629); текст, не прошедший проверку, окна не принимают (SetText возвращает false).
+// Проверка с AVX2 идет по 32 байта без ветвлений (таблицы по старшим и младшим полубайтам
+// соседних байтов), иначе ASCII пропускается по 16 байтов (SSE2), остальное проверяется побайтно.
+// AVX2 выбирается при первом вызове по возможностям процессора; GUI_AVX2=0 отключает его.
+// Все функции можно вызывать из любого потока.
+
+uint8_t UTF8SymbolSize(uint8_t lead);                      // длина символа по первому байту; 0 - не первый байт
+bool    UTF8Validate(const char *s, size_t length);
+size_t  UTF8Count(const char *s, size_t length);           // количество символов (проверенного текста)
+size_t  UTF8Offset(const char *s, size_t length, size_t index);    // смещение символа index; length - если символов меньше
+uint32_t UTF8Decode(const char *s, uint8_t *size);          // код символа проверенного текста и его длина
+uint8_t  UTF8Encode(uint32_t code, char *s);                // запись символа (до 4 байтов, без нуля), возврат - длина
@@ -0,0 +1,66 @@
+// class VirtualList
+
+// Список из большого количества строк без окна на каждую строку: строки запрашиваются у
+// источника (SetSource) только для видимой части и рисуются самим списком. Прокрутка - по целым
+// строкам, номер первой видимой строки хранится в 32 битах, поэтому число строк не ограничено
+// размером документа Scroll.
+// Оповещения родителя - те же, что у List (EVENT_LIST_*, см. list.h); номер строки - GetSelection().
+// Перед подключением нужны <functional>, list.h и scroll.h.
+
+#define VLIST_FONTFACE_SIZE 100
+
+// строка списка, заполняемая источником
+typedef struct _LISTROW
+{
+    const char *text;       // действителен до возврата из OnDraw
+    uint8_t    style;       // TEXT_STYLE_BOLD, TEXT_STYLE_ITALIC
+} LISTROW;
+
+typedef std::function<void(uint32_t row, LISTROW *pRow)> LISTSOURCE;
+
+class VirtualList : public Window
+{
+public:
+    VirtualList();
+    ~VirtualList();
+
+    void     SetSource(LISTSOURCE source);
+    void     SetRowCount(uint32_t nRows);       // количество строк изменилось (строки перерисовываются)
+    uint32_t GetRowCount() const { return m_nRows; }
+    void     InsertRows(uint32_t row, uint32_t n);  // вставка: выбор и прокрутка сохраняются за своими строками
+    void     DeleteRows(uint32_t row, uint32_t n);
+
+    int32_t  GetSelection() const { return m_nSelection; }
+    void     SetSelection(int32_t row);
+    RGB      GetSelBackColor() const { return m_selbackColor; }
+    void     SetSelBackColor(const RGB Color) { m_selbackColor = Color; }
+    uint16_t GetRowHeight() const { return m_rowHeight; }
+    void     SetRowHeight(uint16_t height);
+    void     SetFont(const char *FontFace, const int16_t FontSize);
+    void     ScrollTo(uint32_t row);            // сделать строку видимой
+
+    void     OnCreate();
+    void     OnDraw(Context *cr);
+    void     OnSizeChanged();
+    void     OnNotify(Window *child, uint32_t type, const Point &position);
+    bool     OnLeftMouseButtonClick(const Point &position);
+    bool     OnLeftMouseButtonDoubleClick(const Point &position);
+    bool     OnScroll(uint64_t value);
+
+private:
+    int32_t  RowAt(const Point &position);      // строка под точкой; -1 - строки нет
+    uint32_t GetVisibleRows();                  // строк помещается в окне (хотя бы одна)
+    void     SetTop(int64_t top);               // прокрутка с ограничением
+
+    LISTSOURCE m_source;
+    uint32_t m_nRows;
+    uint32_t m_top;                             // первая видимая строка
+    double   m_dy;                              // накопленная плавная прокрутка меньше строки, пиксели
+    uint16_t m_rowHeight;
+    int32_t  m_nSelection;
+    RGB      m_selbackColor;
+    RGB      m_textColor;
+    char     m_fontFace[VLIST_FONTFACE_SIZE+1];
+    uint16_t m_fontSize;
+    VerticalScrollBar *m_pVBar;
+};
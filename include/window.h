@@ -1,4 +1,7 @@
 #include <inttypes.h>
+#include <functional>
+#include <memory>
+#include <atomic>
 #include "mytypes.h"
 #include "context.h"
 
@@ -22,6 +25,8 @@ enum WindowEventTypes
     EVENT_LASTNUMBER
 };
 
+#define EVENT_USER          0x1000      // начало номеров событий приложения (см. PostEvent, OnUserEvent)
+
 class Window
 {
 public:
@@ -64,11 +69,26 @@ public:
     virtual void CaptureMouse(Window *pWindow);                     // ретрансляция родителю о захвате мыши (для буксировки при скролинге, перемещении окна и т.п.)
     virtual bool HasKeyboard(Window *pWindow);                      // проверка, является ли окно владельцем клавиатуры
 
+    // фоновые задания: job выполняется в пуле потоков, затем done - в главном потоке,
+    // если окно к этому времени не уничтожено (иначе done отбрасывается)
+    void        RunInBackground(std::function<void()> job, std::function<void()> done=nullptr);
+    // тип результата - по job; release освобождает результат, если done не вызван или
+    // не забрал его (done забирает результат, обнуляя его)
+    template<class F>
+    void        RunInBackground(F job, std::function<void(std::invoke_result_t<F>&)> done,
+                    std::function<void(std::invoke_result_t<F>&)> release=nullptr);
+    std::shared_ptr<Window*> GetLifetime();                         // адрес окна, обнуляемый при его уничтожении
+
+    // работа в паузах главного цикла: step выполняет порцию работы и возвращает true, пока работа
+    // не закончена; задание снимается при уничтожении окна (см. idle.h)
+    void        RunWhenIdle(std::function<bool()> step);
+
     // прокрутка
     virtual Rect &GetDataRect();                                    // возвращает размер данных в окне - м.б. больше окна
     virtual void OnDataRectChanged(const Window *pWindow, const Rect &rect); // оповещение об изменении размера окна с данными
     void        SetOrigin(Point origin);                            // установка положения окна в документе - для прокрутки
     Point       GetOrigin();                                        // возврат положения окна в документе - для прокрутки
+    virtual void OnOriginChanged() {}                               // оповещение об изменении положения окна в документе
 
     // рамка
     RGB  GetFrameColor();
@@ -101,6 +121,7 @@ public:
     virtual bool OnTimeout() { return false; }
     virtual bool OnKeyboardCapture(bool bCapture) { return false; }
     virtual bool OnScroll(uint64_t value) { return false; }
+    virtual bool OnUserEvent(uint32_t type, const Point &position, uint64_t value) { return false; }
 //    ...
 
 private:
@@ -114,6 +135,7 @@ private:
     RGB     m_frameColor;                                           // цвет рамки
     uint16_t m_frameWidth;                                          // толщина рамки
     bool    m_bShow;                                                // отображение окна
+    std::shared_ptr<Window*> m_pSelf;                               // адрес окна для фоновых заданий; обнуляется при уничтожении
 protected:
     RGB     m_backColor;                                            // цвет фона
     Rect    m_InteriorSize;                                         // размер внутренней части окна (без рамки, меню, статуса, заголовка и т.п.)
@@ -122,3 +144,19 @@ public:
     const char    *m_ClassName;
 };
 
+// фоновое задание с результатом: результат передается в done в главном потоке
+template<class F>
+void Window::RunInBackground(F job, std::function<void(std::invoke_result_t<F>&)> done,
+    std::function<void(std::invoke_result_t<F>&)> release)
+{
+    typedef std::invoke_result_t<F> R;
+    std::shared_ptr<R> result(new R(), [release](R *p)
+        {
+            if(release)
+            {
+                release(*p);
+            }
+            delete p;
+        });
+    RunInBackground([job, result]() { *result = job(); }, [done, result]() { done(*result); });
+}
@@ -1,8 +1,22 @@
 #include <iostream>
+#include <atomic>
+#include <string>
+#include <functional>
 #include <assert.h>
 #include <cstring>
+#include <climits>
+#include <glib-unix.h>
 
 #include "window.h"
+#include "alloctrack.h"
+#include "metrics.h"
+#include "mainloop.h"
+#include "eventqueue.h"
+#include "idle.h"
+#include "pngread.h"
+#include "thumbcache.h"
+#include "imagecache.h"
+#include "utf8.h"
 #include "GUI.h"
 
 CairoContext::CairoContext()
@@ -208,6 +222,34 @@ void CairoContext::GetFontInfo(const char *fontface, const uint16_t fontsize, co
     *maxadvance = fe.max_x_advance;
 }
 
+// контекст рисования не используется: у каждого вызова свой шрифт cairo_scaled_font_t,
+// поэтому функцию можно вызывать из рабочих потоков (разметка текста, см. text.h)
+void CairoContext::GetTextAdvances(const char *fontface, const uint16_t fontsize, const uint32_t style,
+    const uint32_t *codes, uint32_t n, float *advances)
+{
+    cairo_font_face_t *face = cairo_toy_font_face_create(fontface,
+        style & TEXT_STYLE_ITALIC ? CAIRO_FONT_SLANT_ITALIC : CAIRO_FONT_SLANT_NORMAL,
+        style & TEXT_STYLE_BOLD ? CAIRO_FONT_WEIGHT_BOLD : CAIRO_FONT_WEIGHT_NORMAL);
+    cairo_matrix_t fm, ctm;
+    cairo_matrix_init_scale(&fm, fontsize, fontsize);
+    cairo_matrix_init_identity(&ctm);
+    cairo_font_options_t *options = cairo_font_options_create();
+    cairo_scaled_font_t *font = cairo_scaled_font_create(face, &fm, &ctm, options);
+
+    for(uint32_t i=0; i<n; i++)
+    {
+        char s[5];
+        s[UTF8Encode(codes[i], s)] = 0;
+        cairo_text_extents_t te;
+        cairo_scaled_font_text_extents(font, s, &te);
+        advances[i] = te.x_advance;
+    }
+
+    cairo_scaled_font_destroy(font);
+    cairo_font_options_destroy(options);
+    cairo_font_face_destroy(face);
+}
+
 void CairoContext::Polyline(const uint16_t n, const Point p[])
 {
 	cairo_set_source_rgba(m_cr, m_color.GetRed(), m_color.GetGreen(), m_color.GetBlue(), 1.0);
@@ -240,6 +282,15 @@ void CairoContext::FillPolyline(const uint16_t n, const Point p[])
     }
 }
 
+// удаление картинки при освобождении последней ссылки
+static void destroy_image(IMAGEINFO ii)
+{
+    cairo_surface_t *image = (cairo_surface_t *) ii->imageptr;
+    ImageBytesChanged(-(int64_t) cairo_image_surface_get_stride(image)*ii->height);
+    cairo_surface_destroy (image);
+    delete ii;
+}
+
 IMAGEINFO CairoContext::LoadPNG(const char *filename)
 {
     cairo_surface_t *image;
@@ -253,17 +304,133 @@ IMAGEINFO CairoContext::LoadPNG(const char *filename)
     ii->imageptr = (IMAGEPTR) image;
     ii->width = cairo_image_surface_get_width(image);
     ii->height = cairo_image_surface_get_height(image);
+    ii->refs = 1;
+    ii->destroy = destroy_image;
+
+    metricImagesLoaded.Add();
+    ImageBytesChanged((int64_t) cairo_image_surface_get_stride(image)*ii->height);
+    return ii;
+}
+
+static cairo_user_data_key_t s_pixelsKey;     // владение точками картинки (malloc или кэш образцов)
+
+static void release_thumb(void *thumb)
+{
+    ThumbCacheRelease((THUMB) thumb);
+}
+
+IMAGEINFO CairoContext::LoadPNG(const char *filename, uint16_t maxWidth, uint16_t maxHeight)
+{
+    // образец из кэша используется прямо из отображенного в память файла
+    uint32_t width, height, *pixels;
+    cairo_destroy_func_t release;
+    void *owner;
+
+    THUMBKEY key;
+    THUMB thumb = ThumbCacheLookup(filename, maxWidth, maxHeight, &key);
+    if(thumb)
+    {
+        width = thumb->width;
+        height = thumb->height;
+        pixels = thumb->pixels;
+        release = release_thumb;
+        owner = thumb;
+    }
+    else
+    {
+        pixels = PNGLoadScaled(filename, maxWidth, maxHeight, &width, &height);
+        if(!pixels)
+        {
+            return NULL;
+        }
+        ThumbCacheStore(&key, maxWidth, maxHeight, pixels, width, height);
+        release = free;
+        owner = pixels;
+    }
+
+    // поверхность использует точки без копирования и освобождает их при уничтожении
+    cairo_surface_t *image = cairo_image_surface_create_for_data((unsigned char *) pixels,
+        CAIRO_FORMAT_ARGB32, width, height, width*4);
+    if(cairo_surface_status(image) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy(image);
+        release(owner);
+        return NULL;
+    }
+    cairo_surface_set_user_data(image, &s_pixelsKey, owner, release);
+
+    IMAGEINFO ii = new struct _IMAGEINFO;
+    ii->imageptr = (IMAGEPTR) image;
+    ii->width = width;
+    ii->height = height;
+    ii->refs = 1;
+    ii->destroy = destroy_image;
+
+    metricImagesLoaded.Add();
+    ImageBytesChanged((int64_t) width*4*height);
     return ii;
 }
 
 void CairoContext::DeletePNG(IMAGEINFO ii)
 {
-    cairo_surface_t *image = (cairo_surface_t *) ii->imageptr;
-    cairo_surface_destroy (image);
-    delete ii;
+    ImageRelease(ii);
+}
+
+IMAGEINFO CairoContext::ScaleImage(const IMAGEINFO ii, uint16_t width, uint16_t height, uint8_t filter)
+{
+    cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+    if(cairo_surface_status(image) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy(image);
+        return NULL;
+    }
+
+    // отдельный cairo_t - масштабирование не зависит от текущей отрисовки
+    cairo_t *cr = cairo_create(image);
+    cairo_scale(cr, (double) width/ii->width, (double) height/ii->height);
+    cairo_set_source_surface(cr, (cairo_surface_t *) ii->imageptr, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(cr), filter == IMAGE_FILTER_FAST ? CAIRO_FILTER_FAST : CAIRO_FILTER_GOOD);
+    cairo_pattern_set_extend(cairo_get_source(cr), CAIRO_EXTEND_PAD);   // края без затемнения
+    cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairo_surface_flush(image);
+
+    IMAGEINFO scaled = new struct _IMAGEINFO;
+    scaled->imageptr = (IMAGEPTR) image;
+    scaled->width = width;
+    scaled->height = height;
+    scaled->refs = 1;
+    scaled->destroy = destroy_image;
+
+    ImageBytesChanged((int64_t) cairo_image_surface_get_stride(image)*height);
+    return scaled;
+}
+
+IMAGEINFO CairoContext::CreateImage(uint32_t *pixels, uint16_t width, uint16_t height)
+{
+    cairo_surface_t *image = cairo_image_surface_create_for_data((unsigned char *) pixels,
+        CAIRO_FORMAT_ARGB32, width, height, width*4);
+    if(cairo_surface_status(image) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy(image);
+        free(pixels);
+        return NULL;
+    }
+    cairo_surface_set_user_data(image, &s_pixelsKey, pixels, free);
+
+    IMAGEINFO ii = new struct _IMAGEINFO;
+    ii->imageptr = (IMAGEPTR) image;
+    ii->width = width;
+    ii->height = height;
+    ii->refs = 1;
+    ii->destroy = destroy_image;
+
+    ImageBytesChanged((int64_t) width*4*height);
+    return ii;
 }
 
-void CairoContext::Image(const IMAGEINFO ii, const Point &position, double scaleX, double scaleY)
+void CairoContext::Image(const IMAGEINFO ii, const Point &position, double scaleX, double scaleY, uint8_t filter)
 {
     cairo_surface_t *image = (cairo_surface_t *) ii->imageptr;
 
@@ -271,10 +438,29 @@ void CairoContext::Image(const IMAGEINFO ii, const Point &position, double scale
     cairo_scale (m_cr, scaleX, scaleY);
 
     cairo_set_source_surface (m_cr, image, (position.GetX()-m_x+m_xp)/scaleX, (position.GetY()-m_y+m_yp)/scaleY);
+    cairo_pattern_set_filter(cairo_get_source(m_cr), filter == IMAGE_FILTER_FAST ? CAIRO_FILTER_FAST : CAIRO_FILTER_GOOD);
     cairo_paint (m_cr);
     cairo_restore(m_cr);
 }
 
+void CairoContext::StretchImage(const IMAGEINFO ii, int32_t x, int32_t y, uint32_t width, uint32_t height, uint8_t filter)
+{
+    cairo_surface_t *image = (cairo_surface_t *) ii->imageptr;
+
+    cairo_save(m_cr);
+    cairo_translate(m_cr, x-m_x+m_xp, y-m_y+m_yp);
+    cairo_scale(m_cr, (double) width/ii->width, (double) height/ii->height);
+
+    // заливка прямоугольника вместо cairo_paint: продолжение краев (EXTEND_PAD)
+    // не дает швов между соседними картинками
+    cairo_set_source_surface(m_cr, image, 0, 0);
+    cairo_pattern_set_filter(cairo_get_source(m_cr), filter == IMAGE_FILTER_FAST ? CAIRO_FILTER_FAST : CAIRO_FILTER_GOOD);
+    cairo_pattern_set_extend(cairo_get_source(m_cr), CAIRO_EXTEND_PAD);
+    cairo_rectangle(m_cr, 0, 0, ii->width, ii->height);
+    cairo_fill(m_cr);
+    cairo_restore(m_cr);
+}
+
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -331,17 +517,42 @@ int GtkPlus::Run(int argc, char **argv, Window *wnd, uint16_t w, uint16_t h)
 	// Показываем окно
 	gtk_widget_show_all(m_Widget);
 
+	// источник событий, отправленных окнам функцией PostEvent
+	static GSourceFuncs postedFuncs = { on_posted_prepare, on_posted_check, on_posted_dispatch, nullptr, nullptr, nullptr };
+	GSource *posted = g_source_new(&postedFuncs, sizeof(GSource));
+	g_source_set_name(posted, "PostEvent");
+	g_source_attach(posted, nullptr);
+
+	// публикация метрик (если задана переменными окружения)
+	MetricsStart();
+
 	// Приложение переходит в вечный цикл ожидания действий пользователя
 	gtk_main();
 
+	MetricsStop();
+	g_source_destroy(posted);
+	g_source_unref(posted);
+	ALLOC_TRACK_REPORT();
+
 	return 0;
 }
 
 bool GtkPlus::NotifyWindow(uint32_t type, const Point &p, uint64_t value, Window *pTarget)
 {
     Window *pWindow = pTarget != NULL ? pTarget : m_Window;
+    ALLOC_TRACK_BEGIN(type);
     bool res = pWindow->WindowProc(type, p, value);
+    ALLOC_TRACK_END(type);
+    metricEventsDispatched.Add();
+
+    ProcessRequests();
+
+    return res;
+}
 
+// обработка запросов окон на перерисовку и завершение приложения
+void GtkPlus::ProcessRequests()
+{
     if(m_bReDraw)
     {
         gtk_widget_queue_draw(m_Widget);
@@ -353,8 +564,6 @@ bool GtkPlus::NotifyWindow(uint32_t type, const Point &p, uint64_t value, Window
         gtk_main_quit();
         m_Window->DeleteAllChildren();
     }
-
-    return res;
 }
 
 void GtkPlus::DestroyWidget(GtkWidget *widget)
@@ -368,8 +577,12 @@ void GtkPlus::DestroyWidget(GtkWidget *widget)
 gboolean GtkPlus::Draw(GtkWidget *widget, cairo_t *cr)
 {
     assert(m_Widget == widget);
+    gint64 start = g_get_monotonic_time();
+    ALLOC_TRACK_BEGIN(ALLOC_SCOPE_FRAME);
     SetCairoContext(cr);
     m_Window->Draw(this);
+    ALLOC_TRACK_END(ALLOC_SCOPE_FRAME);
+    metricFrameTime.Observe(g_get_monotonic_time()-start);
     return TRUE;
 }
 
@@ -706,5 +919,115 @@ gboolean on_timeout(gpointer user_data)
 {
     Window *win = reinterpret_cast<Window*>(user_data);
     assert(theGUI);
+    metricTimersFired.Add();
     return theGUI->NotifyWindow(EVENT_TIMEOUT, Point(0,0), 0, win);
 }
+
+gboolean on_invoke(gpointer user_data)
+{
+    std::function<void()> *fn = reinterpret_cast<std::function<void()>*>(user_data);
+    (*fn)();
+    if(theGUI)
+    {
+        theGUI->ProcessRequests();
+    }
+    return G_SOURCE_REMOVE;
+}
+
+void on_invoke_destroy(gpointer user_data)
+{
+    delete reinterpret_cast<std::function<void()>*>(user_data);
+}
+
+// всегда через очередь главного цикла: и из главного потока fn выполняется позже, не внутри вызывающего
+void InvokeOnMainThread(std::function<void()> fn)
+{
+    GSource *source = g_idle_source_new();
+    g_source_set_priority(source, G_PRIORITY_DEFAULT);
+    g_source_set_callback(source, on_invoke, new std::function<void()>(std::move(fn)), on_invoke_destroy);
+    g_source_attach(source, nullptr);
+    g_source_unref(source);
+}
+
+void InvokeAfter(uint32_t ms, std::function<void()> fn)
+{
+    g_timeout_add_full(G_PRIORITY_DEFAULT, ms, on_invoke, new std::function<void()>(std::move(fn)), on_invoke_destroy);
+}
+
+void WakeMainLoop()
+{
+    g_main_context_wakeup(nullptr);
+}
+
+gboolean on_fd_ready(gint fd, GIOCondition condition, gpointer user_data)
+{
+    std::function<void()> *fn = reinterpret_cast<std::function<void()>*>(user_data);
+    (*fn)();
+    if(theGUI)
+    {
+        theGUI->ProcessRequests();
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+uint32_t WatchFd(int fd, std::function<void()> fn)
+{
+    return g_unix_fd_add_full(G_PRIORITY_DEFAULT, fd, G_IO_IN, on_fd_ready, new std::function<void()>(std::move(fn)), on_invoke_destroy);
+}
+
+void UnwatchFd(uint32_t id)
+{
+    if(id)
+    {
+        g_source_remove(id);
+    }
+}
+
+// источник работы в паузах: приоритет ниже ввода и отрисовки (G_PRIORITY_DEFAULT_IDLE)
+static guint s_idleSource = 0;
+
+gboolean on_idle(gpointer user_data)
+{
+    bool more = RunIdleSlice();
+    if(theGUI)
+    {
+        theGUI->ProcessRequests();
+    }
+    if(!more)
+    {
+        s_idleSource = 0;
+        return G_SOURCE_REMOVE;
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+void RequestIdle()
+{
+    if(s_idleSource == 0)
+    {
+        s_idleSource = g_idle_add_full(G_PRIORITY_DEFAULT_IDLE, on_idle, nullptr, nullptr);
+    }
+}
+
+gboolean on_posted_prepare(GSource *source, gint *timeout)
+{
+    *timeout = -1;
+    return HasPostedEvents();
+}
+
+gboolean on_posted_check(GSource *source)
+{
+    return HasPostedEvents();
+}
+
+bool deliver_posted_event(Window *pTarget, uint32_t type, const Point &position, uint64_t value)
+{
+    assert(theGUI);
+    return theGUI->NotifyWindow(type, position, value, pTarget);
+}
+
+gboolean on_posted_dispatch(GSource *source, GSourceFunc callback, gpointer user_data)
+{
+    DispatchPostedEvents(deliver_posted_event);
+    return G_SOURCE_CONTINUE;
+}
@@ -0,0 +1,223 @@
+// alloctrack.cc
+
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include "window.h"
+#include "alloctrack.h"
+
+#define ALLOC_STACK_DEPTH   32                      // допустимая вложенность областей учета
+
+// счетчики выделений текущего потока; выделения рабочих потоков в кадры не попадают
+static thread_local uint64_t tl_count = 0;
+static thread_local uint64_t tl_bytes = 0;
+
+static inline void CountAllocation(size_t size)
+{
+    ++tl_count;
+    tl_bytes += size;
+}
+
+#ifdef GUI_ALLOC_TRACKING
+
+// перехват функций распределения памяти: подсчет и вызов реализации glibc
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t n, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+extern "C" void *malloc(size_t size)
+{
+    CountAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+    CountAllocation(n*size);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    CountAllocation(size);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+    __libc_free(ptr);
+}
+
+void *operator new(size_t size)
+{
+    CountAllocation(size);
+    void *p = __libc_malloc(size);
+    if(!p)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+    CountAllocation(size);
+    return __libc_malloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+    CountAllocation(size);
+    return __libc_malloc(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    __libc_free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    __libc_free(ptr);
+}
+
+#endif // GUI_ALLOC_TRACKING
+
+// состояние учета (используется только главным потоком)
+static ALLOCSTAT s_stat[ALLOC_SCOPES];
+static uint64_t  s_budgetCount[ALLOC_SCOPES];
+static uint64_t  s_budgetBytes[ALLOC_SCOPES];
+static bool      s_bInitialized = false;
+
+// стек открытых областей: значения счетчиков в момент начала
+static struct
+{
+    uint32_t scope;
+    uint64_t count;
+    uint64_t bytes;
+} s_stack[ALLOC_STACK_DEPTH];
+static uint16_t s_depth = 0;
+
+// разбор бюджета вида "количество[,байты]"
+static void ParseBudget(const char *var, uint64_t *count, uint64_t *bytes)
+{
+    const char *s = getenv(var);
+    if(s == nullptr || *s == 0)
+    {
+        return;
+    }
+
+    char *end;
+    *count = strtoull(s, &end, 10);
+    if(*end == ',')
+    {
+        *bytes = strtoull(end+1, nullptr, 10);
+    }
+}
+
+static void AllocTrackInit()
+{
+    uint64_t frameCount = ALLOC_UNLIMITED, frameBytes = ALLOC_UNLIMITED;
+    uint64_t handlerCount = ALLOC_UNLIMITED, handlerBytes = ALLOC_UNLIMITED;
+    ParseBudget("GUI_ALLOC_BUDGET_FRAME", &frameCount, &frameBytes);
+    ParseBudget("GUI_ALLOC_BUDGET_HANDLER", &handlerCount, &handlerBytes);
+
+    for(uint32_t i=0; i<ALLOC_SCOPES; i++)
+    {
+        s_budgetCount[i] = i == ALLOC_SCOPE_FRAME ? frameCount : handlerCount;
+        s_budgetBytes[i] = i == ALLOC_SCOPE_FRAME ? frameBytes : handlerBytes;
+    }
+    s_bInitialized = true;
+}
+
+void AllocTrackSetBudget(uint32_t scope, uint64_t count, uint64_t bytes)
+{
+    assert(scope < ALLOC_SCOPES);
+    if(!s_bInitialized)
+    {
+        AllocTrackInit();
+    }
+    s_budgetCount[scope] = count;
+    s_budgetBytes[scope] = bytes;
+}
+
+void AllocTrackBegin(uint32_t scope)
+{
+    if(!s_bInitialized)
+    {
+        AllocTrackInit();
+    }
+
+    assert(s_depth < ALLOC_STACK_DEPTH);
+    s_stack[s_depth].scope = scope;
+    s_stack[s_depth].count = tl_count;
+    s_stack[s_depth].bytes = tl_bytes;
+    ++s_depth;
+}
+
+void AllocTrackEnd(uint32_t scope)
+{
+    assert(s_depth > 0 && s_stack[s_depth-1].scope == scope);
+    --s_depth;
+
+    uint64_t count = tl_count - s_stack[s_depth].count;
+    uint64_t bytes = tl_bytes - s_stack[s_depth].bytes;
+
+    // неизвестные типы событий учитываем вместе с EVENT_UNKNOWN
+    uint32_t i = scope < ALLOC_SCOPES ? scope : EVENT_UNKNOWN;
+    ALLOCSTAT &st = s_stat[i];
+    ++st.calls;
+    st.count += count;
+    st.bytes += bytes;
+    st.maxCount = max(st.maxCount, count);
+    st.maxBytes = max(st.maxBytes, bytes);
+
+    if(count > s_budgetCount[i] || bytes > s_budgetBytes[i])
+    {
+        // iostream здесь не используем: он сам выделяет память
+        fprintf(stderr, "Превышен бюджет выделений памяти: %s %u: %llu выделений (%llu байт), бюджет %llu (%llu байт)\n",
+            i == ALLOC_SCOPE_FRAME ? "кадр" : "обработчик события", i,
+            (unsigned long long) count, (unsigned long long) bytes,
+            (unsigned long long) s_budgetCount[i], (unsigned long long) s_budgetBytes[i]);
+        assert(count <= s_budgetCount[i] && bytes <= s_budgetBytes[i]);
+    }
+}
+
+ALLOCSTAT AllocTrackGetStat(uint32_t scope)
+{
+    assert(scope < ALLOC_SCOPES);
+    return s_stat[scope];
+}
+
+void AllocTrackPrint()
+{
+    fprintf(stderr, "Выделения памяти:      вызовов  выделений        байт  макс.выд.  макс.байт\n");
+    for(uint32_t i=0; i<ALLOC_SCOPES; i++)
+    {
+        const ALLOCSTAT &st = s_stat[i];
+        if(st.calls == 0)
+        {
+            continue;
+        }
+
+        char name[32];
+        if(i == ALLOC_SCOPE_FRAME)
+        {
+            snprintf(name, sizeof(name), "кадр");
+        }
+        else
+        {
+            snprintf(name, sizeof(name), "событие %u", i);
+        }
+        fprintf(stderr, "  %-20s %9llu %10llu %11llu %10llu %10llu\n", name,
+            (unsigned long long) st.calls, (unsigned long long) st.count, (unsigned long long) st.bytes,
+            (unsigned long long) st.maxCount, (unsigned long long) st.maxBytes);
+    }
+}
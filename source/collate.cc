@@ -0,0 +1,302 @@
+// collate.cc
+
+#include <functional>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include "threadpool.h"
+#include "collate.h"
+
+#define COLLATE_BLOCK   4096    // имен в одном задании построения ключей
+
+// элемент сортировки: начало ключа хранится в самом элементе, поэтому большинство сравнений
+// не обращается к памяти ключей
+typedef struct _SORTITEM
+{
+    uint64_t      prefix;   // первые 8 байт ключа, старший байт - первый
+    const uint8_t *key;
+    uint32_t      length;
+    uint32_t      index;    // номер имени
+} SORTITEM;
+
+// строчная буква для заглавной, ё - как е; UTF-8, длина символа не меняется
+static inline void FoldCase(const uint8_t *s, uint8_t *d)
+{
+    uint8_t c0 = s[0], c1 = s[1];
+    if((c0 == 0xd0 && c1 == 0x81) || (c0 == 0xd1 && c1 == 0x91))
+    {
+        // Ё, ё: U+0401, U+0451 -> е U+0435
+        c0 = 0xd0;
+        c1 = 0xb5;
+    }
+    else if(c0 == 0xc3 && c1 >= 0x80 && c1 <= 0x9e && c1 != 0x97)
+    {
+        // Latin-1: U+00C0-U+00DE, кроме знака умножения
+        c1 += 0x20;
+    }
+    else if(c0 == 0xce && c1 >= 0x91 && c1 <= 0x9f)
+    {
+        // греческий: U+0391-U+039F
+        c1 += 0x20;
+    }
+    else if(c0 == 0xce && c1 >= 0xa0 && c1 <= 0xa9)
+    {
+        // греческий: U+03A0-U+03A9
+        c0 = 0xcf;
+        c1 -= 0x20;
+    }
+    else if(c0 == 0xd0 && c1 >= 0x80 && c1 <= 0x8f)
+    {
+        // кириллица: U+0400-U+040F (Ѐ-Џ, в том числе Ё)
+        c0 = 0xd1;
+        c1 += 0x10;
+    }
+    else if(c0 == 0xd0 && c1 >= 0x90 && c1 <= 0x9f)
+    {
+        // кириллица: U+0410-U+041F (А-П)
+        c1 += 0x20;
+    }
+    else if(c0 == 0xd0 && c1 >= 0xa0 && c1 <= 0xaf)
+    {
+        // кириллица: U+0420-U+042F (Р-Я)
+        c0 = 0xd1;
+        c1 -= 0x20;
+    }
+    d[0] = c0;
+    d[1] = c1;
+}
+
+uint32_t CollateKey(const char *name, uint32_t length, bool bDir, uint8_t *key)
+{
+    const uint8_t *s = (const uint8_t *) name;
+    uint32_t k = 0;
+    key[k++] = bDir ? 0 : 1;
+
+    for(uint32_t i=0; i<length; )
+    {
+        uint8_t c = s[i];
+        if(c >= '0' && c <= '9')
+        {
+            // число: ведущие нули не учитываются, более длинное число - большее
+            while(i < length && s[i] == '0')
+            {
+                ++i;
+            }
+            uint32_t first = i;
+            while(i < length && s[i] >= '0' && s[i] <= '9')
+            {
+                ++i;
+            }
+            uint32_t nDigits = i - first;
+            key[k++] = '0';
+            key[k++] = nDigits < 255 ? nDigits : 255;
+            memcpy(key+k, s+first, nDigits);
+            k += nDigits;
+        }
+        else if(c >= 'A' && c <= 'Z')
+        {
+            key[k++] = c + ('a' - 'A');
+            ++i;
+        }
+        else if(c >= 0xc3 && c <= 0xd1 && i+1 < length)
+        {
+            FoldCase(s+i, key+k);
+            k += 2;
+            i += 2;
+        }
+        else
+        {
+            key[k++] = c;
+            ++i;
+        }
+    }
+    return k;
+}
+
+void CollateFold(const char *name, uint32_t length, char *folded)
+{
+    const uint8_t *s = (const uint8_t *) name;
+    uint8_t *d = (uint8_t *) folded;
+    for(uint32_t i=0; i<length; )
+    {
+        uint8_t c = s[i];
+        if(c >= 'A' && c <= 'Z')
+        {
+            d[i++] = c + ('a' - 'A');
+        }
+        else if(c >= 0xc3 && c <= 0xd1 && i+1 < length)
+        {
+            FoldCase(s+i, d+i);
+            i += 2;
+        }
+        else
+        {
+            d[i++] = c;
+        }
+    }
+}
+
+int CollateCompare(const char *name1, bool bDir1, const char *name2, bool bDir2)
+{
+    uint32_t length1 = strlen(name1), length2 = strlen(name2);
+    uint8_t *key1 = (uint8_t *) malloc(COLLATE_KEY_SIZE(length1) + COLLATE_KEY_SIZE(length2));
+    uint8_t *key2 = key1 + COLLATE_KEY_SIZE(length1);
+    uint32_t k1 = CollateKey(name1, length1, bDir1, key1);
+    uint32_t k2 = CollateKey(name2, length2, bDir2, key2);
+
+    int res = memcmp(key1, key2, std::min(k1, k2));
+    if(res == 0)
+    {
+        res = k1 != k2 ? (k1 < k2 ? -1 : 1) : strcmp(name1, name2);
+    }
+    free(key1);
+    return res;
+}
+
+static inline bool Less(const SORTITEM &a, const SORTITEM &b, const char *const *names)
+{
+    if(a.prefix != b.prefix)
+    {
+        return a.prefix < b.prefix;
+    }
+
+    // первые 8 байт совпадают
+    uint32_t m = std::min(a.length, b.length);
+    if(m > 8)
+    {
+        int res = memcmp(a.key+8, b.key+8, m-8);
+        if(res)
+        {
+            return res < 0;
+        }
+    }
+    if(a.length != b.length)
+    {
+        return a.length < b.length;
+    }
+    return strcmp(names[a.index], names[b.index]) < 0;
+}
+
+void CollateOrder(const char *const *names, const bool *bDirs, uint32_t n, uint32_t *order)
+{
+    if(n == 0)
+    {
+        return;
+    }
+
+    // место ключей
+    size_t *offsets = (size_t *) malloc((n+1)*sizeof(size_t));
+    uint32_t *lengths = (uint32_t *) malloc(n*sizeof(uint32_t));
+    SORTITEM *items = (SORTITEM *) malloc(n*sizeof(SORTITEM));
+    if(!offsets || !lengths || !items)
+    {
+        free(offsets);
+        free(lengths);
+        free(items);
+        for(uint32_t i=0; i<n; i++)
+        {
+            order[i] = i;
+        }
+        return;
+    }
+    offsets[0] = 0;
+    for(uint32_t i=0; i<n; i++)
+    {
+        lengths[i] = strlen(names[i]);
+        offsets[i+1] = offsets[i] + COLLATE_KEY_SIZE(lengths[i]);
+    }
+    uint8_t *keys = (uint8_t *) malloc(offsets[n]);
+
+    // ключи
+    auto build = [names, bDirs, keys, offsets, lengths, items, n](uint32_t block)
+    {
+        uint32_t end = std::min((block+1)*COLLATE_BLOCK, n);
+        for(uint32_t i=block*COLLATE_BLOCK; i<end; i++)
+        {
+            uint8_t *key = keys + offsets[i];
+            uint32_t length = CollateKey(names[i], lengths[i], bDirs && bDirs[i], key);
+            uint64_t prefix = 0;
+            for(uint32_t j=0; j<8; j++)
+            {
+                prefix = prefix << 8 | (j < length ? key[j] : 0);
+            }
+            items[i].prefix = prefix;
+            items[i].key = key;
+            items[i].length = length;
+            items[i].index = i;
+        }
+    };
+    auto less = [names](const SORTITEM &a, const SORTITEM &b) { return Less(a, b, names); };
+
+    uint16_t nThreads = ThreadPool::Get()->GetThreadCount();
+    if(!keys)
+    {
+        // без ключей: порядок, как в массиве
+        for(uint32_t i=0; i<n; i++)
+        {
+            order[i] = i;
+        }
+    }
+    else if(n < COLLATE_PARALLEL_MIN || nThreads < 2)
+    {
+        for(uint32_t b=0; b*COLLATE_BLOCK<n; b++)
+        {
+            build(b);
+        }
+        std::sort(items, items+n, less);
+        for(uint32_t i=0; i<n; i++)
+        {
+            order[i] = items[i].index;
+        }
+    }
+    else
+    {
+        ThreadPool::Get()->ParallelFor((n + COLLATE_BLOCK-1)/COLLATE_BLOCK, build);
+
+        // части по числу потоков (степень двойки) сортируются одновременно
+        uint32_t nParts = 1;
+        while(nParts*2 <= nThreads)
+        {
+            nParts *= 2;
+        }
+        uint32_t *bounds = (uint32_t *) malloc((nParts+1)*sizeof(uint32_t));
+        for(uint32_t p=0; p<=nParts; p++)
+        {
+            bounds[p] = (uint64_t) n*p/nParts;
+        }
+        ThreadPool::Get()->ParallelFor(nParts, [items, bounds, less](uint32_t p)
+        {
+            std::sort(items+bounds[p], items+bounds[p+1], less);
+        });
+
+        // попарное слияние соседних частей, пока не останется одна
+        SORTITEM *tmp = (SORTITEM *) malloc(n*sizeof(SORTITEM));
+        SORTITEM *src = items, *dst = tmp;
+        if(!tmp)
+        {
+            std::sort(items, items+n, less);
+            nParts = 1;
+        }
+        for(uint32_t width=1; width<nParts; width*=2)
+        {
+            ThreadPool::Get()->ParallelFor(nParts/(2*width), [src, dst, bounds, width, less](uint32_t m)
+            {
+                uint32_t first = bounds[2*m*width], mid = bounds[(2*m+1)*width], last = bounds[(2*m+2)*width];
+                std::merge(src+first, src+mid, src+mid, src+last, dst+first, less);
+            });
+            std::swap(src, dst);
+        }
+        for(uint32_t i=0; i<n; i++)
+        {
+            order[i] = src[i].index;
+        }
+        free(tmp);
+        free(bounds);
+    }
+
+    free(keys);
+    free(items);
+    free(lengths);
+    free(offsets);
+}
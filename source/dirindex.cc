@@ -0,0 +1,527 @@
+// dirindex.cc
+
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "dirscan.h"
+#include "dirindex.h"
+#include "collate.h"
+#include "fileprobe.h"
+#include "pngread.h"
+#include "threadpool.h"
+
+#define NO_ENTRY    UINT32_MAX      // элемента нет в прежнем индексе
+
+// заголовок файла индекса; за ним - путь корня, элементы (с границы 8 байт) и область имен
+typedef struct _INDEXHEADER
+{
+    char     magic[DIRINDEX_MAGIC_SIZE];
+    uint32_t n;             // количество элементов
+    uint32_t rootLength;    // длина пути корня
+    uint64_t entries;       // смещение элементов
+    uint64_t names;         // смещение области имен
+    uint64_t namesSize;
+    int64_t  built;         // время построения, с
+} INDEXHEADER;
+
+// каталог, читаемый на очередном уровне обхода
+typedef struct _INDEXDIR
+{
+    uint32_t    entry;      // номер элемента каталога в новом индексе
+    uint32_t    previous;   // номер элемента каталога в прежнем индексе; NO_ENTRY - нет
+    int64_t     mtime;      // время изменения каталога
+    std::string path;
+} INDEXDIR;
+
+// прочитанное содержимое каталога
+typedef struct _DIRCONTENT
+{
+    std::vector<INDEXENTRY> entries;    // name - смещение в names
+    std::vector<uint32_t>   previous;   // номера элементов в прежнем индексе; NO_ENTRY - нет
+    std::vector<uint8_t>    bDescend;   // каталог обходится (не символическая ссылка и не "..")
+    std::string             names;
+    bool                    bListed;    // каталог прочитан
+} DIRCONTENT;
+
+static uint64_t HashPath(const char *path)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;     // FNV-1a
+    for(; *path; path++)
+    {
+        h = (h ^ (uint8_t) *path) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+// имя файла индекса для корня root (полный путь); каталоги кэша создаются
+static bool GetIndexName(const char *root, char *name)
+{
+    char dir[PATH_MAX];
+    const char *env = getenv("XDG_CACHE_HOME");
+    if(env && *env)
+    {
+        snprintf(dir, sizeof(dir), "%s", env);
+    }
+    else if((env = getenv("HOME")) != nullptr)
+    {
+        snprintf(dir, sizeof(dir), "%s/.cache", env);
+    }
+    else
+    {
+        return false;
+    }
+    mkdir(dir, 0755);
+    strncat(dir, "/gui3", sizeof(dir)-strlen(dir)-1);
+    mkdir(dir, 0755);
+    strncat(dir, "/index", sizeof(dir)-strlen(dir)-1);
+    mkdir(dir, 0755);
+    return snprintf(name, PATH_MAX, "%s/%016llx.idx", dir, (unsigned long long) HashPath(root)) < PATH_MAX;
+}
+
+static int64_t GetMtime(const struct stat &st)
+{
+    return (int64_t) st.st_mtim.tv_sec*1000000000 + st.st_mtim.tv_nsec;
+}
+
+static std::string JoinPath(const std::string &dir, const char *name)
+{
+    return dir == "/" ? dir + name : dir + "/" + name;
+}
+
+// проверка отображенного индекса: ссылки не выходят за его пределы, элементы каталога
+// лежат после самого каталога (поэтому поиск по пути конечен)
+static bool Validate(const uint8_t *map, size_t size, const char *root)
+{
+    const INDEXHEADER *h = (const INDEXHEADER *) map;
+    size_t rootLength = strlen(root);
+    if(size < sizeof(INDEXHEADER) + rootLength + 1 || memcmp(h->magic, DIRINDEX_MAGIC, DIRINDEX_MAGIC_SIZE)
+        || h->n == 0 || h->rootLength != rootLength || memcmp(map + sizeof(INDEXHEADER), root, rootLength + 1)
+        || h->entries % 8 || h->entries > size || (size - h->entries)/sizeof(INDEXENTRY) < h->n
+        || h->names > size || h->namesSize == 0 || h->namesSize > size - h->names
+        || map[h->names + h->namesSize - 1] != 0)
+    {
+        return false;
+    }
+
+    const INDEXENTRY *entries = (const INDEXENTRY *)(map + h->entries);
+    for(uint32_t i=0; i<h->n; i++)
+    {
+        const INDEXENTRY &e = entries[i];
+        if((uint64_t) e.name + e.length >= h->namesSize
+            || (e.first != DIRINDEX_UNLISTED && (e.first <= i || (uint64_t) e.first + e.n > h->n)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+DIRINDEX DirIndexOpen(const char *root)
+{
+    char path[PATH_MAX], name[PATH_MAX];
+    if(!realpath(root, path) || !GetIndexName(path, name))
+    {
+        return nullptr;
+    }
+    int fd = open(name, O_RDONLY|O_CLOEXEC);
+    if(fd < 0)
+    {
+        return nullptr;
+    }
+
+    // файл индекса заменяется целиком (rename), поэтому отображение не меняется под руками
+    struct stat st;
+    void *map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(INDEXHEADER))
+    {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        return nullptr;
+    }
+    if(!Validate((const uint8_t *) map, st.st_size, path))
+    {
+        munmap(map, st.st_size);
+        return nullptr;
+    }
+
+    const INDEXHEADER *h = (const INDEXHEADER *) map;
+    DIRINDEX index = (DIRINDEX) malloc(sizeof(struct _DIRINDEX));
+    index->entries = (const INDEXENTRY *)((const char *) map + h->entries);
+    index->n = h->n;
+    index->names = (const char *) map + h->names;
+    index->root = (const char *) map + sizeof(INDEXHEADER);
+    index->built = h->built;
+    index->map = map;
+    index->mapSize = st.st_size;
+    return index;
+}
+
+void DirIndexClose(DIRINDEX index)
+{
+    if(index)
+    {
+        munmap(index->map, index->mapSize);
+        free(index);
+    }
+}
+
+bool DirIndexLookup(DIRINDEX index, const char *path, uint32_t *entry)
+{
+    size_t rootLength = strlen(index->root);
+    if(strncmp(path, index->root, rootLength)
+        || (path[rootLength] && path[rootLength] != '/' && index->root[rootLength-1] != '/'))
+    {
+        return false;
+    }
+
+    // по элементам пути от корня; элементы каталога упорядочены, как при показе
+    uint32_t i = 0;
+    const char *p = path + rootLength;
+    while(true)
+    {
+        const INDEXENTRY &d = index->entries[i];
+        if(d.type != DIRSCAN_DIR || d.first == DIRINDEX_UNLISTED)
+        {
+            return false;
+        }
+        while(*p == '/')
+        {
+            ++p;
+        }
+        if(!*p)
+        {
+            break;
+        }
+
+        const char *end = strchrnul(p, '/');
+        char name[NAME_MAX+1];
+        if(end - p > NAME_MAX)
+        {
+            return false;
+        }
+        memcpy(name, p, end - p);
+        name[end - p] = 0;
+        p = end;
+
+        uint32_t lo = d.first, hi = d.first + d.n;
+        while(lo < hi)
+        {
+            uint32_t mid = lo + (hi - lo)/2;
+            const INDEXENTRY &e = index->entries[mid];
+            if(CollateCompare(name, true, index->names + e.name, e.type == DIRSCAN_DIR) > 0)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+        if(lo == d.first + d.n || strcmp(index->names + index->entries[lo].name, name))
+        {
+            return false;
+        }
+        i = lo;
+    }
+    *entry = i;
+    return true;
+}
+
+// чтение каталога: если каталог не изменился, элементы берутся из прежнего индекса и на диске
+// проверяются только вложенные каталоги (а с bFiles - и размер и время изменения файлов),
+// иначе каталог читается с диска
+static void ReadContent(const INDEXDIR &dir, DIRINDEX previous, bool bFiles, DIRCONTENT *pContent)
+{
+    pContent->bListed = false;
+    int dirfd = open(dir.path.c_str(), O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(dirfd < 0)
+    {
+        return;
+    }
+
+    const INDEXENTRY *pPrevious = nullptr;
+    if(previous && dir.previous != NO_ENTRY)
+    {
+        pPrevious = &previous->entries[dir.previous];
+        if(pPrevious->type != DIRSCAN_DIR || pPrevious->first == DIRINDEX_UNLISTED)
+        {
+            pPrevious = nullptr;
+        }
+    }
+
+    std::vector<const char *> names;
+    std::vector<uint8_t> types;
+    std::vector<uint32_t> &prev = pContent->previous;
+    DIRSCAN ds = nullptr;
+    bool bUnchanged = pPrevious && pPrevious->mtime == dir.mtime;
+    if(bUnchanged)
+    {
+        for(uint32_t k=0; k<pPrevious->n; k++)
+        {
+            const INDEXENTRY &p = previous->entries[pPrevious->first + k];
+            names.push_back(previous->names + p.name);
+            types.push_back(p.type);
+            prev.push_back(pPrevious->first + k);
+        }
+    }
+    else
+    {
+        ds = DirScan(dir.path.c_str(), DIRSCAN_SKIP_DOT);
+        if(!ds)
+        {
+            close(dirfd);
+            return;
+        }
+        DirScanSort(ds);
+
+        // оба списка в порядке показа - прежние элементы находятся одним проходом
+        uint32_t j = 0, nPrevious = pPrevious ? pPrevious->n : 0;
+        for(uint32_t k=0; k<ds->n; k++)
+        {
+            const DIRENTRY &e = ds->entries[k];
+            bool bDir = e.type == DIRSCAN_DIR;
+            names.push_back(e.name);
+            types.push_back(e.type);
+            prev.push_back(NO_ENTRY);
+            while(j < nPrevious)
+            {
+                const INDEXENTRY &p = previous->entries[pPrevious->first + j];
+                int res = CollateCompare(previous->names + p.name, p.type == DIRSCAN_DIR, e.name, bDir);
+                if(res > 0)
+                {
+                    break;
+                }
+                ++j;
+                if(res == 0)
+                {
+                    prev[k] = pPrevious->first + j - 1;
+                    break;
+                }
+            }
+        }
+    }
+
+    uint32_t n = names.size();
+    pContent->entries.resize(n);
+    pContent->bDescend.resize(n);
+    std::vector<uint32_t> probe;     // файлы, тип содержимого которых определяется заново
+    for(uint32_t k=0; k<n; k++)
+    {
+        INDEXENTRY &e = pContent->entries[k];
+        memset(&e, 0, sizeof(e));
+        e.length = strlen(names[k]);
+        e.name = pContent->names.size();
+        pContent->names.append(names[k], e.length + 1);
+        e.type = types[k];
+        e.first = DIRINDEX_UNLISTED;
+
+        // элемент неизменившегося каталога - как в прежнем индексе; каталоги проверяются всегда:
+        // по их времени изменения решается, перечитывать ли их
+        if(bUnchanged && !bFiles && e.type != DIRSCAN_DIR)
+        {
+            const INDEXENTRY &p = previous->entries[prev[k]];
+            e.size = p.size;
+            e.mtime = p.mtime;
+            e.format = p.format;
+            e.width = p.width;
+            e.height = p.height;
+            continue;
+        }
+
+        // символическая ссылка описывается тем, на что она указывает, но не обходится
+        struct stat st;
+        if(fstatat(dirfd, names[k], &st, AT_SYMLINK_NOFOLLOW) == 0)
+        {
+            pContent->bDescend[k] = S_ISDIR(st.st_mode) && strcmp(names[k], "..");
+            if(S_ISLNK(st.st_mode))
+            {
+                fstatat(dirfd, names[k], &st, 0);
+            }
+            e.size = st.st_size;
+            e.mtime = GetMtime(st);
+        }
+
+        if(e.type != DIRSCAN_FILE)
+        {
+            continue;
+        }
+        if(prev[k] != NO_ENTRY)
+        {
+            const INDEXENTRY &p = previous->entries[prev[k]];
+            if(p.type == DIRSCAN_FILE && p.size == e.size && p.mtime == e.mtime)
+            {
+                e.format = p.format;
+                e.width = p.width;
+                e.height = p.height;
+                continue;
+            }
+        }
+        probe.push_back(k);
+    }
+
+    if(!probe.empty())
+    {
+        // имена в pContent->names больше не перемещаются
+        std::vector<const char *> probeNames(probe.size());
+        std::vector<uint8_t> formats(probe.size());
+        for(size_t i=0; i<probe.size(); i++)
+        {
+            probeNames[i] = pContent->names.data() + pContent->entries[probe[i]].name;
+        }
+        FileProbe(dirfd, probeNames.data(), probe.size(), formats.data());
+        for(size_t i=0; i<probe.size(); i++)
+        {
+            INDEXENTRY &e = pContent->entries[probe[i]];
+            e.format = formats[i];
+            if(e.format == FILETYPE_PNG)
+            {
+                PNGGetSize(JoinPath(dir.path, probeNames[i]).c_str(), &e.width, &e.height);
+            }
+        }
+    }
+
+    DirScanFree(ds);
+    close(dirfd);
+    pContent->bListed = true;
+}
+
+static bool WriteAll(int fd, const void *data, size_t size, off_t offset)
+{
+    const char *p = (const char *) data;
+    while(size)
+    {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if(n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+bool DirIndexBuild(const char *root, DIRINDEX previous, bool bFiles)
+{
+    char path[PATH_MAX], name[PATH_MAX];
+    struct stat st;
+    if(!realpath(root, path) || !GetIndexName(path, name) || stat(path, &st) != 0 || !S_ISDIR(st.st_mode))
+    {
+        return false;
+    }
+    if(previous && strcmp(previous->root, path))
+    {
+        previous = nullptr;
+    }
+
+    // корень - элемент 0 с пустым именем
+    std::vector<INDEXENTRY> entries(1);
+    std::string names(1, '\0');
+    memset(&entries[0], 0, sizeof(INDEXENTRY));
+    entries[0].size = st.st_size;
+    entries[0].mtime = GetMtime(st);
+    entries[0].type = DIRSCAN_DIR;
+    entries[0].first = DIRINDEX_UNLISTED;
+
+    // обход по уровням: каталоги уровня читаются параллельно, их элементы дописываются по порядку,
+    // так что элементы каждого каталога лежат подряд
+    std::vector<INDEXDIR> level(1);
+    level[0].entry = 0;
+    level[0].previous = previous ? 0 : NO_ENTRY;
+    level[0].mtime = entries[0].mtime;
+    level[0].path = path;
+    while(!level.empty())
+    {
+        // порциями: между ними пул успевает выполнять другие задания
+        std::vector<DIRCONTENT> contents(level.size());
+        for(size_t first=0; first<level.size(); first+=DIRINDEX_BATCH)
+        {
+            uint32_t n = std::min(level.size() - first, (size_t) DIRINDEX_BATCH);
+            ThreadPool::Get()->ParallelFor(n, [&level, &contents, previous, bFiles, first](uint32_t i)
+            {
+                ReadContent(level[first + i], previous, bFiles, &contents[first + i]);
+            });
+        }
+
+        std::vector<INDEXDIR> next;
+        for(size_t i=0; i<level.size(); i++)
+        {
+            const DIRCONTENT &c = contents[i];
+            if(!c.bListed)
+            {
+                continue;
+            }
+            if(entries.size() + c.entries.size() >= DIRINDEX_UNLISTED || names.size() + c.names.size() > UINT32_MAX)
+            {
+                fprintf(stderr, "Дерево каталогов %s слишком велико для индекса\n", path);
+                return false;
+            }
+
+            uint32_t first = entries.size();
+            uint32_t base = names.size();
+            entries[level[i].entry].first = first;
+            entries[level[i].entry].n = c.entries.size();
+            for(size_t k=0; k<c.entries.size(); k++)
+            {
+                INDEXENTRY e = c.entries[k];
+                e.name += base;
+                entries.push_back(e);
+                if(c.bDescend[k])
+                {
+                    INDEXDIR d;
+                    d.entry = first + k;
+                    d.previous = c.previous[k];
+                    d.mtime = e.mtime;
+                    d.path = JoinPath(level[i].path, c.names.data() + c.entries[k].name);
+                    next.push_back(std::move(d));
+                }
+            }
+            names += c.names;
+        }
+        level.swap(next);
+    }
+
+    // запись во временный файл и замена прежнего индекса: открытые отображения остаются действительными
+    INDEXHEADER h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DIRINDEX_MAGIC, DIRINDEX_MAGIC_SIZE);
+    h.n = entries.size();
+    h.rootLength = strlen(path);
+    h.entries = (sizeof(h) + h.rootLength + 1 + 7) & ~7ULL;
+    h.names = h.entries + entries.size()*sizeof(INDEXENTRY);
+    h.namesSize = names.size();
+    h.built = time(nullptr);
+
+    char tmp[PATH_MAX+16];
+    snprintf(tmp, sizeof(tmp), "%s.%d", name, (int) getpid());
+    int fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if(fd < 0)
+    {
+        return false;
+    }
+    bool bOk = WriteAll(fd, &h, sizeof(h), 0)
+        && WriteAll(fd, path, h.rootLength + 1, sizeof(h))
+        && WriteAll(fd, entries.data(), entries.size()*sizeof(INDEXENTRY), h.entries)
+        && WriteAll(fd, names.data(), names.size(), h.names);
+    bOk = close(fd) == 0 && bOk && rename(tmp, name) == 0;
+    if(!bOk)
+    {
+        unlink(tmp);
+    }
+    return bOk;
+}
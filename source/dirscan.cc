@@ -0,0 +1,250 @@
+// dirscan.cc
+
+#include <cstdio>
+#include <utility>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syscall.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "dirscan.h"
+#include "fileprobe.h"
+#include "collate.h"
+
+// запись, возвращаемая getdents64
+struct linux_dirent64
+{
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+// тип по stat; вызывается, если d_type не известен или элемент - символическая ссылка
+static uint8_t StatType(int dirfd, const char *name)
+{
+    struct stat st;
+    if(fstatat(dirfd, name, &st, 0) != 0)
+    {
+        return DIRSCAN_OTHER;
+    }
+    return S_ISDIR(st.st_mode) ? DIRSCAN_DIR : S_ISREG(st.st_mode) ? DIRSCAN_FILE : DIRSCAN_OTHER;
+}
+
+// тип содержимого обычных файлов - одним вызовом FileProbe на весь каталог
+static void ProbeFiles(int dirfd, DIRENTRY *entries, uint32_t nEntries)
+{
+    uint32_t nFiles = 0;
+    for(uint32_t i=0; i<nEntries; i++)
+    {
+        nFiles += entries[i].type == DIRSCAN_FILE;
+    }
+    if(!nFiles)
+    {
+        return;
+    }
+
+    const char **names = (const char **) malloc(nFiles*sizeof(const char *));
+    uint32_t *index = (uint32_t *) malloc(nFiles*sizeof(uint32_t));
+    uint8_t *types = (uint8_t *) malloc(nFiles);
+    if(names && index && types)
+    {
+        uint32_t k = 0;
+        for(uint32_t i=0; i<nEntries; i++)
+        {
+            if(entries[i].type == DIRSCAN_FILE)
+            {
+                names[k] = entries[i].name;
+                index[k++] = i;
+            }
+        }
+        FileProbe(dirfd, names, nFiles, types);
+        for(uint32_t j=0; j<nFiles; j++)
+        {
+            entries[index[j]].format = types[j];
+        }
+    }
+    free(names);
+    free(index);
+    free(types);
+}
+
+DIRSCAN DirScan(const char *path, uint8_t flags)
+{
+    int dirfd = open(path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+    if(dirfd < 0)
+    {
+        return nullptr;
+    }
+
+    char *buf = (char *) malloc(DIRSCAN_BATCH);
+    uint32_t nEntries = 0, maxEntries = 256;
+    size_t nNames = 0, maxNames = 16*1024;
+    DIRENTRY *entries = (DIRENTRY *) malloc(maxEntries*sizeof(DIRENTRY));
+    char *names = (char *) malloc(maxNames);
+    size_t *offsets = (size_t *) malloc(maxEntries*sizeof(size_t));    // пока область растет, имена - смещения
+    bool bOk = buf && entries && names && offsets;
+
+    while(bOk)
+    {
+        long nRead = syscall(SYS_getdents64, dirfd, buf, DIRSCAN_BATCH);
+        if(nRead <= 0)
+        {
+            bOk = nRead == 0;
+            break;
+        }
+
+        for(long pos=0; pos<nRead; )
+        {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+
+            const char *name = d->d_name;
+            if((flags & DIRSCAN_SKIP_DOT) && !strcmp(name, "."))
+            {
+                continue;
+            }
+
+            uint8_t type;
+            switch(d->d_type)
+            {
+            case DT_DIR:
+                type = DIRSCAN_DIR;
+                break;
+            case DT_REG:
+                type = DIRSCAN_FILE;
+                break;
+            case DT_LNK:
+            case DT_UNKNOWN:
+                type = StatType(dirfd, name);
+                break;
+            default:
+                type = DIRSCAN_OTHER;
+            }
+            size_t length = strlen(name);
+            // при неудаче realloc прежние области остаются и освобождаются ниже
+            if(nEntries == maxEntries)
+            {
+                DIRENTRY *newEntries = (DIRENTRY *) realloc(entries, 2*maxEntries*sizeof(DIRENTRY));
+                if(newEntries)
+                {
+                    entries = newEntries;
+                }
+                size_t *newOffsets = newEntries ? (size_t *) realloc(offsets, 2*maxEntries*sizeof(size_t)) : nullptr;
+                if(newOffsets)
+                {
+                    offsets = newOffsets;
+                }
+                if(!newEntries || !newOffsets)
+                {
+                    bOk = false;
+                    break;
+                }
+                maxEntries *= 2;
+            }
+            if(nNames+length+1 > maxNames)
+            {
+                size_t size = maxNames;
+                while(nNames+length+1 > size)
+                {
+                    size *= 2;
+                }
+                char *newNames = (char *) realloc(names, size);
+                if(!newNames)
+                {
+                    bOk = false;
+                    break;
+                }
+                names = newNames;
+                maxNames = size;
+            }
+
+            memcpy(names+nNames, name, length+1);
+            offsets[nEntries] = nNames;
+            entries[nEntries].length = length;
+            entries[nEntries].type = type;
+            entries[nEntries].format = FILETYPE_UNKNOWN;
+            ++nEntries;
+            nNames += length+1;
+        }
+    }
+    free(buf);
+
+    if(!bOk)
+    {
+        close(dirfd);
+        free(entries);
+        free(names);
+        free(offsets);
+        return nullptr;
+    }
+
+    for(uint32_t i=0; i<nEntries; i++)
+    {
+        entries[i].name = names + offsets[i];
+    }
+    free(offsets);
+
+    if(flags & DIRSCAN_PROBE)
+    {
+        ProbeFiles(dirfd, entries, nEntries);
+    }
+    close(dirfd);
+
+    DIRSCAN ds = (DIRSCAN) malloc(sizeof(struct _DIRSCAN));
+    if(!ds)
+    {
+        free(entries);
+        free(names);
+        return nullptr;
+    }
+    ds->entries = entries;
+    ds->n = nEntries;
+    ds->names = names;
+    return ds;
+}
+
+void DirScanSort(DIRSCAN ds)
+{
+    if(!ds || ds->n < 2)
+    {
+        return;
+    }
+
+    const char **names = (const char **) malloc(ds->n*sizeof(const char *));
+    bool *bDirs = (bool *) malloc(ds->n*sizeof(bool));
+    uint32_t *order = (uint32_t *) malloc(ds->n*sizeof(uint32_t));
+    DIRENTRY *entries = (DIRENTRY *) malloc(ds->n*sizeof(DIRENTRY));
+    if(names && bDirs && order && entries)
+    {
+        for(uint32_t i=0; i<ds->n; i++)
+        {
+            names[i] = ds->entries[i].name;
+            bDirs[i] = ds->entries[i].type == DIRSCAN_DIR;
+        }
+        CollateOrder(names, bDirs, ds->n, order);
+        for(uint32_t i=0; i<ds->n; i++)
+        {
+            entries[i] = ds->entries[order[i]];
+        }
+        std::swap(entries, ds->entries);
+    }
+    free(names);
+    free(bDirs);
+    free(order);
+    free(entries);
+}
+
+void DirScanFree(DIRSCAN ds)
+{
+    if(ds)
+    {
+        free(ds->entries);
+        free(ds->names);
+        free(ds);
+    }
+}
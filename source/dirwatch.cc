@@ -0,0 +1,160 @@
+// dirwatch.cc
+
+#include <functional>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "mainloop.h"
+#include "dirwatch.h"
+
+#define DIRWATCH_MASK   (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_CLOSE_WRITE|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR|IN_EXCL_UNLINK)
+
+DirWatch::DirWatch()
+{
+    m_fd = -1;
+    m_wd = -1;
+    m_source = 0;
+    m_buf = nullptr;
+    m_changes = nullptr;
+}
+
+DirWatch::~DirWatch()
+{
+    Stop();
+    free(m_buf);
+    free(m_changes);
+}
+
+bool DirWatch::Start(const char *path, DIRWATCHFN fn)
+{
+    Stop();
+
+    if(!m_buf || !m_changes)
+    {
+        // буферы выделяются вместе: при нехватке памяти не остается ни одного
+        free(m_buf);
+        free(m_changes);
+        m_buf = (char *) malloc(DIRWATCH_BUFFER);
+        m_changes = (DIRCHANGE *) malloc(DIRWATCH_BUFFER/sizeof(struct inotify_event)*sizeof(DIRCHANGE));
+        if(!m_buf || !m_changes)
+        {
+            free(m_buf);
+            free(m_changes);
+            m_buf = nullptr;
+            m_changes = nullptr;
+            return false;
+        }
+    }
+
+    // у каждого наблюдения свой дескриптор: события прежнего каталога, еще не прочитанные, пропадают вместе с ним
+    m_fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+    if(m_fd < 0)
+    {
+        return false;
+    }
+    m_wd = inotify_add_watch(m_fd, path, DIRWATCH_MASK);
+    if(m_wd < 0)
+    {
+        Stop();
+        return false;
+    }
+
+    m_fn = std::move(fn);
+    m_source = WatchFd(m_fd, [this]() { OnReadable(); });
+    return true;
+}
+
+void DirWatch::Stop()
+{
+    UnwatchFd(m_source);
+    m_source = 0;
+    if(m_fd >= 0)
+    {
+        close(m_fd);
+    }
+    m_fd = -1;
+    m_wd = -1;
+    m_fn = nullptr;
+}
+
+void DirWatch::OnReadable()
+{
+    // одно чтение за вызов: имена указывают в буфер; если события остались, главный цикл вызовет снова
+    ssize_t nRead = read(m_fd, m_buf, DIRWATCH_BUFFER);
+    if(nRead <= 0)
+    {
+        return;
+    }
+
+    uint32_t n = 0;
+    bool bRescan = false;
+    uint32_t cookie = 0;        // cookie последнего IN_MOVED_FROM, если это последнее событие
+    for(ssize_t pos=0; pos<nRead; )
+    {
+        const struct inotify_event *e = (const struct inotify_event *)(m_buf + pos);
+        pos += sizeof(struct inotify_event) + e->len;
+
+        if(e->mask & (IN_Q_OVERFLOW|IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF))
+        {
+            bRescan = true;
+            continue;
+        }
+        if(!e->len)
+        {
+            continue;
+        }
+
+        DIRCHANGE &c = m_changes[n];
+        c.bDir = e->mask & IN_ISDIR;
+        c.name = e->name;
+        c.newName = nullptr;
+
+        if((e->mask & IN_MOVED_TO) && cookie && cookie == e->cookie)
+        {
+            // вторая половина перемещения внутри каталога
+            m_changes[n-1].event = DIRWATCH_RENAMED;
+            m_changes[n-1].newName = e->name;
+            cookie = 0;
+            continue;
+        }
+        cookie = 0;
+
+        if(e->mask & (IN_CREATE|IN_MOVED_TO))
+        {
+            c.event = DIRWATCH_ADDED;
+        }
+        else if(e->mask & (IN_DELETE|IN_MOVED_FROM))
+        {
+            c.event = DIRWATCH_REMOVED;
+            cookie = e->mask & IN_MOVED_FROM ? e->cookie : 0;
+        }
+        else if(e->mask & IN_CLOSE_WRITE)
+        {
+            c.event = DIRWATCH_WRITTEN;
+        }
+        else
+        {
+            continue;
+        }
+        ++n;
+    }
+
+    // после переполнения отдельные изменения не нужны
+    if(bRescan)
+    {
+        m_changes[0].event = DIRWATCH_RESCAN;
+        m_changes[0].bDir = true;
+        m_changes[0].name = nullptr;
+        m_changes[0].newName = nullptr;
+        n = 1;
+    }
+
+    if(n && m_fn)
+    {
+        // обработчик может остановить наблюдение или начать новое - вызываем копию
+        DIRWATCHFN fn = m_fn;
+        fn(m_changes, n);
+    }
+}
@@ -4,6 +4,7 @@
 #include <iostream>
 #include "window.h"
 #include "edit.h"
+#include "utf8.h"
 
 Edit::Edit(const char *text)
 {
@@ -92,14 +93,14 @@ void Edit::SetFont(const char *FontFace, const int16_t FontSize, const int16_t b
 
 bool Edit::SetText(const char *text)
 {
-    if(!CheckUTF8(text))
+    uint32_t s = strlen(text);
+    if(!UTF8Validate(text, s))
     {
         return false;
     }
-    uint32_t s = strlen(text);
     ExpandText(s);
-    strcpy(m_text, text);
-    strcpy(m_shadow, text);
+    memcpy(m_text, text, s+1);
+    memcpy(m_shadow, text, s+1);
     m_textSize = s;
     m_pointerPosition = GetTextLength();
     return true;
@@ -173,7 +174,9 @@ void Edit::DrawPointer(Context *cr, const Point &ws)
             }
 
             old_b = b;
-            CopyUnicodeSymbol(b);
+            uint8_t l = UTF8SymbolSize(m_text[b]);
+            memcpy(m_shadow+b, m_text+b, l);
+            b += l;
             ++s;
             oldpos = newpos;
         }
@@ -220,6 +223,10 @@ bool Edit::OnKeyPress(uint64_t value)
         {
             CaptureKeyboard(GetParent());
         }
+        else if(value == KEY_Return)
+        {
+            NotifyParent(EVENT_EDIT_RETURN, Point(0,0));
+        }
     }
     else if(value < 1<<7)                   // ASCII
     {
@@ -327,30 +334,15 @@ bool Edit::OnTimeout()
 
 uint32_t Edit::GetTextLength()
 {
-    uint32_t len = 0, i;
-
-    for(i=0; i<m_textSize; i++)
-    {
-        if((m_text[i]&0xc0) != 0x80)
-        {
-            // начало символа Unicode
-            ++len;
-        }
-    }
-
-    return len;
+    return UTF8Count(m_text, m_textSize);
 }
 
 // установка указателя при помощи стрелок, Home, End
 void Edit::SetPointer(uint32_t newPosition)
 {
-    uint32_t b = 0;
-    for(uint32_t s=0; s<newPosition; s++)
-    {
-        assert(m_text[b]);
-        CopyUnicodeSymbol(b);
-    }
-
+    // теневая копия - текст до указателя
+    uint32_t b = UTF8Offset(m_text, m_textSize, newPosition);
+    memcpy(m_shadow, m_text, b);
     m_shadow[b] = 0;
 
     m_pointerPosition = newPosition;
@@ -407,6 +399,7 @@ void Edit::Insert(uint64_t value, uint8_t s)
     m_textSize += s;
     SetPointer(m_pointerPosition+1);
     ReDraw();
+    NotifyParent(EVENT_EDIT_CHANGED, Point(0,0));
 }
 
 void Edit::Delete()
@@ -415,7 +408,7 @@ void Edit::Delete()
     int32_t byteindex = GetByteIndex(m_pointerPosition);
 
     // узнаем длину символа
-    uint8_t s = GetUnicodeSymbolSize(m_text[byteindex]);
+    uint8_t s = UTF8SymbolSize(m_text[byteindex]);
 
     // сдвигаем правую часть строки влево на s байтов
     for(int32_t i=byteindex; i<m_textSize; i++)
@@ -424,81 +417,10 @@ void Edit::Delete()
     }
     m_textSize -= s;
     ReDraw();
+    NotifyParent(EVENT_EDIT_CHANGED, Point(0,0));
 }
 
 uint32_t Edit::GetByteIndex(uint32_t position)
 {
-    uint32_t byteindex = 0, symindex = 0;
-    while(symindex < position)
-    {
-        assert(byteindex<m_textSize);
-        // в зависимости от длины символа в байтах
-        uint8_t s = GetUnicodeSymbolSize(m_text[byteindex]);
-        byteindex += s;
-        ++symindex;
-    }
-
-    return byteindex;
-}
-
-// копирование одного символа UTF-8 из m_text в m_shadow
-void Edit::CopyUnicodeSymbol(uint32_t &b)
-{
-    uint8_t s = GetUnicodeSymbolSize(m_text[b]);
-    for(uint8_t i=0; i<s; i++)
-    {
-        m_shadow[b] = m_text[b];
-        ++b;
-    }
-}
-
-uint8_t Edit::GetUnicodeSymbolSize(uint8_t firstbyte)
-{
-    if((firstbyte & 0x80) == 0x00)
-    {
-        // UTF-8: ASCII (8 bits)
-        return 1;
-    }
-    else if((firstbyte & 0xe0) == 0xc0)
-    {
-        // UTF-8: 16 bits
-        return 2;
-    }
-    else if((firstbyte & 0xf0) == 0xe0)
-    {
-        // UTF-8: 24 bits
-        return 3;
-    }
-    else if((firstbyte & 0xf8) == 0xf0)
-    {
-        // UTF-8: 32 bits
-        return 4;
-    }
-    else
-    {
-        // не должно быть
-        assert(0);
-        return 0;
-    }
-}
-
-bool Edit::CheckUTF8(const char *s)
-{
-    while(*s)
-    {
-        uint8_t l = GetUnicodeSymbolSize(s[0]);
-        if(l==0)
-        {
-            return false;
-        }
-        for(uint8_t i=1; i<l; i++)
-        {
-            if((s[i]&0xc0) != 0x80)
-            {
-                return false;
-            }
-        }
-        s+=l;
-    }
-    return true;
+    return UTF8Offset(m_text, m_textSize, position);
 }
@@ -0,0 +1,144 @@
+// eventqueue.cc
+
+#include <atomic>
+#include <functional>
+#include <cassert>
+#include "window.h"
+#include "mainloop.h"
+#include "eventqueue.h"
+
+#define COALESCE_HASH_SIZE  2048    // размер хеш-таблицы объединения (больше POSTED_BATCH_MAX)
+
+// очередь Вьюкова: производители добавляют в голову, потребитель забирает из хвоста
+static POSTEDEVENT              s_stub;
+static std::atomic<POSTEDEVENT*> s_head(&s_stub);
+static POSTEDEVENT              *s_tail = &s_stub;
+static std::atomic<uint32_t>    s_nPending(0);
+
+// рабочие массивы потребителя
+static POSTEDEVENT *s_batch[POSTED_BATCH_MAX];
+static int16_t     s_hash[COALESCE_HASH_SIZE];
+
+static void Push(POSTEDEVENT *e)
+{
+    e->next.store(nullptr, std::memory_order_relaxed);
+    POSTEDEVENT *prev = s_head.exchange(e, std::memory_order_acq_rel);
+    prev->next.store(e, std::memory_order_release);
+}
+
+// nullptr - очередь пуста или производитель еще не завершил добавление
+static POSTEDEVENT *Pop()
+{
+    POSTEDEVENT *tail = s_tail;
+    POSTEDEVENT *next = tail->next.load(std::memory_order_acquire);
+
+    if(tail == &s_stub)
+    {
+        if(next == nullptr)
+        {
+            return nullptr;
+        }
+        s_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if(next)
+    {
+        s_tail = next;
+        return tail;
+    }
+
+    if(tail != s_head.load(std::memory_order_acquire))
+    {
+        return nullptr;
+    }
+
+    Push(&s_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if(next)
+    {
+        s_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+void PostEvent(const std::shared_ptr<Window*> &target, uint32_t type, const Point &position, uint64_t value)
+{
+    assert(target);
+
+    POSTEDEVENT *e = new POSTEDEVENT;
+    e->target = target;
+    e->type = type;
+    e->position = position;
+    e->value = value;
+    Push(e);
+
+    // будим главный цикл только при появлении первого события
+    if(s_nPending.fetch_add(1, std::memory_order_release) == 0)
+    {
+        WakeMainLoop();
+    }
+}
+
+bool HasPostedEvents()
+{
+    return s_nPending.load(std::memory_order_acquire) > 0;
+}
+
+void DispatchPostedEvents(EVENTSINK sink)
+{
+    // забираем накопившиеся события, объединяя одинаковые
+    for(uint16_t i=0; i<COALESCE_HASH_SIZE; i++)
+    {
+        s_hash[i] = -1;
+    }
+
+    uint16_t n = 0;
+    uint32_t nTaken = 0;
+    POSTEDEVENT *e;
+    while(n < POSTED_BATCH_MAX && nTaken < POSTED_DRAIN_MAX && (e = Pop()) != nullptr)
+    {
+        ++nTaken;
+        s_nPending.fetch_sub(1, std::memory_order_relaxed);
+
+        // объединяются только идемпотентные события
+        if(!(e->type & POSTED_COALESCE) && e->type != EVENT_WINDOWRESIZE)
+        {
+            s_batch[n++] = e;
+            continue;
+        }
+
+        uint32_t h = (uint32_t)(((uintptr_t) e->target.get() >> 4) * 31 + e->type) % COALESCE_HASH_SIZE;
+        while(s_hash[h] >= 0 && (s_batch[s_hash[h]]->target != e->target || s_batch[s_hash[h]]->type != e->type))
+        {
+            h = (h+1) % COALESCE_HASH_SIZE;
+        }
+
+        if(s_hash[h] >= 0)
+        {
+            // такое событие уже есть: обновляем его значения, порядок - по первому событию
+            POSTEDEVENT *first = s_batch[s_hash[h]];
+            first->position = e->position;
+            first->value = e->value;
+            delete e;
+        }
+        else
+        {
+            s_hash[h] = n;
+            s_batch[n++] = e;
+        }
+    }
+
+    // доставляем события существующим окнам: адрес в target обнуляется при уничтожении окна
+    for(uint16_t i=0; i<n; i++)
+    {
+        e = s_batch[i];
+        if(*e->target)
+        {
+            sink(*e->target, e->type & ~POSTED_COALESCE, e->position, e->value);
+        }
+        delete e;
+    }
+}
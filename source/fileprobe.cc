@@ -0,0 +1,407 @@
+// fileprobe.cc
+
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syscall.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+#include "threadpool.h"
+#include "fileprobe.h"
+
+#define PROBE_CHUNK     32      // файлов в одном задании пула (без io_uring)
+
+uint8_t FileTypeBySignature(const uint8_t *head, size_t size)
+{
+    if(size >= 8 && !memcmp(head, "\x89PNG\r\n\x1a\n", 8))
+    {
+        return FILETYPE_PNG;
+    }
+    if(size >= 3 && head[0] == 0xff && head[1] == 0xd8 && head[2] == 0xff)
+    {
+        return FILETYPE_JPEG;
+    }
+    if(size >= 6 && (!memcmp(head, "GIF87a", 6) || !memcmp(head, "GIF89a", 6)))
+    {
+        return FILETYPE_GIF;
+    }
+    if(size >= 12 && !memcmp(head, "RIFF", 4) && !memcmp(head+8, "WEBP", 4))
+    {
+        return FILETYPE_WEBP;
+    }
+    if(size >= 4 && (!memcmp(head, "II*\0", 4) || !memcmp(head, "MM\0*", 4)))
+    {
+        return FILETYPE_TIFF;
+    }
+    if(size >= 2 && head[0] == 'B' && head[1] == 'M')
+    {
+        return FILETYPE_BMP;
+    }
+    return FILETYPE_UNKNOWN;
+}
+
+static uint8_t ProbeOne(int dirfd, const char *name)
+{
+    int fd = openat(dirfd, name, O_RDONLY|O_CLOEXEC|O_NOCTTY);
+    if(fd < 0)
+    {
+        return FILETYPE_UNKNOWN;
+    }
+    uint8_t head[PROBE_BYTES];
+    ssize_t n = pread(fd, head, sizeof(head), 0);
+    close(fd);
+    return n > 0 ? FileTypeBySignature(head, n) : FILETYPE_UNKNOWN;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// io_uring (системные вызовы напрямую, без liburing)
+
+typedef struct _RING
+{
+    int       fd;
+    unsigned  *sqTail, *sqMask, *sqArray;
+    unsigned  *cqHead, *cqTail, *cqMask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void      *sqMap, *cqMap;
+    size_t    sqMapSize, cqMapSize, sqesSize;
+    unsigned  nEntries;
+    bool      bLost;        // судьба отправленных записей неизвестна (см. RingSubmitAndWait)
+} RING;
+
+static std::atomic<bool> s_bNoRing(false);  // io_uring недоступен - дальше сразу пул потоков
+
+static bool RingInit(RING *r, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(r, 0, sizeof(RING));
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(r->fd < 0)
+    {
+        // нет в ядре или запрещен; нехватка памяти или дескрипторов - временная
+        if(errno == ENOSYS || errno == EPERM || errno == EINVAL)
+        {
+            s_bNoRing = true;
+        }
+        return false;
+    }
+
+    r->sqMapSize = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+    r->cqMapSize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+    if(p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        r->sqMapSize = r->cqMapSize = std::max(r->sqMapSize, r->cqMapSize);
+    }
+    r->sqMap = mmap(nullptr, r->sqMapSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cqMap = MAP_FAILED;
+    r->sqes = (struct io_uring_sqe *) MAP_FAILED;
+    if(r->sqMap != MAP_FAILED)
+    {
+        r->cqMap = (p.features & IORING_FEAT_SINGLE_MMAP) ? r->sqMap
+            : mmap(nullptr, r->cqMapSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        r->sqesSize = p.sq_entries*sizeof(struct io_uring_sqe);
+        r->sqes = (struct io_uring_sqe *) mmap(nullptr, r->sqesSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    }
+    if(r->sqMap == MAP_FAILED || r->cqMap == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+        if(r->sqes != MAP_FAILED)
+        {
+            munmap(r->sqes, r->sqesSize);
+        }
+        if(r->cqMap != MAP_FAILED && r->cqMap != r->sqMap)
+        {
+            munmap(r->cqMap, r->cqMapSize);
+        }
+        if(r->sqMap != MAP_FAILED)
+        {
+            munmap(r->sqMap, r->sqMapSize);
+        }
+        close(r->fd);
+        return false;
+    }
+
+    uint8_t *sq = (uint8_t *) r->sqMap, *cq = (uint8_t *) r->cqMap;
+    r->sqTail = (unsigned *)(sq + p.sq_off.tail);
+    r->sqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+    r->sqArray = (unsigned *)(sq + p.sq_off.array);
+    r->cqHead = (unsigned *)(cq + p.cq_off.head);
+    r->cqTail = (unsigned *)(cq + p.cq_off.tail);
+    r->cqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    r->nEntries = p.sq_entries;
+    return true;
+}
+
+static void RingFree(RING *r)
+{
+    munmap(r->sqes, r->sqesSize);
+    if(r->cqMap != r->sqMap)
+    {
+        munmap(r->cqMap, r->cqMapSize);
+    }
+    munmap(r->sqMap, r->sqMapSize);
+    close(r->fd);
+}
+
+// очередная запись очереди отправки (место есть: в пакете не больше nEntries записей)
+static struct io_uring_sqe *RingGetSQE(RING *r, unsigned *tail)
+{
+    unsigned i = *tail & *r->sqMask;
+    struct io_uring_sqe *sqe = &r->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqArray[i] = i;
+    ++*tail;
+    return sqe;
+}
+
+// отправка записей до tail и ожидание nWait завершений (каждая запись дает одно завершение);
+// false - ошибка io_uring_enter. И при ошибке записи, принятые ядром, к возврату завершены и их
+// результаты можно разобрать (RingReap); не принятые не выполняются. Если не удалось и ожидание,
+// выставляется r->bLost: что выполнено - неизвестно
+static bool RingSubmitAndWait(RING *r, unsigned tail, unsigned nWait)
+{
+    unsigned nTotal = tail - *r->sqTail;
+    unsigned nSubmit = nTotal;
+    bool bOk = true;
+    __atomic_store_n(r->sqTail, tail, __ATOMIC_RELEASE);
+    for(;;)
+    {
+        unsigned nReady = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE) - *r->cqHead;
+        if(!nSubmit && nReady >= nWait)
+        {
+            return bOk;
+        }
+        int res = syscall(__NR_io_uring_enter, r->fd, nSubmit, nWait > nReady ? nWait - nReady : 0,
+            IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(res < 0)
+        {
+            if(errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            {
+                continue;
+            }
+            if(!bOk)
+            {
+                r->bLost = true;
+                return false;
+            }
+            // дальше только ожидание завершения принятых записей
+            bOk = false;
+            nWait = nTotal - nSubmit;
+            nSubmit = 0;
+            continue;
+        }
+        nSubmit -= std::min((unsigned) res, nSubmit);
+    }
+}
+
+// обход полученных завершений
+static void RingReap(RING *r, std::function<void(uint64_t, int32_t)> fn)
+{
+    unsigned head = *r->cqHead;
+    unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cqMask];
+        fn(cqe->user_data, cqe->res);
+    }
+    __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+}
+
+// пакетами по PROBE_DEPTH: сначала все openat, затем для открытых - read и связанный с ним close;
+// false - ошибка io_uring (если он недоступен совсем - выставляется s_bNoRing), проверены файлы до *pDone
+static bool ProbeRing(int dirfd, const char *const *names, uint32_t n, uint8_t *types, uint32_t *pDone)
+{
+    RING r;
+    if(!RingInit(&r, 2*PROBE_DEPTH))
+    {
+        return false;
+    }
+
+    int fds[PROBE_DEPTH];
+    int32_t reads[PROBE_DEPTH];
+    uint8_t heads[PROBE_DEPTH][PROBE_BYTES];
+    bool bOk = true;
+
+    *pDone = 0;
+    for(uint32_t first=0; bOk && first<n; first+=PROBE_DEPTH)
+    {
+        uint32_t count = std::min(n-first, (uint32_t) PROBE_DEPTH);
+
+        // открытие
+        unsigned tail = *r.sqTail;
+        for(uint32_t i=0; i<count; i++)
+        {
+            struct io_uring_sqe *sqe = RingGetSQE(&r, &tail);
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = dirfd;
+            sqe->addr = (uint64_t)(uintptr_t) names[first+i];
+            sqe->open_flags = O_RDONLY|O_CLOEXEC|O_NOCTTY;
+            sqe->user_data = i;
+            fds[i] = -1;
+        }
+        if(!RingSubmitAndWait(&r, tail, count))
+        {
+            // файлы, открытые до ошибки, закрываются до перехода к пулу потоков
+            RingReap(&r, [&](uint64_t, int32_t res)
+            {
+                if(res >= 0 && !r.bLost)
+                {
+                    close(res);
+                }
+            });
+            bOk = false;
+            break;
+        }
+        bool bUnsupported = false, bNoFiles = false;
+        RingReap(&r, [&](uint64_t i, int32_t res)
+        {
+            fds[i] = res;
+            bUnsupported = bUnsupported || res == -EINVAL || res == -EOPNOTSUPP;
+            bNoFiles = bNoFiles || res == -EMFILE || res == -ENFILE;
+        });
+        if(bUnsupported)
+        {
+            // ядро без IORING_OP_OPENAT
+            s_bNoRing = true;
+            for(uint32_t i=0; i<count; i++)
+            {
+                if(fds[i] >= 0)
+                {
+                    close(fds[i]);
+                }
+            }
+            bOk = false;
+            break;
+        }
+
+        // чтение начала и закрытие
+        tail = *r.sqTail;
+        unsigned nWait = 0;
+        for(uint32_t i=0; i<count; i++)
+        {
+            reads[i] = -1;
+            if(fds[i] < 0)
+            {
+                continue;
+            }
+            struct io_uring_sqe *sqe = RingGetSQE(&r, &tail);
+            sqe->opcode = IORING_OP_READ;
+            sqe->fd = fds[i];
+            sqe->addr = (uint64_t)(uintptr_t) heads[i];
+            sqe->len = PROBE_BYTES;
+            sqe->off = 0;
+            sqe->flags = IOSQE_IO_LINK;
+            sqe->user_data = (uint64_t) i << 1;
+
+            sqe = RingGetSQE(&r, &tail);
+            sqe->opcode = IORING_OP_CLOSE;
+            sqe->fd = fds[i];
+            sqe->user_data = (uint64_t) i << 1 | 1;
+            nWait += 2;
+        }
+        bOk = RingSubmitAndWait(&r, tail, nWait);
+        RingReap(&r, [&](uint64_t data, int32_t res)
+        {
+            uint32_t i = data >> 1;
+            if(!(data & 1))
+            {
+                reads[i] = res;
+            }
+            else
+            {
+                if(res == -ECANCELED)
+                {
+                    // чтение не удалось - связанное закрытие отменено
+                    close(fds[i]);
+                }
+                fds[i] = -1;
+            }
+        });
+        if(!bOk)
+        {
+            // закрытия, не принятые ядром, выполняются здесь; если неизвестно, что выполнено,
+            // дескрипторы остаются открытыми - повторное закрытие могло бы закрыть чужой файл
+            for(uint32_t i=0; i<count; i++)
+            {
+                if(fds[i] >= 0 && !r.bLost)
+                {
+                    close(fds[i]);
+                }
+            }
+            break;
+        }
+
+        for(uint32_t i=0; i<count; i++)
+        {
+            if(fds[i] == -EMFILE || fds[i] == -ENFILE)
+            {
+                // не хватило дескрипторов (пакет держит открытыми до PROBE_DEPTH файлов);
+                // файлы пакета уже закрыты - повтор по одному
+                types[first+i] = ProbeOne(dirfd, names[first+i]);
+                continue;
+            }
+            types[first+i] = reads[i] > 0 ? FileTypeBySignature(heads[i], reads[i]) : FILETYPE_UNKNOWN;
+        }
+        *pDone = first+count;
+        if(bNoFiles)
+        {
+            // остальные файлы - в пуле потоков, по одному открытому файлу на поток
+            break;
+        }
+    }
+
+    RingFree(&r);
+    return bOk;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+// пул потоков
+
+// файлы разбираются порциями по PROBE_CHUNK
+static void ProbePool(int dirfd, const char *const *names, uint32_t n, uint8_t *types)
+{
+    uint32_t nChunks = (n + PROBE_CHUNK-1)/PROBE_CHUNK;
+    ThreadPool::Get()->ParallelFor(nChunks, [dirfd, names, n, types](uint32_t chunk)
+    {
+        uint32_t first = chunk*PROBE_CHUNK;
+        uint32_t end = std::min(first + PROBE_CHUNK, n);
+        for(uint32_t i=first; i<end; i++)
+        {
+            types[i] = ProbeOne(dirfd, names[i]);
+        }
+    });
+}
+
+void FileProbe(int dirfd, const char *const *names, uint32_t n, uint8_t *types)
+{
+    if(n == 0)
+    {
+        return;
+    }
+
+    uint32_t nDone = 0;
+    if(!s_bNoRing)
+    {
+        const char *env = getenv("GUI_IOURING");
+        if(env && !strcmp(env, "0"))
+        {
+            s_bNoRing = true;
+        }
+        else
+        {
+            // при временной ошибке io_uring остается доступным для следующих вызовов
+            ProbeRing(dirfd, names, n, types, &nDone);
+        }
+    }
+    if(nDone < n)
+    {
+        ProbePool(dirfd, names+nDone, n-nDone, types+nDone);
+    }
+}
@@ -0,0 +1,75 @@
+// idle.cc
+
+#include <functional>
+#include <memory>
+#include <deque>
+#include <ctime>
+#include "window.h"
+#include "mainloop.h"
+#include "idle.h"
+
+typedef struct _IDLEJOB
+{
+    IDLESTEP step;
+    std::shared_ptr<Window*> owner;     // nullptr - задание не привязано к окну
+} IDLEJOB;
+
+static std::deque<IDLEJOB> s_jobs;
+static uint32_t s_sliceUs = IDLE_SLICE_US;
+
+static uint64_t GetTimeUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+void ScheduleIdle(IDLESTEP step, std::shared_ptr<Window*> owner)
+{
+    IDLEJOB job;
+    job.step = std::move(step);
+    job.owner = std::move(owner);
+    s_jobs.push_back(std::move(job));
+    RequestIdle();
+}
+
+void SetIdleSlice(uint32_t us)
+{
+    s_sliceUs = us;
+}
+
+uint32_t GetIdleSlice()
+{
+    return s_sliceUs;
+}
+
+bool RunIdleSlice()
+{
+    uint64_t deadline = GetTimeUs() + s_sliceUs;
+
+    // по одной порции каждого задания по кругу, пока не истечет интервал
+    do
+    {
+        if(s_jobs.empty())
+        {
+            break;
+        }
+
+        IDLEJOB job = std::move(s_jobs.front());
+        s_jobs.pop_front();
+
+        // окно задания уничтожено - задание снимается
+        if(job.owner && *job.owner == nullptr)
+        {
+            continue;
+        }
+
+        if(job.step())
+        {
+            s_jobs.push_back(std::move(job));
+        }
+    }
+    while(GetTimeUs() < deadline);
+
+    return !s_jobs.empty();
+}
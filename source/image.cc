@@ -1,10 +1,22 @@
 #include "window.h"
+#include "mainloop.h"
 #include "image.h"
+#include "imagecache.h"
 
 Image::Image(const IMAGEINFO image)
 {
     m_ClassName = __FUNCTION__;
     SetFrameWidth(0);
+    m_image = nullptr;
+    m_scaled = nullptr;
+    for(uint8_t i=0; i<IMAGE_MIPS; i++)
+    {
+        m_mips[i] = nullptr;
+    }
+    m_scaledWidth = 0;
+    m_scaledHeight = 0;
+    m_nScale = 0;
+    m_bMips = false;
     SetImage(image);
     m_scaleX = 1.0;
     m_scaleY = 1.0;
@@ -13,13 +25,154 @@ Image::Image(const IMAGEINFO image)
 
 Image::~Image()
 {
+    ClearScaled();
+    ImageRelease(m_image);
 }
 
+// окно держит свою ссылку на картинку
 void Image::SetImage(const IMAGEINFO image)
 {
+    if(image == m_image)
+    {
+        return;
+    }
+    ClearScaled();
+    ImageAddRef(image);
+    ImageRelease(m_image);
     m_image = image;
 }
 
+void Image::ClearScaled()
+{
+    ImageRelease(m_scaled);
+    m_scaled = nullptr;
+    for(uint8_t i=0; i<IMAGE_MIPS; i++)
+    {
+        ImageRelease(m_mips[i]);
+        m_mips[i] = nullptr;
+    }
+    m_scaledWidth = 0;
+    m_scaledHeight = 0;
+    m_bMips = false;
+    ++m_nScale;     // результат начатого масштабирования не нужен
+}
+
+IMAGEINFO Image::GetMip(uint16_t width, uint16_t height)
+{
+    IMAGEINFO src = m_image;
+    for(uint8_t i=0; i<IMAGE_MIPS && m_mips[i]; i++)
+    {
+        if(m_mips[i]->width < width || m_mips[i]->height < height)
+        {
+            break;
+        }
+        src = m_mips[i];
+    }
+    return src;
+}
+
+void Image::RequestMips(Context *cr)
+{
+    if(m_bMips)
+    {
+        return;
+    }
+    m_bMips = true;
+
+    // копии строятся один раз и дальше переиспользуются при любом уменьшении; пока их нет,
+    // выводится сама картинка. Задание держит ссылку на картинку: пока оно не закончено,
+    // картинка не удаляется и ее адрес не может достаться другой картинке
+    typedef struct { IMAGEINFO src; IMAGEINFO mips[IMAGE_MIPS]; } MIPS;
+    std::shared_ptr<MIPS> result(new MIPS(), [](MIPS *p)
+        {
+            for(uint8_t i=0; i<IMAGE_MIPS; i++)
+            {
+                ImageRelease(p->mips[i]);
+            }
+            ImageRelease(p->src);
+            delete p;
+        });
+    result->src = ImageAddRef(m_image);
+    RunInBackground([cr, result]()
+        {
+            IMAGEINFO src = result->src;
+            for(uint8_t i=0; i<IMAGE_MIPS && src->width >= 2 && src->height >= 2; i++)
+            {
+                result->mips[i] = cr->ScaleImage(src, src->width/2, src->height/2, IMAGE_FILTER_GOOD);
+                if(!result->mips[i])
+                {
+                    break;
+                }
+                src = result->mips[i];
+            }
+        },
+        [this, result]()
+        {
+            if(result->src != m_image || !m_bMips)
+            {
+                return;
+            }
+            for(uint8_t i=0; i<IMAGE_MIPS; i++)
+            {
+                ImageRelease(m_mips[i]);
+                m_mips[i] = result->mips[i];
+                result->mips[i] = nullptr;
+            }
+            ReDraw();
+        });
+}
+
+void Image::RequestScale(Context *cr, uint16_t width, uint16_t height)
+{
+    if(width == m_scaledWidth && height == m_scaledHeight)
+    {
+        return;
+    }
+    m_scaledWidth = width;
+    m_scaledHeight = height;
+
+    // каждое изменение размера откладывает масштабирование: считается только последний размер
+    uint32_t nScale = ++m_nScale;
+    std::shared_ptr<Window*> self = GetLifetime();
+    InvokeAfter(IMAGE_SETTLE_MS, [this, self, cr, nScale]()
+    {
+        if(!*self || nScale != m_nScale)
+        {
+            return;
+        }
+
+        // результат освобождается и тогда, когда окно уничтожено до окончания масштабирования
+        IMAGEINFO src = ImageAddRef(m_image);
+        uint16_t w = m_scaledWidth, h = m_scaledHeight;
+        std::shared_ptr<IMAGEINFO> result(new IMAGEINFO(nullptr), [](IMAGEINFO *p) { ImageRelease(*p); delete p; });
+        RunInBackground([cr, src, w, h, result]()
+            {
+                *result = cr->ScaleImage(src, w, h, IMAGE_FILTER_GOOD);
+                ImageRelease(src);
+            },
+            [this, nScale, result]()
+            {
+                if(nScale != m_nScale)
+                {
+                    return;
+                }
+                if(*result)
+                {
+                    ImageRelease(m_scaled);
+                    m_scaled = *result;
+                    *result = nullptr;
+                    ReDraw();
+                }
+                else
+                {
+                    // масштабирование не удалось - следующая отрисовка запросит его снова
+                    m_scaledWidth = 0;
+                    m_scaledHeight = 0;
+                }
+            });
+    });
+}
+
 IMAGEINFO Image::GetImage()
 {
     return m_image;
@@ -113,7 +266,31 @@ void Image::OnDraw(Context *cr)
             }
         }
 
-        cr->Image(m_image, Point(gx,gy), sx, sy);
+        // размер картинки при выводе
+        double tw = m_image->width*sx + 0.5, th = m_image->height*sy + 0.5;
+        if((sx == 1.0 && sy == 1.0) || tw < 1.0 || th < 1.0 || tw > UINT16_MAX || th > UINT16_MAX
+            || tw*th > IMAGE_SCALED_MAX)
+        {
+            cr->Image(m_image, Point(gx,gy), sx, sy);
+        }
+        else if(m_scaled && m_scaled->width == (int32_t) tw && m_scaled->height == (int32_t) th)
+        {
+            // готовая масштабированная картинка выводится без пересчета точек
+            cr->Image(m_scaled, Point(gx,gy), 1.0, 1.0);
+        }
+        else
+        {
+            // пока размер меняется - быстрый фильтр по ближайшей уменьшенной копии (пока копии
+            // строятся в фоне - по самой картинке), качественная картинка будет построена после паузы
+            uint16_t w = (uint16_t) tw, h = (uint16_t) th;
+            if(m_image->width/2 >= w && m_image->height/2 >= h)
+            {
+                RequestMips(cr);
+            }
+            IMAGEINFO src = GetMip(w, h);
+            cr->Image(src, Point(gx,gy), (double) w/src->width, (double) h/src->height, IMAGE_FILTER_FAST);
+            RequestScale(cr, w, h);
+        }
     }
 }
 
@@ -0,0 +1,183 @@
+// imagecache.cc
+
+#include <atomic>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <sys/stat.h>
+#include "window.h"
+#include "metrics.h"
+#include "imagecache.h"
+
+typedef struct _CACHEDIMAGE
+{
+    std::string key;
+    IMAGEINFO   ii;         // ссылка кэша на картинку
+    uint64_t    bytes;
+} CACHEDIMAGE;
+
+static std::mutex               s_mutex;
+static std::list<CACHEDIMAGE>   s_lru;      // в начале - недавно использованные
+static std::unordered_map<std::string, std::list<CACHEDIMAGE>::iterator> s_index;
+static uint64_t                 s_bytes = 0;
+static uint64_t                 s_budget = 0;
+static uint64_t                 s_hits = 0, s_misses = 0, s_evictions = 0;
+static std::atomic<int64_t>     s_resident(0);  // объем всех картинок в памяти; метрика только публикует его
+
+IMAGEINFO ImageAddRef(IMAGEINFO ii)
+{
+    if(ii)
+    {
+        ii->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ii;
+}
+
+void ImageRelease(IMAGEINFO ii)
+{
+    if(ii && ii->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        ii->destroy(ii);
+    }
+}
+
+void ImageBytesChanged(int64_t bytes)
+{
+    s_resident.fetch_add(bytes, std::memory_order_relaxed);
+    metricImageBytes.Add(bytes);
+}
+
+// вызывается под s_mutex
+static uint64_t GetBudget()
+{
+    if(s_budget == 0)
+    {
+        const char *env = getenv("GUI_IMAGECACHE_MB");
+        int mb = env ? atoi(env) : IMAGECACHE_MB;
+        s_budget = (uint64_t)(mb > 0 ? mb : IMAGECACHE_MB) << 20;
+    }
+    return s_budget;
+}
+
+// вытеснение неиспользуемых картинок, начиная с давно использованных, пока объем всех картинок
+// в памяти (в том числе используемых, масштабированных копий и уменьшенных копий окон Image)
+// больше budget; вызывается под s_mutex
+static void Evict(uint64_t budget)
+{
+    auto it = s_lru.end();
+    while(s_resident.load(std::memory_order_relaxed) > (int64_t) budget && it != s_lru.begin())
+    {
+        --it;
+
+        // картинку используют вне кэша (ссылку может добавить только кэш, под s_mutex)
+        if(it->ii->refs.load(std::memory_order_acquire) > 1)
+        {
+            continue;
+        }
+
+        s_bytes -= it->bytes;
+        metricImageCacheBytes.Add(-(int64_t) it->bytes);
+        ++s_evictions;
+        metricImageCacheEvictions.Add();
+        ImageRelease(it->ii);
+        s_index.erase(it->key);
+        it = s_lru.erase(it);
+    }
+}
+
+IMAGEINFO ImageCacheLoad(Context *cr, const char *filename, uint16_t maxWidth, uint16_t maxHeight)
+{
+    // ключ: полный путь, время изменения и размер файла, размер чтения
+    char path[PATH_MAX];
+    struct stat st;
+    if(!realpath(filename, path) || stat(path, &st) != 0)
+    {
+        return nullptr;
+    }
+    char suffix[96];
+    snprintf(suffix, sizeof(suffix), "|%lld.%09ld|%lld|%ux%u", (long long) st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+        (long long) st.st_size, maxWidth, maxHeight);
+    std::string key = std::string(path) + suffix;
+
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        auto it = s_index.find(key);
+        if(it != s_index.end())
+        {
+            s_lru.splice(s_lru.begin(), s_lru, it->second);
+            ++s_hits;
+            metricImageCacheHits.Add();
+            return ImageAddRef(it->second->ii);
+        }
+    }
+
+    // чтение - вне блокировки; если тот же файл одновременно читается в другом потоке,
+    // в кэше остается картинка, прочитанная первой
+    IMAGEINFO ii;
+    if(maxWidth || maxHeight)
+    {
+        ii = cr->LoadPNG(path, maxWidth ? maxWidth : UINT16_MAX, maxHeight ? maxHeight : UINT16_MAX);
+    }
+    else
+    {
+        ii = cr->LoadPNG(path);
+    }
+    if(!ii)
+    {
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    auto it = s_index.find(key);
+    if(it != s_index.end())
+    {
+        s_lru.splice(s_lru.begin(), s_lru, it->second);
+        ++s_hits;
+        metricImageCacheHits.Add();
+        ImageRelease(ii);
+        return ImageAddRef(it->second->ii);
+    }
+
+    CACHEDIMAGE ci;
+    ci.key = key;
+    ci.ii = ImageAddRef(ii);
+    ci.bytes = (uint64_t) ii->width*ii->height*4;
+    s_lru.push_front(ci);
+    s_index[key] = s_lru.begin();
+    s_bytes += ci.bytes;
+    metricImageCacheBytes.Add(ci.bytes);
+    ++s_misses;
+    metricImageCacheMisses.Add();
+
+    Evict(GetBudget());
+    return ii;
+}
+
+void ImageCacheSetBudget(uint64_t bytes)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    s_budget = bytes;
+    Evict(GetBudget());
+}
+
+void ImageCacheGetStat(IMAGECACHESTAT *stat)
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    stat->hits = s_hits;
+    stat->misses = s_misses;
+    stat->evictions = s_evictions;
+    stat->bytes = s_bytes;
+    stat->resident = max(s_resident.load(std::memory_order_relaxed), 0);
+    stat->budget = GetBudget();
+    stat->count = s_lru.size();
+}
+
+void ImageCacheClear()
+{
+    std::lock_guard<std::mutex> lock(s_mutex);
+    Evict(0);
+}
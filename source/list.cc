@@ -98,9 +98,6 @@ void List::Insert(const uint16_t position, Window *pElement, void *value)
     // корректируем позицию, если нужно
     uint16_t pos = position < m_nElements ? position : m_nElements;
 
-    // отменим выбор текущего элемента
-    SetSelection(-1);
-
     // расширяем память
     if(m_nElements == 0)
     {
@@ -125,6 +122,12 @@ void List::Insert(const uint16_t position, Window *pElement, void *value)
     m_pValues[pos] = value;
     ++m_nElements;
 
+    // если вставили перед выбранным элементом, сдвинем выбор
+    if(m_nSelection >= pos)
+    {
+        ++m_nSelection;
+    }
+
     // добавляем окно-потомок
     Point p = Point(0, pos*m_ElementHeight);
     Rect s = Rect(GetInteriorSize().GetWidth(), m_ElementHeight);
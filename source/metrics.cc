@@ -0,0 +1,314 @@
+// metrics.cc
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cinttypes>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "metrics.h"
+
+// реестр метрик: заполняется конструкторами статических объектов, читается потоком публикации
+static std::atomic<Metric*>  s_metrics[METRICS_MAX];
+static std::atomic<uint32_t> s_nMetrics(0);
+
+Metric::Metric(const char *name, const char *help, MetricType type)
+{
+    m_name = name;
+    m_help = help;
+    m_type = type;
+
+    uint32_t i = s_nMetrics.fetch_add(1, std::memory_order_relaxed);
+    if(i < METRICS_MAX)
+    {
+        s_metrics[i].store(this, std::memory_order_release);
+    }
+    else
+    {
+        fprintf(stderr, "Метрика %s не зарегистрирована: превышено количество метрик\n", name);
+    }
+}
+
+Histogram::Histogram(const char *name, const char *help, const uint64_t *bounds, uint16_t nBounds)
+    : Metric(name, help, METRIC_HISTOGRAM), m_count(0), m_sum(0)
+{
+    m_bounds = bounds;
+    m_nBounds = nBounds < HISTOGRAM_MAX_BUCKETS ? nBounds : HISTOGRAM_MAX_BUCKETS;
+    for(uint16_t i=0; i<=HISTOGRAM_MAX_BUCKETS; i++)
+    {
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::Observe(uint64_t value)
+{
+    // интервалы немногочисленны, линейный поиск быстрее двоичного
+    uint16_t i = 0;
+    while(i < m_nBounds && value > m_bounds[i])
+    {
+        ++i;
+    }
+    m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    m_sum.fetch_add(value, std::memory_order_relaxed);
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static const uint64_t s_frameTimeBounds[] = { 1000, 2000, 4000, 8000, 16000, 33000, 66000, 100000, 250000, 1000000 };
+
+Histogram metricFrameTime("gui_frame_time_us", "Время отрисовки кадра, мкс",
+    s_frameTimeBounds, sizeof(s_frameTimeBounds)/sizeof(s_frameTimeBounds[0]));
+Counter metricEventsDispatched("gui_events_dispatched_total", "Количество обработанных событий");
+Counter metricTimersFired("gui_timers_fired_total", "Количество сработавших таймеров");
+Counter metricImagesLoaded("gui_images_loaded_total", "Количество загруженных картинок");
+Gauge   metricImageBytes("gui_image_bytes", "Объем памяти поверхностей картинок, байты");
+Counter metricImageCacheHits("gui_image_cache_hits_total", "Картинки, найденные в кэше картинок");
+Counter metricImageCacheMisses("gui_image_cache_misses_total", "Картинки, загруженные в кэш картинок");
+Counter metricImageCacheEvictions("gui_image_cache_evictions_total", "Картинки, вытесненные из кэша картинок");
+Gauge   metricImageCacheBytes("gui_image_cache_bytes", "Объем картинок в кэше картинок, байты");
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void MetricsSnapshot(std::string &out)
+{
+    char line[256];
+    out.clear();
+
+    uint32_t n = s_nMetrics.load(std::memory_order_acquire);
+    n = n < METRICS_MAX ? n : METRICS_MAX;
+    for(uint32_t i=0; i<n; i++)
+    {
+        Metric *m = s_metrics[i].load(std::memory_order_acquire);
+        if(m == nullptr)
+        {
+            // регистрация еще не завершена
+            continue;
+        }
+
+        const char *type = m->GetType() == METRIC_COUNTER ? "counter" : m->GetType() == METRIC_GAUGE ? "gauge" : "histogram";
+        snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n", m->GetName(), m->GetHelp(), m->GetName(), type);
+        out += line;
+
+        if(m->GetType() == METRIC_COUNTER)
+        {
+            snprintf(line, sizeof(line), "%s %" PRIu64 "\n", m->GetName(), static_cast<Counter*>(m)->Get());
+            out += line;
+        }
+        else if(m->GetType() == METRIC_GAUGE)
+        {
+            snprintf(line, sizeof(line), "%s %" PRId64 "\n", m->GetName(), static_cast<Gauge*>(m)->Get());
+            out += line;
+        }
+        else
+        {
+            // в формате Prometheus интервалы гистограммы накопительные
+            Histogram *h = static_cast<Histogram*>(m);
+            uint64_t cumulative = 0;
+            for(uint16_t b=0; b<h->GetBucketCount(); b++)
+            {
+                cumulative += h->GetBucket(b);
+                snprintf(line, sizeof(line), "%s_bucket{le=\"%" PRIu64 "\"} %" PRIu64 "\n", m->GetName(), h->GetBound(b), cumulative);
+                out += line;
+            }
+            cumulative += h->GetBucket(h->GetBucketCount());
+            snprintf(line, sizeof(line), "%s_bucket{le=\"+Inf\"} %" PRIu64 "\n%s_sum %" PRIu64 "\n%s_count %" PRIu64 "\n",
+                m->GetName(), cumulative, m->GetName(), h->GetSum(), m->GetName(), h->GetCount());
+            out += line;
+        }
+    }
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// публикация снимков в отдельном потоке
+static std::thread *s_pExporter = nullptr;
+static int s_wakeup[2] = { -1, -1 };            // канал для остановки потока
+static int s_listen = -1;                       // слушающий сокет
+static char s_socketPath[sizeof(((struct sockaddr_un*)0)->sun_path)];
+static char s_filePath[1024];
+static int  s_period = METRICS_PERIOD;
+
+static void WriteAll(int fd, const std::string &s)
+{
+    size_t done = 0;
+    while(done < s.size())
+    {
+        ssize_t n = send(fd, s.data()+done, s.size()-done, MSG_NOSIGNAL);
+        if(n <= 0)
+        {
+            return;
+        }
+        done += n;
+    }
+}
+
+// запись снимка во временный файл и атомарная замена
+static void WriteFile(const std::string &s)
+{
+    char tmp[sizeof(s_filePath)+8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", s_filePath);
+
+    FILE *out = fopen(tmp, "w");
+    if(!out)
+    {
+        return;
+    }
+    bool ok = fwrite(s.data(), 1, s.size(), out) == s.size();
+    ok = (fclose(out) == 0) && ok;
+    if(ok)
+    {
+        rename(tmp, s_filePath);
+    }
+    else
+    {
+        unlink(tmp);
+    }
+}
+
+static void ExporterThread()
+{
+    std::string snapshot;
+    struct pollfd fds[2];
+    fds[0].fd = s_wakeup[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = s_listen;
+    fds[1].events = POLLIN;
+
+    while(true)
+    {
+        if(s_filePath[0])
+        {
+            MetricsSnapshot(snapshot);
+            WriteFile(snapshot);
+        }
+
+        int timeout = s_filePath[0] ? s_period*1000 : -1;
+        int res = poll(fds, s_listen >= 0 ? 2 : 1, timeout);
+
+        if(res > 0 && (fds[0].revents & POLLIN))
+        {
+            // запрос на остановку
+            break;
+        }
+        if(res > 0 && (fds[1].revents & POLLIN))
+        {
+            int client = accept(s_listen, nullptr, nullptr);
+            if(client >= 0)
+            {
+                MetricsSnapshot(snapshot);
+                WriteAll(client, snapshot);
+                close(client);
+            }
+        }
+    }
+}
+
+static int OpenSocket(const char *path)
+{
+    struct sockaddr_un addr;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        fprintf(stderr, "Слишком длинный путь сокета метрик: %s\n", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+    if(fd < 0)
+    {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if(bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 4) < 0)
+    {
+        perror("Сокет метрик");
+        close(fd);
+        return -1;
+    }
+    strcpy(s_socketPath, path);
+    return fd;
+}
+
+void MetricsStart()
+{
+    if(s_pExporter)
+    {
+        return;
+    }
+
+    const char *socketPath = getenv("GUI_METRICS_SOCKET");
+    const char *filePath = getenv("GUI_METRICS_FILE");
+    const char *period = getenv("GUI_METRICS_PERIOD");
+
+    if(socketPath && *socketPath)
+    {
+        s_listen = OpenSocket(socketPath);
+    }
+    if(filePath && *filePath && strlen(filePath) < sizeof(s_filePath))
+    {
+        strcpy(s_filePath, filePath);
+    }
+    if(period && atoi(period) > 0)
+    {
+        s_period = atoi(period);
+    }
+
+    // публиковать некуда
+    if(s_listen < 0 && s_filePath[0] == 0)
+    {
+        return;
+    }
+
+    if(pipe2(s_wakeup, O_CLOEXEC) < 0)
+    {
+        perror("Публикация метрик");
+        if(s_listen >= 0)
+        {
+            close(s_listen);
+            unlink(s_socketPath);
+            s_listen = -1;
+        }
+        return;
+    }
+    s_pExporter = new std::thread(ExporterThread);
+}
+
+void MetricsStop()
+{
+    if(!s_pExporter)
+    {
+        return;
+    }
+
+    char c = 0;
+    if(write(s_wakeup[1], &c, 1) == 1)
+    {
+        s_pExporter->join();
+    }
+    else
+    {
+        s_pExporter->detach();
+    }
+    delete s_pExporter;
+    s_pExporter = nullptr;
+
+    close(s_wakeup[0]);
+    close(s_wakeup[1]);
+    if(s_listen >= 0)
+    {
+        close(s_listen);
+        unlink(s_socketPath);
+        s_listen = -1;
+    }
+}
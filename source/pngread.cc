@@ -0,0 +1,284 @@
+// pngread.cc
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <png.h>
+#include "pngread.h"
+
+struct _PNGREADER
+{
+    FILE        *file;
+    png_structp png;
+    png_infop   info;
+    uint32_t    width, height;
+    uint32_t    y;              // номер следующей строки
+    uint8_t     *row;           // строка RGBA
+    uint8_t     *image;         // картинка RGBA целиком (только при чересстрочной развертке)
+    png_bytep   *rows;          // указатели на строки image
+};
+
+// деление на 255 с округлением
+static inline uint32_t Div255(uint32_t v)
+{
+    v += 128;
+    return (v + (v >> 8)) >> 8;
+}
+
+bool PNGGetSize(const char *filename, uint32_t *width, uint32_t *height)
+{
+    FILE *file = fopen(filename, "rb");
+    if(!file)
+    {
+        return false;
+    }
+
+    // подпись, длина и тип первого блока (IHDR), ширина и высота (big-endian)
+    png_byte head[24];
+    bool bRead = fread(head, 1, sizeof(head), file) == sizeof(head);
+    fclose(file);
+    if(!bRead || png_sig_cmp(head, 0, 8) || memcmp(head+12, "IHDR", 4))
+    {
+        return false;
+    }
+    *width = png_get_uint_32(head+16);
+    *height = png_get_uint_32(head+20);
+    return true;
+}
+
+PNGREADER PNGOpen(const char *filename, uint32_t *width, uint32_t *height)
+{
+    FILE *file = fopen(filename, "rb");
+    if(!file)
+    {
+        return nullptr;
+    }
+
+    png_byte sign[8];
+    if(fread(sign, 1, 8, file) != 8 || png_sig_cmp(sign, 0, 8))
+    {
+        fclose(file);
+        return nullptr;
+    }
+
+    PNGREADER r = (PNGREADER) calloc(1, sizeof(struct _PNGREADER));
+    r->file = file;
+    r->png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    r->info = r->png ? png_create_info_struct(r->png) : nullptr;
+    if(!r->info)
+    {
+        PNGClose(r);
+        return nullptr;
+    }
+
+    if(setjmp(png_jmpbuf(r->png)))
+    {
+        PNGClose(r);
+        return nullptr;
+    }
+
+    png_init_io(r->png, file);
+    png_set_sig_bytes(r->png, 8);
+    png_read_info(r->png, r->info);
+
+    r->width = png_get_image_width(r->png, r->info);
+    r->height = png_get_image_height(r->png, r->info);
+    int colorType = png_get_color_type(r->png, r->info);
+    int bitDepth = png_get_bit_depth(r->png, r->info);
+
+    // приводим любой формат к RGBA по 8 бит
+    if(colorType == PNG_COLOR_TYPE_PALETTE)
+    {
+        png_set_palette_to_rgb(r->png);
+    }
+    if(colorType == PNG_COLOR_TYPE_GRAY && bitDepth < 8)
+    {
+        png_set_expand_gray_1_2_4_to_8(r->png);
+    }
+    if(png_get_valid(r->png, r->info, PNG_INFO_tRNS))
+    {
+        png_set_tRNS_to_alpha(r->png);
+    }
+    if(bitDepth == 16)
+    {
+        png_set_strip_16(r->png);
+    }
+    if(colorType == PNG_COLOR_TYPE_GRAY || colorType == PNG_COLOR_TYPE_GRAY_ALPHA)
+    {
+        png_set_gray_to_rgb(r->png);
+    }
+    png_set_filler(r->png, 0xff, PNG_FILLER_AFTER);
+    int passes = png_set_interlace_handling(r->png);
+    png_read_update_info(r->png, r->info);
+
+    size_t rowbytes = (size_t) r->width*4;
+    if(passes > 1)
+    {
+        // чересстрочную развертку построчно не прочитать - читаем картинку целиком
+        r->image = (uint8_t *) malloc(rowbytes*r->height);
+        r->rows = (png_bytep *) malloc(r->height*sizeof(png_bytep));
+        if(!r->image || !r->rows)
+        {
+            PNGClose(r);
+            return nullptr;
+        }
+        for(uint32_t y=0; y<r->height; y++)
+        {
+            r->rows[y] = r->image + y*rowbytes;
+        }
+        png_read_image(r->png, r->rows);
+    }
+    else
+    {
+        r->row = (uint8_t *) malloc(rowbytes);
+    }
+
+    *width = r->width;
+    *height = r->height;
+    return r;
+}
+
+bool PNGReadRow(PNGREADER r, uint32_t *row)
+{
+    if(r->y >= r->height)
+    {
+        return false;
+    }
+
+    const uint8_t *src;
+    if(r->image)
+    {
+        src = r->image + (size_t) r->y*r->width*4;
+    }
+    else
+    {
+        if(setjmp(png_jmpbuf(r->png)))
+        {
+            return false;
+        }
+        png_read_row(r->png, r->row, nullptr);
+        src = r->row;
+    }
+    ++r->y;
+
+    // RGBA -> ARGB32 с умножением на альфу
+    for(uint32_t x=0; x<r->width; x++, src+=4)
+    {
+        uint32_t a = src[3];
+        if(a == 0xff)
+        {
+            row[x] = 0xff000000 | (src[0] << 16) | (src[1] << 8) | src[2];
+        }
+        else
+        {
+            row[x] = (a << 24) | (Div255(src[0]*a) << 16) | (Div255(src[1]*a) << 8) | Div255(src[2]*a);
+        }
+    }
+    return true;
+}
+
+void PNGClose(PNGREADER r)
+{
+    if(r->png)
+    {
+        png_destroy_read_struct(&r->png, r->info ? &r->info : nullptr, nullptr);
+    }
+    fclose(r->file);
+    free(r->row);
+    free(r->image);
+    free(r->rows);
+    free(r);
+}
+
+uint32_t *PNGLoadScaled(const char *filename, uint32_t maxWidth, uint32_t maxHeight,
+                        uint32_t *width, uint32_t *height)
+{
+    uint32_t w, h;
+    PNGREADER r = PNGOpen(filename, &w, &h);
+    if(!r)
+    {
+        return nullptr;
+    }
+
+    // размер результата
+    uint32_t tw = w, th = h;
+    if(w > maxWidth || h > maxHeight)
+    {
+        double s = (double) maxWidth/w < (double) maxHeight/h ? (double) maxWidth/w : (double) maxHeight/h;
+        tw = (uint32_t)(w*s + 0.5);
+        th = (uint32_t)(h*s + 0.5);
+        tw = tw < 1 ? 1 : tw > maxWidth ? maxWidth : tw;
+        th = th < 1 ? 1 : th > maxHeight ? maxHeight : th;
+    }
+
+    uint32_t *result = (uint32_t *) malloc((size_t) tw*th*4);
+    uint32_t *row = (uint32_t *) malloc((size_t) w*4);
+    uint32_t *col = (uint32_t *) malloc((size_t) w*4);          // столбец результата для каждого столбца исходной картинки
+    uint32_t *colCount = (uint32_t *) calloc(tw, 4);            // количество исходных столбцов в столбце результата
+    uint64_t *sum = (uint64_t *) calloc((size_t) tw*4, 8);      // суммы каналов для строки результата
+    if(!result || !row || !col || !colCount || !sum)
+    {
+        free(result);
+        result = nullptr;
+        goto done;
+    }
+
+    for(uint32_t x=0; x<w; x++)
+    {
+        col[x] = (uint64_t) x*tw/w;
+        ++colCount[col[x]];
+    }
+
+    // усреднение по площади: каждая точка результата - среднее покрываемых ею исходных точек
+    {
+        uint32_t ty = 0, rows = 0;
+        for(uint32_t y=0; y<h; y++)
+        {
+            if(!PNGReadRow(r, row))
+            {
+                free(result);
+                result = nullptr;
+                goto done;
+            }
+
+            for(uint32_t x=0; x<w; x++)
+            {
+                uint32_t p = row[x];
+                uint64_t *s = sum + col[x]*4;
+                s[0] += p >> 24;
+                s[1] += (p >> 16) & 0xff;
+                s[2] += (p >> 8) & 0xff;
+                s[3] += p & 0xff;
+            }
+            ++rows;
+
+            // строка результата набрана
+            if(y+1 == h || (uint64_t)(y+1)*th/h != ty)
+            {
+                uint32_t *out = result + (size_t) ty*tw;
+                for(uint32_t x=0; x<tw; x++)
+                {
+                    uint64_t *s = sum + x*4;
+                    uint64_t n = (uint64_t) colCount[x]*rows;
+                    out[x] = (uint32_t)((s[0] + n/2)/n) << 24 | (uint32_t)((s[1] + n/2)/n) << 16
+                           | (uint32_t)((s[2] + n/2)/n) << 8 | (uint32_t)((s[3] + n/2)/n);
+                    s[0] = s[1] = s[2] = s[3] = 0;
+                }
+                ++ty;
+                rows = 0;
+            }
+        }
+    }
+
+    *width = tw;
+    *height = th;
+
+done:
+    free(row);
+    free(col);
+    free(colCount);
+    free(sum);
+    PNGClose(r);
+    return result;
+}
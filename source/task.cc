@@ -0,0 +1,86 @@
+// task.cc
+
+#include <coroutine>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <functional>
+#include <memory>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "window.h"
+#include "mainloop.h"
+#include "threadpool.h"
+#include "task.h"
+
+TaskPromiseBase::TaskPromiseBase()
+{
+    m_pParent = nullptr;
+    m_bDetached = false;
+    m_bCancelled = false;
+}
+
+bool TaskPromiseBase::IsCancelled()
+{
+    for(TaskPromiseBase *p = this; p; p = p->m_pParent)
+    {
+        if(p->m_owner && *p->m_owner == nullptr)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskPromiseBase::Resume()
+{
+    if(!IsCancelled())
+    {
+        m_handle.resume();
+        return;
+    }
+
+    // окно уничтожено: уничтожаем всю цепочку, начиная с внешней сопрограммы;
+    // вложенные уничтожаются деструкторами ожидаемых ими объектов Task (см. ~Task)
+    TaskPromiseBase *root = this;
+    while(root->m_pParent)
+    {
+        root = root->m_pParent;
+    }
+    root->m_bCancelled = true;
+    if(root->m_bDetached)
+    {
+        root->m_handle.destroy();
+    }
+    // иначе цепочка уничтожится вместе с объектом Task внешней сопрограммы
+}
+
+void RunInPool(std::function<void()> job)
+{
+    ThreadPool::Get()->Submit(std::move(job));
+}
+
+bool ReadWholeFile(const std::string &filename, std::string &data)
+{
+    int file = open(filename.c_str(), O_RDONLY);
+    if(file < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(file, &st) == 0 && st.st_size > 0)
+    {
+        data.reserve(st.st_size);
+    }
+
+    char buffer[65536];
+    ssize_t n;
+    while((n = read(file, buffer, sizeof(buffer))) > 0)
+    {
+        data.append(buffer, n);
+    }
+    close(file);
+    return n == 0;
+}
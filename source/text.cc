@@ -2,8 +2,112 @@
 #include <cstdlib>
 #include <cassert>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 #include "window.h"
+#include "scroll.h"
+#include "threadpool.h"
 #include "text.h"
+#include "utf8.h"
+
+// ширина символов для разметки: частые - из таблицы, остальные запрашиваются у контекста
+// и запоминаются; у каждого задания разметки свой объект
+class Advances
+{
+public:
+    Advances(Context *cr, const float *table, const char *fontface, uint16_t fontsize, uint32_t style) :
+        m_cr(cr), m_table(table), m_fontFace(fontface), m_fontSize(fontsize), m_style(style) {}
+
+    float Get(uint32_t code)
+    {
+        if(code < TEXT_ADVANCE_TABLE)
+        {
+            return m_table[code];
+        }
+        auto it = m_other.find(code);
+        if(it != m_other.end())
+        {
+            return it->second;
+        }
+        float a;
+        m_cr->GetTextAdvances(m_fontFace, m_fontSize, m_style, &code, 1, &a);
+        m_other[code] = a;
+        return a;
+    }
+
+private:
+    Context     *m_cr;
+    const float *m_table;
+    const char  *m_fontFace;
+    uint16_t    m_fontSize;
+    uint32_t    m_style;
+    std::unordered_map<uint32_t, float> m_other;
+};
+
+// разметка абзаца, начинающегося в start: строки добавляются в lines, ширина самой длинной - в width;
+// возврат - начало следующего абзаца; limit == 0 - без переноса
+static uint32_t LayoutParagraph(const char *text, uint32_t start, uint32_t end, float limit,
+    Advances &adv, std::vector<TEXTLINE> &lines, float &width)
+{
+    const char *nl = (const char *) memchr(text+start, '\n', end-start);
+    uint32_t stop = nl ? nl-text : end;
+
+    uint32_t lineStart = start;
+    float x = 0;
+    if(limit == 0)
+    {
+        for(uint32_t pos=start; pos<stop; )
+        {
+            uint8_t s;
+            uint32_t code = UTF8Decode(text+pos, &s);
+            x += adv.Get(code == '\t' ? ' ' : code);
+            pos += s;
+        }
+    }
+    else
+    {
+        for(uint32_t pos=start; pos<stop; )
+        {
+            uint8_t s;
+            uint32_t code = UTF8Decode(text+pos, &s);
+            float a = adv.Get(code == '\t' ? ' ' : code);
+            if(pos > lineStart && x + a > limit)
+            {
+                // выход за предел длины строки: символ переходит на новую строку
+                lines.push_back(TEXTLINE{lineStart, pos-lineStart});
+                width = max(width, x);
+                lineStart = pos;
+                x = 0;
+            }
+            x += a;
+            pos += s;
+        }
+    }
+    lines.push_back(TEXTLINE{lineStart, stop-lineStart});
+    width = max(width, x);
+    return stop+1;
+}
+
+// разметка целых абзацев из [start, end); возврат - ширина самой длинной строки
+static float LayoutText(const char *text, uint32_t start, uint32_t end, float limit,
+    Advances &adv, std::vector<TEXTLINE> &lines)
+{
+    float width = 0;
+    while(start < end)
+    {
+        start = LayoutParagraph(text, start, end, limit, adv, lines, width);
+    }
+    return width;
+}
+
+// результат разметки в пуле: строки частей текста по порядку
+struct TEXTLAYOUT
+{
+    std::vector<std::vector<TEXTLINE>> parts;
+    float width;
+};
 
 Text::Text(const char *text)
 {
@@ -14,20 +118,43 @@ Text::Text(const char *text)
 
     m_text = nullptr;
     m_textSize = 0;
+    m_bufferSize = 0;
+    m_laidOut = 0;
+    m_bTextIsReady = false;
+    m_nlines = m_maxlines = 0;
+    m_lines = nullptr;
+    m_line = nullptr;
+    m_lineSize = 0;
+    m_textWidth = 0;
+    m_nLayout = 0;
+    m_bPartial = false;
+    m_anchor = 0;
+    m_partialY = 0;
+    m_bToEnd = false;
+    m_scrollTo = TEXT_NONE;
+    m_highlights = nullptr;
+    m_nHighlights = m_maxHighlights = 0;
+    m_currentHighlight = TEXT_NONE;
+    m_highlightColor = RGB(1.0, 1.0, 0.0);
+    m_currentColor = RGB(1.0, 0.6, 0.0);
+    m_pVBar = nullptr;
+    m_top = 0;
+    m_left = 0;
+    m_dx = m_dy = 0;
     if(text)
     {
         SetText(text);
     }
     m_style = TEXT_ALIGNH_LEFT|TEXT_ALIGNV_TOP;
     m_bWrap = false;
-    m_nlines = 0;
-    m_lines = nullptr;
 }
 
 Text::~Text()
 {
-    free(m_text);
-    ClearLines();
+    CancelLayout();
+    free(m_lines);
+    free(m_line);
+    free(m_highlights);
 }
 
 RGB  Text::GetTextColor()
@@ -79,6 +206,8 @@ void Text::SetFont(const char *FontFace, const int16_t FontSize, const int16_t b
     {
         m_style = (m_style & ~TEXT_STYLE_ITALIC) | (italic & TEXT_STYLE_ITALIC);
     }
+    m_advances = nullptr;
+    m_bTextIsReady = false;
 }
 
 uint8_t Text::GetAlignment()
@@ -116,27 +245,150 @@ void Text::SetWrap(bool bWrap)
     m_bTextIsReady = false;
 }
 
+// своя прокрутка по строкам: шкала создается вместе с окном и уничтожается как дочернее окно
+void Text::SetLineScroll(bool bLineScroll)
+{
+    if(bLineScroll && !m_pVBar)
+    {
+        m_pVBar = new VerticalScrollBar;
+    }
+}
+
+void Text::OnCreate()
+{
+    if(m_pVBar)
+    {
+        Rect is = GetInteriorSize();
+        AddChild(m_pVBar, Point(is.GetWidth()-SCROLLBAR_SIZE,0), Rect(SCROLLBAR_SIZE,is.GetHeight()));
+        m_pVBar->SetTotal(0);
+        m_pVBar->SetDataOrigin(0);
+    }
+}
 
+uint32_t Text::GetVisibleRows()
+{
+    return max(GetInteriorSize().GetHeight()/max(m_ls, 1), 1);
+}
 
-bool Text::SetText(const char *text)
+void Text::SetTop(int64_t top)
+{
+    int64_t maxTop = (int64_t) m_nlines - GetVisibleRows();
+    top = min(top, maxTop);
+    m_top = max(top, 0);
+    m_pVBar->SetDataOrigin(min((uint64_t) m_top*m_ls, INT32_MAX));
+}
+
+void Text::OnNotify(Window *child, uint32_t type, const Point &position)
+{
+    if(child == m_pVBar && type == EVENT_SCROLLING)
+    {
+        m_top = m_pVBar->GetDataOrigin()/max(m_ls, 1);
+        ReDraw();
+    }
+}
+
+// при своей прокрутке - по целым строкам (остаток накапливается) и по горизонтали;
+// иначе прокручивает родитель
+bool Text::OnScroll(uint64_t value)
 {
-    if(!CheckUTF8(text))
+    if(!m_pVBar)
     {
         return false;
     }
 
-    m_textSize = strlen(text);
-    if(m_text == nullptr)
+    SCROLLINFO si = (SCROLLINFO) value;
+    switch(si->direction)
     {
-        m_text = (char *) malloc(m_textSize+1);
+    case _SCROLLINFO::SCROLL_LEFT:
+        m_dx -= SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_RIGHT:
+        m_dx += SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_UP:
+        m_dy -= SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_DOWN:
+        m_dy += SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_SMOOTH:
+        m_dx -= si->dx;
+        m_dy -= si->dy;
+        break;
+    default:
+        return true;
     }
-    else
+
+    uint16_t ls = max(m_ls, 1);
+    int32_t nRows = (int32_t)(m_dy/ls);
+    int32_t nPixels = (int32_t) m_dx;
+    if(nRows || nPixels)
     {
-        m_text = (char *) realloc(m_text, m_textSize+1);
+        m_dy -= nRows*ls;
+        m_dx -= nPixels;
+        SetTop((int64_t) m_top + nRows);
+        int32_t maxLeft = (int32_t) m_BackgroundSize.GetWidth() - (GetInteriorSize().GetWidth()-SCROLLBAR_SIZE);
+        m_left = max(min((int32_t) m_left + nPixels, maxLeft), 0);
+        ReDraw();
     }
+    if(si->stop)
+    {
+        m_dx = m_dy = 0;
+    }
+    return true;
+}
+
+
+
+bool Text::SetText(const char *text)
+{
+    // проверка по 32 или 16 байтов (см. utf8.h)
+    size_t length = strlen(text);
+    if(!UTF8Validate(text, length))
+    {
+        return false;
+    }
+
+    // прежний буфер освобождается, когда закончится его разметка в пуле
+    m_textSize = length;
+    m_text = (char *) malloc(m_textSize+1);
     assert(m_text);
-    strcpy(m_text, text);
+    memcpy(m_text, text, m_textSize+1);
+    m_buffer.reset(m_text, free);
+    m_bufferSize = m_textSize+1;
+    ClearLines();
+    ClearHighlights();
+    m_bPartial = false;
     m_bTextIsReady = false;
+    CancelLayout();                     // разметка прежнего текста в пуле больше не нужна
+    return true;
+}
+
+// дописывание в конец: прежний текст не копируется, пока хватает буфера
+bool Text::AppendText(const char *text, uint32_t length)
+{
+    if(!UTF8Validate(text, length))
+    {
+        return false;
+    }
+
+    if(m_textSize + length + 1 > m_bufferSize)
+    {
+        // новый буфер вдвое больше; прежний освобождается, когда закончится его разметка в пуле
+        m_bufferSize = max(2*m_bufferSize, m_textSize + length + 1);
+        char *buf = (char *) malloc(m_bufferSize);
+        assert(buf);
+        if(m_textSize)
+        {
+            memcpy(buf, m_text, m_textSize);
+        }
+        m_text = buf;
+        m_buffer.reset(m_text, free);
+    }
+    // разметка в пуле читает только текст до прежнего конца: дописывать в тот же буфер можно
+    memcpy(m_text+m_textSize, text, length);
+    m_textSize += length;
+    m_text[m_textSize] = 0;
     return true;
 }
 
@@ -145,11 +397,49 @@ char *Text::GetText()
     return m_text;
 }
 
+void Text::ScrollToEnd()
+{
+    m_bToEnd = true;
+}
+
+void Text::ScrollToOffset(uint32_t offset)
+{
+    m_scrollTo = offset;
+}
+
+void Text::AddHighlights(const TEXTRANGE *ranges, uint32_t n)
+{
+    if(m_nHighlights + n > m_maxHighlights)
+    {
+        m_maxHighlights = max(2*m_maxHighlights, max(m_nHighlights + n, 64));
+        m_highlights = (TEXTRANGE *) realloc(m_highlights, m_maxHighlights*sizeof(TEXTRANGE));
+        assert(m_highlights);
+    }
+    memcpy(m_highlights+m_nHighlights, ranges, n*sizeof(TEXTRANGE));
+    m_nHighlights += n;
+}
+
+void Text::ClearHighlights()
+{
+    m_nHighlights = 0;
+    m_currentHighlight = TEXT_NONE;
+}
+
+void Text::SetCurrentHighlight(uint32_t index)
+{
+    m_currentHighlight = index;
+}
+
 void Text::OnDraw(Context *cr)
 {
     cr->GetFontInfo(m_fontFace, m_fontSize, m_style, &m_ascent, &m_descent, &m_ls, &m_adv);
 
     Point ws = GetInteriorSize();
+    if(m_pVBar)
+    {
+        // справа - своя шкала прокрутки
+        ws.SetX(ws.GetX() > SCROLLBAR_SIZE ? ws.GetX()-SCROLLBAR_SIZE : 0);
+    }
 
     uint16_t limit = m_bWrap ? ws.GetX() - 2*GetGap() : 0;
     if(!m_bTextIsReady)
@@ -157,10 +447,28 @@ void Text::OnDraw(Context *cr)
         PrepareLines(cr, limit);
         m_bTextIsReady = true;
     }
+    else if(!m_bPartial && m_laidOut < m_textSize)
+    {
+        AppendLines(cr, limit);
+    }
 
-    // фон
+    // фон; при частичной разметке размер данных еще прежний
     cr->SetColor(m_backColor);
-    cr->FillRectangle(Point(0,0), m_BackgroundSize);
+    if(m_pVBar)
+    {
+        // своя прокрутка: по горизонтали текст сдвигается на m_left
+        cr->Save();
+        cr->SetOrigin(Point(m_left,0));
+        cr->FillRectangle(Point(m_left,0), ws);
+    }
+    else
+    {
+        cr->FillRectangle(Point(0,0), m_BackgroundSize);
+        if(m_bPartial)
+        {
+            cr->FillRectangle(Point(GetOrigin().GetX(), m_partialY), ws);
+        }
+    }
 
     // положение базовой точки в окне текста зависит от требуемого выравнивания
     int16_t startX=0;
@@ -191,172 +499,396 @@ void Text::OnDraw(Context *cr)
         break;
     }
 
-    // текст
+    // текст: выводятся только строки, видимые в окне (с запасом в строку);
+    // координаты 16-битные, строки ниже UINT16_MAX не выводятся
     cr->SetColor(m_textColor);
-    uint16_t advance, width = 0;
-    for(uint16_t i=0; i<m_nlines; i++)
+    uint32_t first = 0, last = m_nlines, top = 0;
+    if(m_bPartial)
+    {
+        // частично размеченный текст показывается с верха окна
+        startY = m_partialY;
+    }
+    else if(m_pVBar)
     {
-        cr->Text(m_lines[i], m_fontFace, m_fontSize, Point(startX, startY+m_ls*i), m_style, &advance);
-        width = max(width, advance);
+        // своя прокрутка: строки от первой видимой, последняя может быть видна частично
+        first = top = m_top;
+        last = min(m_nlines, m_top + GetVisibleRows() + 1);
+    }
+    else if(m_ls > 0)
+    {
+        int64_t top = (int64_t) GetOrigin().GetY() - startY;
+        first = top > m_ls ? top/m_ls - 1 : 0;
+        last = min((int64_t) m_nlines, max(top + ws.GetY(), 0)/m_ls + 2);
+    }
+    uint32_t highlight = 0;
+    if(first < last && m_nHighlights > 0)
+    {
+        // первый отрезок, кончающийся после начала первой видимой строки
+        uint32_t lo = m_lines[first].offset;
+        highlight = std::lower_bound(m_highlights, m_highlights+m_nHighlights, lo,
+            [](const TEXTRANGE &r, uint32_t offset) { return r.offset + r.length <= offset; }) - m_highlights;
+    }
+    for(uint32_t i=first; i<last; i++)
+    {
+        int64_t y = startY + (int64_t) m_ls*(i-top);
+        if(y > UINT16_MAX)
+        {
+            break;
+        }
+        DrawHighlights(cr, i, startX, y, highlight);
+        const char *line = GetLine(m_lines[i].offset, m_lines[i].length);
+        cr->Text(line, m_fontFace, m_fontSize, Point(startX, y), m_style);
+    }
+    if(m_pVBar)
+    {
+        cr->Restore();
     }
 
-    ComputeDataRect(width, limit);
+    if(!m_bPartial)
+    {
+        ComputeDataRect(m_textWidth, limit);
+        if(m_bToEnd || m_scrollTo != TEXT_NONE)
+        {
+            ScrollToTarget(cr, ws, startX);
+        }
+    }
 }
 
-void Text::OnSizeChanged()
+static uint16_t GetAdvance(Context *cr, const char *text, const char *fontface, uint16_t fontsize, uint32_t style)
 {
-    m_bTextIsReady = false;
+    uint16_t temp, advance;
+    cr->GetTextInfo(text, fontface, fontsize, style, &temp, &temp, &advance);
+    return advance;
 }
 
-uint8_t Text::GetUnicodeSymbolSize(uint8_t firstbyte)
+// фон подсвеченных отрезков строки line, выводимой в (x, y); first - первый отрезок, который
+// может пересекаться со строкой, продвигается от строки к строке
+void Text::DrawHighlights(Context *cr, uint32_t line, int16_t x, int64_t y, uint32_t &first)
 {
-    if((firstbyte & 0x80) == 0x00)
+    uint32_t lo = m_lines[line].offset, hi = lo + m_lines[line].length;
+    while(first < m_nHighlights && m_highlights[first].offset + m_highlights[first].length <= lo)
     {
-        // UTF-8: ASCII (8 bits)
-        return 1;
+        ++first;
     }
-    else if((firstbyte & 0xe0) == 0xc0)
+    if(first == m_nHighlights || m_highlights[first].offset >= hi)
     {
-        // UTF-8: 16 bits
-        return 2;
+        return;
     }
-    else if((firstbyte & 0xf0) == 0xe0)
+
+    // положение начала строки и ее верха зависит от выравнивания
+    if(!(m_style & TEXT_ALIGNH_LEFT))
     {
-        // UTF-8: 24 bits
-        return 3;
+        uint16_t w = GetAdvance(cr, GetLine(lo, hi-lo), m_fontFace, m_fontSize, m_style);
+        x -= m_style & TEXT_ALIGNH_RIGHT ? w : w/2;
     }
-    else if((firstbyte & 0xf8) == 0xf0)
+    if(m_style & TEXT_ALIGNV_CENTER)
     {
-        // UTF-8: 32 bits
-        return 4;
+        y -= m_ls/2;
     }
-    else
+    else if(m_style & TEXT_ALIGNV_BOTTOM)
+    {
+        y -= m_ls;
+    }
+
+    for(uint32_t k=first; k<m_nHighlights && m_highlights[k].offset < hi; k++)
     {
-        // не должно быть
-        assert(0);
-        return 0;
+        uint32_t from = max(m_highlights[k].offset, lo);
+        uint32_t to = min(m_highlights[k].offset + m_highlights[k].length, hi);
+        uint16_t x0 = GetAdvance(cr, GetLine(lo, from-lo), m_fontFace, m_fontSize, m_style);
+        uint16_t x1 = GetAdvance(cr, GetLine(lo, to-lo), m_fontFace, m_fontSize, m_style);
+        cr->SetColor(k == m_currentHighlight ? m_currentColor : m_highlightColor);
+        cr->FillRectangle(Point(max(x + x0, 0), max(y, 0)), Rect(x1-x0, m_ls));
     }
+    cr->SetColor(m_textColor);
 }
 
-bool Text::CheckUTF8(const char *s)
+// после разметки: окно показывает конец текста или строку со смещением m_scrollTo;
+// родитель (Scroll) ограничит положение и обновит шкалы прокрутки, при своей прокрутке - SetTop
+void Text::ScrollToTarget(Context *cr, const Point &ws, int16_t startX)
 {
-    while(*s)
+    uint16_t x = m_pVBar ? m_left : GetOrigin().GetX(), y = GetOrigin().GetY();
+    if(m_bToEnd)
     {
-        uint8_t l = GetUnicodeSymbolSize(s[0]);
-        if(l==0)
+        uint16_t h = m_BackgroundSize.GetHeight();
+        y = h > ws.GetY() ? h - ws.GetY() : 0;
+        if(m_pVBar)
         {
-            return false;
+            SetTop(m_nlines);
         }
-        for(uint8_t i=1; i<l; i++)
+    }
+    else if(m_nlines > 0)
+    {
+        // невидимая строка показывается на трети высоты окна, так же по горизонтали
+        uint32_t i = FindLine(m_scrollTo);
+        uint32_t lo = m_lines[i].offset;
+        uint64_t ly = (uint64_t) i*m_ls;
+        if(m_pVBar)
         {
-            if((s[i]&0xc0) != 0x80)
+            uint32_t rows = GetVisibleRows();
+            if(i < m_top || i >= m_top + rows)
             {
-                return false;
+                SetTop((int64_t) i - rows/3);
             }
         }
-        s+=l;
+        else if(ly < y || ly + m_ls > y + ws.GetY())
+        {
+            y = min(ly > ws.GetY()/3u ? ly - ws.GetY()/3u : 0, UINT16_MAX);
+        }
+        uint32_t to = min(m_scrollTo, lo + m_lines[i].length);
+        uint16_t lx = max(startX + GetAdvance(cr, GetLine(lo, to-lo), m_fontFace, m_fontSize, m_style), 0);
+        if(lx < x || lx >= x + ws.GetX())
+        {
+            x = lx > ws.GetX()/3 ? lx - ws.GetX()/3 : 0;
+        }
     }
-    return true;
+    m_bToEnd = false;
+    m_scrollTo = TEXT_NONE;
+    if(m_pVBar)
+    {
+        m_left = x;
+        ReDraw();
+        return;
+    }
+    SetOrigin(Point(x, y));
+    GetParent()->OnDataRectChanged(this, m_BackgroundSize);
+}
+
+void Text::OnSizeChanged()
+{
+    if(m_pVBar)
+    {
+        Rect is = GetInteriorSize();
+        m_pVBar->SetSize(Rect(SCROLLBAR_SIZE,is.GetHeight()));
+        m_pVBar->SetPosition(Point(is.GetWidth()-SCROLLBAR_SIZE,0));
+    }
+    m_bTextIsReady = false;
 }
 
 // подготовка текста: разбиение по строкам
+// строки не копируются: запоминаются их смещения и длины в m_text
 void Text::PrepareLines(Context *cr, uint16_t limit)
 {
+    // первый видимый абзац после разметки остается вверху окна
+    uint16_t top = m_pVBar ? 0 : GetOrigin().GetY();
+    uint32_t topLine = m_pVBar ? m_top : top/max(m_ls, 1);
+    uint32_t anchor = 0;
+    if(m_bPartial)
+    {
+        anchor = m_anchor;
+    }
+    else if(m_ls > 0 && topLine < m_nlines)
+    {
+        anchor = m_lines[topLine].offset;
+        while(anchor > 0 && m_text[anchor-1] != '\n')
+        {
+            --anchor;
+        }
+    }
+
     ClearLines();
-    char tmp[m_textSize+1];             // рабочий буфер
-    uint32_t pos=0;                     // позиция в исходном тексте
-    uint16_t linepos=0;                 // позиция в очередной строке
-    uint16_t width=0;                   // ширина текста
+    m_bPartial = false;
+    m_laidOut = m_textSize;
+    CancelLayout();                     // разметка, начатая раньше, больше не нужна
+    uint32_t nLayout = m_nLayout;
 
     if( limit > 0 && limit < m_adv)
     {
         return;
     }
 
-    // память для первого элемента массива
-    m_lines = (char **) malloc(sizeof(char *));
-    m_nlines = 1;
+    PrepareAdvances(cr);
+    Advances adv(cr, m_advances.get(), m_fontFace, m_fontSize, m_style);
+    std::vector<TEXTLINE> lines;
+    if(m_textSize <= TEXT_PARALLEL_SIZE)
+    {
+        m_textWidth = min(LayoutText(m_text, 0, m_textSize, limit, adv, lines), (float) UINT16_MAX);
+        AddLines(lines.data(), lines.size());
+        ComputeDataRect(m_textWidth, limit);
+        return;
+    }
 
-    // по одному исследуем символы текста
-    while(pos < m_textSize)
+    // большой текст: сразу размечаются только абзацы, видимые в окне
+    uint32_t rows = GetInteriorSize().GetHeight()/max(m_ls, 1) + 1;
+    float width = 0;
+    for(uint32_t pos=anchor; pos<m_textSize && lines.size()<rows; )
     {
-        if(m_text[pos] == '\t')
-        {
-            // заменяем символ табуляции на пробел
-            tmp[linepos] = ' ';
-            ++pos;
-            ++linepos;
-        }
-        else if(m_text[pos] == '\n')
+        pos = LayoutParagraph(m_text, pos, m_textSize, limit, adv, lines, width);
+    }
+    AddLines(lines.data(), min((uint32_t) lines.size(), rows));
+    m_bPartial = true;
+    m_anchor = anchor;
+    m_partialY = top;
+
+    // весь текст - в пуле потоков частями из целых абзацев, у каждой части своя таблица ширины
+    std::shared_ptr<char> buffer = m_buffer;
+    std::shared_ptr<float> table = m_advances;
+    std::string face(m_fontFace);
+    uint16_t size = m_fontSize;
+    uint32_t style = m_style, textSize = m_textSize;
+    std::shared_ptr<TEXTLAYOUT> result = std::make_shared<TEXTLAYOUT>();
+    std::shared_ptr<std::atomic<bool>> stop = m_stop = std::make_shared<std::atomic<bool>>(false);
+    RunInBackground([cr, buffer, table, face, size, style, textSize, limit, result, stop]()
         {
-            // очередная строка закончена
-            tmp[linepos] = 0;
-
-            // память для нее и копируем
-            m_lines[m_nlines-1] = (char *) malloc(linepos+1);
-            strcpy(m_lines[m_nlines-1], tmp);
-
-            // увеличим массив
-            ++m_nlines;
-            m_lines = (char **) realloc(m_lines, m_nlines*sizeof(char *));
+            const char *text = buffer.get();
+            std::vector<uint32_t> bounds(1, 0);
+            while(bounds.back() < textSize)
+            {
+                // часть заканчивается после перевода строки
+                uint32_t b = bounds.back() + TEXT_LAYOUT_CHUNK;
+                const char *nl = b < textSize ? (const char *) memchr(text+b, '\n', textSize-b) : nullptr;
+                bounds.push_back(nl ? nl-text+1 : textSize);
+            }
 
-            ++pos;
-            linepos = 0;
-        }
-        else
+            uint32_t n = bounds.size()-1;
+            std::vector<float> widths(n);
+            result->parts.resize(n);
+            ThreadPool::Get()->ParallelFor(n, [&](uint32_t i)
+            {
+                // отмененная разметка (новый текст, размер, шрифт, окно уничтожено) не продолжается
+                if(*stop)
+                {
+                    return;
+                }
+                Advances adv(cr, table.get(), face.c_str(), size, style);
+                widths[i] = LayoutText(text, bounds[i], bounds[i+1], limit, adv, result->parts[i]);
+            });
+            result->width = *std::max_element(widths.begin(), widths.end());
+        },
+        [this, nLayout, limit, textSize, result]()
         {
-            // копируем очередной символ текста
-            uint16_t s = GetUnicodeSymbolSize(m_text[pos]);
-            for(uint16_t i=0; i<s; i++)
+            if(nLayout != m_nLayout)
             {
-                tmp[linepos++] = m_text[pos++];
+                return;
             }
+            m_stop = nullptr;
 
-            // узнаем текущий размер строки
-            tmp[linepos] = 0;
-            uint16_t temp, advance;
-            cr->GetTextInfo(tmp, m_fontFace, m_fontSize, m_style, &temp, &temp, &advance);
-            if(limit == 0)
+            ClearLines();
+            for(const std::vector<TEXTLINE> &part : result->parts)
+            {
+                AddLines(part.data(), part.size());
+            }
+            m_textWidth = min(result->width, (float) UINT16_MAX);
+            m_bPartial = false;
+            m_laidOut = textSize;       // дописанное за время разметки размечается при отрисовке
+
+            // первый видимый абзац - вверху окна
+            const TEXTLINE *line = std::lower_bound(m_lines, m_lines+m_nlines, m_anchor,
+                [](const TEXTLINE &l, uint32_t offset) { return l.offset < offset; });
+            if(m_pVBar)
             {
-                width = max(width, advance);
+                ComputeDataRect(m_textWidth, limit);
+                SetTop(line-m_lines);
             }
-            else if(advance > limit)
+            else
             {
-                // выход за предел длины строки: надо убрать последний символ и перейти к новой строке
-                pos -= s;
-                linepos -= s;
+                uint64_t y = (uint64_t) (line-m_lines)*m_ls;
+                SetOrigin(Point(GetOrigin().GetX(), min(y, UINT16_MAX)));
+                ComputeDataRect(m_textWidth, limit);
+            }
+            ReDraw();
+        });
+}
 
-                // очередная строка закончена
-                tmp[linepos] = 0;
+// отмена разметки в пуле: ее результат отбрасывается, а необработанные части не размечаются
+void Text::CancelLayout()
+{
+    ++m_nLayout;
+    if(m_stop)
+    {
+        *m_stop = true;
+        m_stop = nullptr;
+    }
+}
 
-                // память для нее и копируем
-                m_lines[m_nlines-1] = (char *) malloc(linepos+1);
-                strcpy(m_lines[m_nlines-1], tmp);
+// разметка текста, дописанного после m_laidOut: последний размеченный абзац мог быть
+// не закончен, поэтому его строки размечаются заново; остальные строки не меняются
+void Text::AppendLines(Context *cr, uint16_t limit)
+{
+    // окно у конца текста остается у конца
+    uint16_t wsHeight = GetInteriorSize().GetHeight();
+    if(m_pVBar ? m_top + GetVisibleRows() >= m_nlines : GetOrigin().GetY() + wsHeight >= m_BackgroundSize.GetHeight())
+    {
+        m_bToEnd = true;
+    }
 
-                // увеличим массив
-                ++m_nlines;
-                m_lines = (char **) realloc(m_lines, m_nlines*sizeof(char *));
+    uint32_t start = m_laidOut;
+    while(start > 0 && m_text[start-1] != '\n')
+    {
+        --start;
+    }
+    while(m_nlines > 0 && m_lines[m_nlines-1].offset >= start)
+    {
+        --m_nlines;
+    }
+    m_laidOut = m_textSize;
 
-                linepos = 0;
-            }
+    if(limit > 0 && limit < m_adv)
+    {
+        return;
+    }
+    PrepareAdvances(cr);
+    Advances adv(cr, m_advances.get(), m_fontFace, m_fontSize, m_style);
+    std::vector<TEXTLINE> lines;
+    float width = LayoutText(m_text, start, m_textSize, limit, adv, lines);
+    AddLines(lines.data(), lines.size());
+    m_textWidth = max(m_textWidth, min(width, (float) UINT16_MAX));
+}
+
+// таблица ширины символов общая для всех окон с тем же шрифтом; только из главного потока
+void Text::PrepareAdvances(Context *cr)
+{
+    static std::unordered_map<std::string, std::shared_ptr<float>> tables;
+
+    if(m_advances)
+    {
+        return;
+    }
+    std::string key = std::string(m_fontFace) + '/' + std::to_string(m_fontSize) + '/' +
+        std::to_string(m_style & (TEXT_STYLE_BOLD|TEXT_STYLE_ITALIC));
+    std::shared_ptr<float> &table = tables[key];
+    if(!table)
+    {
+        uint32_t codes[TEXT_ADVANCE_TABLE];
+        for(uint32_t i=0; i<TEXT_ADVANCE_TABLE; i++)
+        {
+            codes[i] = i;
         }
+        float *advances = (float *) malloc(TEXT_ADVANCE_TABLE*sizeof(float));
+        assert(advances);
+        cr->GetTextAdvances(m_fontFace, m_fontSize, m_style, codes, TEXT_ADVANCE_TABLE, advances);
+        table.reset(advances, free);
     }
+    m_advances = table;
+}
 
-    if(linepos > 0)
+void Text::AddLines(const TEXTLINE *lines, uint32_t n)
+{
+    if(m_nlines + n > m_maxlines)
     {
-        // последняя строка
-        tmp[linepos] = 0;
+        m_maxlines = max(2*m_maxlines, max(m_nlines + n, 64));
+        m_lines = (TEXTLINE *) realloc(m_lines, m_maxlines*sizeof(TEXTLINE));
+        assert(m_lines);
+    }
+    memcpy(m_lines+m_nlines, lines, n*sizeof(TEXTLINE));
+    m_nlines += n;
+}
 
-        // память для нее и копируем
-        m_lines[m_nlines-1] = (char *) malloc(linepos+1);
-        strcpy(m_lines[m_nlines-1], tmp);
+// строка для вывода в буфере m_line: табуляция заменяется пробелом
+const char *Text::GetLine(uint32_t offset, uint32_t length)
+{
+    if(length+1 > m_lineSize)
+    {
+        m_lineSize = length+1;
+        m_line = (char *) realloc(m_line, m_lineSize);
+        assert(m_line);
     }
-    else
+    const char *src = m_text+offset;
+    for(uint32_t i=0; i<length; i++)
     {
-        --m_nlines;
+        m_line[i] = src[i] == '\t' ? ' ' : src[i];
     }
-
-    ComputeDataRect(width, limit);
+    m_line[length] = 0;
+    return m_line;
 }
 
 // вычисление размера данных
@@ -366,9 +898,17 @@ void Text::ComputeDataRect(const uint16_t width, const uint16_t limit)
     uint16_t w, h;
     Rect s = GetInteriorSize();
 
+    if(m_pVBar)
+    {
+        // по вертикали прокручивает своя шкала: данные по высоте окна
+        s.SetWidth(s.GetWidth() > SCROLLBAR_SIZE ? s.GetWidth()-SCROLLBAR_SIZE : 0);
+        m_pVBar->SetTotal(min((uint64_t) m_nlines*m_ls, INT32_MAX));
+        SetTop(m_top);
+    }
+
     w = (limit == 0 ? width : limit) + 2*GetGap();
     w = max(s.GetWidth(), w);
-    h = m_nlines*m_ls;
+    h = m_pVBar ? 0 : min((uint32_t) m_nlines*m_ls, UINT16_MAX);
     h = max(s.GetHeight(), h);
 
     bool bNotify = (w != m_BackgroundSize.GetWidth()) || (h != m_BackgroundSize.GetHeight());
@@ -382,15 +922,17 @@ void Text::ComputeDataRect(const uint16_t width, const uint16_t limit)
 }
 
 
+uint32_t Text::FindLine(uint32_t offset)
+{
+    const TEXTLINE *line = std::upper_bound(m_lines, m_lines+m_nlines, offset,
+        [](uint32_t offset, const TEXTLINE &l) { return offset < l.offset; });
+    return line > m_lines ? line-m_lines-1 : 0;
+}
+
+// массив строк остается для следующего разбиения
 void Text::ClearLines()
 {
-    for(uint16_t i=0; i<m_nlines; i++)
-    {
-        free(m_lines[i]);
-    }
-    free(m_lines);
     m_nlines = 0;
-    m_lines = nullptr;
 }
 
 Rect    &Text::GetDataRect()
@@ -0,0 +1,860 @@
+// class TextEdit
+
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <algorithm>
+#include "window.h"
+#include "scroll.h"
+#include "utf8.h"
+#include "textedit.h"
+
+#define ORIGINAL    0       // исходный текст
+#define ADDED       1       // добавочный буфер: все введенное, только дописывается
+
+// кусок документа - отрезок одного из буферов
+typedef struct _PIECE
+{
+    uint32_t start;
+    uint32_t length;
+    uint32_t lines;         // переводов строки в куске
+    uint8_t  buffer;        // ORIGINAL, ADDED
+} PIECE;
+
+// отменяемая правка: отрезок [position, position+length) заменяется кусками pieces;
+// после выполнения запись превращается в обратную правку
+typedef struct _EDITRECORD
+{
+    uint32_t position;
+    uint32_t length;
+    std::vector<PIECE> pieces;
+} EDITRECORD;
+
+struct TextEditData
+{
+    char     *buffers[2];
+    uint32_t sizes[2];
+    uint32_t addedMax;
+    std::vector<uint32_t> newlines[2];  // смещения переводов строки в буферах (начала строк), по возрастанию
+    std::vector<PIECE>    pieces;
+    std::vector<uint32_t> ends;         // конец куска в документе
+    std::vector<uint32_t> lines;        // переводов строки в документе до конца куска
+    uint32_t valid;                     // ends и lines верны для кусков до valid
+    std::vector<EDITRECORD> undo, redo;
+
+    TextEditData();
+    ~TextEditData();
+
+    PIECE    MakePiece(uint8_t buffer, uint32_t start, uint32_t length);
+    void     Update();
+    uint32_t Size();
+    uint32_t Lines();
+    uint32_t Find(uint32_t position);
+    uint32_t Split(uint32_t position);
+    std::vector<PIECE> Extract(uint32_t position, uint32_t length);
+    void     InsertPieces(uint32_t position, const std::vector<PIECE> &inserted);
+    void     Apply(EDITRECORD &r);
+    uint32_t Append(const char *s, uint32_t length);
+    uint32_t Read(uint32_t position, uint32_t length, char *buf);
+    uint32_t LineStart(uint32_t line);
+    uint32_t LineOf(uint32_t position);
+};
+
+TextEditData::TextEditData()
+{
+    buffers[ORIGINAL] = buffers[ADDED] = nullptr;
+    sizes[ORIGINAL] = sizes[ADDED] = 0;
+    addedMax = 0;
+    valid = 0;
+}
+
+TextEditData::~TextEditData()
+{
+    free(buffers[ORIGINAL]);
+    free(buffers[ADDED]);
+}
+
+PIECE TextEditData::MakePiece(uint8_t buffer, uint32_t start, uint32_t length)
+{
+    const std::vector<uint32_t> &nl = newlines[buffer];
+    PIECE p;
+    p.start = start;
+    p.length = length;
+    p.lines = std::lower_bound(nl.begin(), nl.end(), start+length) - std::lower_bound(nl.begin(), nl.end(), start);
+    p.buffer = buffer;
+    return p;
+}
+
+// пересчет накопленных значений после правки - только для кусков за ней
+void TextEditData::Update()
+{
+    uint32_t n = pieces.size();
+    ends.resize(n);
+    lines.resize(n);
+    for(uint32_t i=valid; i<n; i++)
+    {
+        ends[i] = (i ? ends[i-1] : 0) + pieces[i].length;
+        lines[i] = (i ? lines[i-1] : 0) + pieces[i].lines;
+    }
+    valid = n;
+}
+
+uint32_t TextEditData::Size()
+{
+    Update();
+    return ends.empty() ? 0 : ends.back();
+}
+
+uint32_t TextEditData::Lines()
+{
+    Update();
+    return lines.empty() ? 0 : lines.back();
+}
+
+// кусок, содержащий position; pieces.size() - конец текста
+uint32_t TextEditData::Find(uint32_t position)
+{
+    Update();
+    return std::upper_bound(ends.begin(), ends.end(), position) - ends.begin();
+}
+
+// граница кусков в position; возврат - номер куска, начинающегося в position
+uint32_t TextEditData::Split(uint32_t position)
+{
+    uint32_t i = Find(position);
+    if(i == pieces.size())
+    {
+        return i;
+    }
+    uint32_t k = position - (i ? ends[i-1] : 0);
+    if(k == 0)
+    {
+        return i;
+    }
+    PIECE p = pieces[i];
+    pieces[i] = MakePiece(p.buffer, p.start, k);
+    pieces.insert(pieces.begin()+i+1, MakePiece(p.buffer, p.start+k, p.length-k));
+    valid = min(valid, i);
+    return i+1;
+}
+
+std::vector<PIECE> TextEditData::Extract(uint32_t position, uint32_t length)
+{
+    std::vector<PIECE> removed;
+    if(length == 0)
+    {
+        return removed;
+    }
+    uint32_t i = Split(position);
+    uint32_t j = Split(position+length);
+    removed.assign(pieces.begin()+i, pieces.begin()+j);
+    pieces.erase(pieces.begin()+i, pieces.begin()+j);
+    valid = min(valid, i);
+    return removed;
+}
+
+void TextEditData::InsertPieces(uint32_t position, const std::vector<PIECE> &inserted)
+{
+    if(inserted.empty())
+    {
+        return;
+    }
+    uint32_t i = Split(position);
+    pieces.insert(pieces.begin()+i, inserted.begin(), inserted.end());
+    valid = min(valid, i);
+}
+
+void TextEditData::Apply(EDITRECORD &r)
+{
+    std::vector<PIECE> removed = Extract(r.position, r.length);
+    uint32_t length = 0;
+    for(const PIECE &p : r.pieces)
+    {
+        length += p.length;
+    }
+    InsertPieces(r.position, r.pieces);
+    r.length = length;
+    r.pieces = std::move(removed);
+}
+
+// возврат - смещение дописанного в добавочном буфере
+uint32_t TextEditData::Append(const char *s, uint32_t length)
+{
+    uint32_t offset = sizes[ADDED];
+    if(offset + length > addedMax)
+    {
+        addedMax = max(2*addedMax, offset + length + 4096);
+        buffers[ADDED] = (char *) realloc(buffers[ADDED], addedMax);
+        assert(buffers[ADDED]);
+    }
+    memcpy(buffers[ADDED]+offset, s, length);
+    for(uint32_t i=0; i<length; i++)
+    {
+        if(s[i] == '\n')
+        {
+            newlines[ADDED].push_back(offset+i);
+        }
+    }
+    sizes[ADDED] += length;
+    return offset;
+}
+
+uint32_t TextEditData::Read(uint32_t position, uint32_t length, char *buf)
+{
+    uint32_t i = Find(position), copied = 0;
+    uint32_t k = i < pieces.size() ? position - (i ? ends[i-1] : 0) : 0;
+    for(; i<pieces.size() && copied<length; i++, k=0)
+    {
+        const PIECE &p = pieces[i];
+        uint32_t n = min(length - copied, p.length - k);
+        memcpy(buf+copied, buffers[p.buffer]+p.start+k, n);
+        copied += n;
+    }
+    return copied;
+}
+
+// начало строки line: после line-го перевода строки
+uint32_t TextEditData::LineStart(uint32_t line)
+{
+    if(line == 0)
+    {
+        return 0;
+    }
+    Update();
+    uint32_t i = std::lower_bound(lines.begin(), lines.end(), line) - lines.begin();
+    if(i == pieces.size())
+    {
+        return Size();
+    }
+    const PIECE &p = pieces[i];
+    const std::vector<uint32_t> &nl = newlines[p.buffer];
+    uint32_t k = line - (i ? lines[i-1] : 0);
+    uint32_t offset = *(std::lower_bound(nl.begin(), nl.end(), p.start) + k-1);
+    return (i ? ends[i-1] : 0) + offset - p.start + 1;
+}
+
+uint32_t TextEditData::LineOf(uint32_t position)
+{
+    uint32_t i = Find(position);
+    if(i == pieces.size())
+    {
+        return Lines();
+    }
+    const PIECE &p = pieces[i];
+    uint32_t k = position - (i ? ends[i-1] : 0);
+    return (i ? lines[i-1] : 0) + MakePiece(p.buffer, p.start, k).lines;
+}
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TextEdit::TextEdit()
+{
+    m_ClassName = __FUNCTION__;
+    SetBackColor(RGB(1.0, 1.0, 1.0));
+    m_pData = new TextEditData;
+    m_pointer = 0;
+    m_column = 0;
+    m_top = 0;
+    m_left = 0;
+    m_dy = 0;
+    m_rowHeight = 18;
+    m_bModified = false;
+    m_bCoalesce = false;
+    m_bFocus = false;
+    m_Pointer = 0;
+    m_bStoredClick = false;
+    m_line = nullptr;
+    m_lineSize = 0;
+    m_textColor = RGB(0.0, 0.0, 0.0);
+    m_pointerColor = RGB(1.0, 0.0, 0.0);
+    m_fontSize = 12;
+    strcpy(m_fontFace,"Cantarel");
+    m_pVBar = new VerticalScrollBar;
+}
+
+TextEdit::~TextEdit()
+{
+    delete m_pData;
+    free(m_line);
+}
+
+bool TextEdit::SetText(const char *text, uint32_t length)
+{
+    if(!UTF8Validate(text, length))
+    {
+        return false;
+    }
+
+    TextEditData *d = new TextEditData;
+    d->buffers[ORIGINAL] = (char *) malloc(length+1);
+    assert(d->buffers[ORIGINAL]);
+    memcpy(d->buffers[ORIGINAL], text, length);
+    d->sizes[ORIGINAL] = length;
+    for(const char *p = text; (p = (const char *) memchr(p, '\n', text+length-p)); p++)
+    {
+        d->newlines[ORIGINAL].push_back(p-text);
+    }
+    if(length > 0)
+    {
+        d->pieces.push_back(d->MakePiece(ORIGINAL, 0, length));
+    }
+    delete m_pData;
+    m_pData = d;
+
+    m_pointer = 0;
+    m_column = 0;
+    m_left = 0;
+    m_bModified = false;
+    m_bCoalesce = false;
+    m_pVBar->SetTotal(GetLineCount()*m_rowHeight);
+    SetTop(0);
+    ReDraw();
+    return true;
+}
+
+uint32_t TextEdit::GetTextSize()
+{
+    return m_pData->Size();
+}
+
+uint32_t TextEdit::GetText(uint32_t position, uint32_t length, char *buf)
+{
+    return m_pData->Read(position, length, buf);
+}
+
+uint32_t TextEdit::GetLineCount()
+{
+    return m_pData->Lines()+1;
+}
+
+void TextEdit::SetFont(const char *FontFace, const int16_t FontSize)
+{
+    if(FontFace)
+    {
+        assert(strlen(FontFace)<=TEXTEDIT_FONTFACE_SIZE);
+        strcpy(m_fontFace,FontFace);
+    }
+    if(FontSize >= 0)
+    {
+        m_fontSize = FontSize;
+    }
+}
+
+// вставка в положении указателя
+void TextEdit::Insert(const char *s, uint32_t length)
+{
+    TextEditData &d = *m_pData;
+    d.redo.clear();
+    uint32_t offset = d.Append(s, length);
+
+    // набор подряд удлиняет тот же кусок добавочного буфера
+    uint32_t i = d.Split(m_pointer);
+    if(i > 0 && d.pieces[i-1].buffer == ADDED && d.pieces[i-1].start + d.pieces[i-1].length == offset)
+    {
+        PIECE &p = d.pieces[i-1];
+        p = d.MakePiece(ADDED, p.start, p.length+length);
+        d.valid = min(d.valid, i-1);
+    }
+    else
+    {
+        d.InsertPieces(m_pointer, std::vector<PIECE>(1, d.MakePiece(ADDED, offset, length)));
+    }
+
+    // и ту же отменяемую правку; перевод строки ее заканчивает
+    if(m_bCoalesce && !d.undo.empty() && d.undo.back().pieces.empty() &&
+        d.undo.back().position + d.undo.back().length == m_pointer)
+    {
+        d.undo.back().length += length;
+    }
+    else
+    {
+        d.undo.push_back(EDITRECORD{m_pointer, length, {}});
+    }
+    m_pointer += length;
+    m_bCoalesce = s[length-1] != '\n';
+}
+
+void TextEdit::Delete(uint32_t position, uint32_t length, bool bBackward)
+{
+    TextEditData &d = *m_pData;
+    d.redo.clear();
+    std::vector<PIECE> removed = d.Extract(position, length);
+
+    // удаление подряд (Backspace или Delete) - одна отменяемая правка
+    EDITRECORD *r = m_bCoalesce && !d.undo.empty() && d.undo.back().length == 0 ? &d.undo.back() : nullptr;
+    if(r && bBackward && r->position == position+length)
+    {
+        r->pieces.insert(r->pieces.begin(), removed.begin(), removed.end());
+        r->position = position;
+    }
+    else if(r && !bBackward && r->position == position)
+    {
+        r->pieces.insert(r->pieces.end(), removed.begin(), removed.end());
+    }
+    else
+    {
+        d.undo.push_back(EDITRECORD{position, 0, std::move(removed)});
+    }
+    m_pointer = position;
+    m_bCoalesce = true;
+}
+
+bool TextEdit::Undo()
+{
+    TextEditData &d = *m_pData;
+    if(d.undo.empty())
+    {
+        return false;
+    }
+    EDITRECORD r = std::move(d.undo.back());
+    d.undo.pop_back();
+    d.Apply(r);
+    m_pointer = r.position + r.length;
+    d.redo.push_back(std::move(r));
+    m_bCoalesce = false;
+    Changed();
+    return true;
+}
+
+bool TextEdit::Redo()
+{
+    TextEditData &d = *m_pData;
+    if(d.redo.empty())
+    {
+        return false;
+    }
+    EDITRECORD r = std::move(d.redo.back());
+    d.redo.pop_back();
+    d.Apply(r);
+    m_pointer = r.position + r.length;
+    d.undo.push_back(std::move(r));
+    m_bCoalesce = false;
+    Changed();
+    return true;
+}
+
+// после правки: прокрутка к указателю, оповещение родителя
+void TextEdit::Changed()
+{
+    m_bModified = true;
+    m_column = GetColumn(m_pointer);
+    m_pVBar->SetTotal(GetLineCount()*m_rowHeight);
+    ScrollToPointer();
+    m_Pointer = 2;
+    ReDraw();
+    NotifyParent(EVENT_TEXTEDIT_CHANGED, Point(0,0));
+}
+
+uint32_t TextEdit::GetLineStart(uint32_t line)
+{
+    return m_pData->LineStart(line);
+}
+
+uint32_t TextEdit::GetLineEnd(uint32_t line)
+{
+    return line+1 < GetLineCount() ? m_pData->LineStart(line+1)-1 : m_pData->Size();
+}
+
+uint32_t TextEdit::GetLineOf(uint32_t position)
+{
+    return m_pData->LineOf(position);
+}
+
+uint32_t TextEdit::NextSymbol(uint32_t position)
+{
+    char c;
+    if(m_pData->Read(position, 1, &c) == 0)
+    {
+        return position;
+    }
+    return position + max(UTF8SymbolSize(c), 1);
+}
+
+uint32_t TextEdit::PrevSymbol(uint32_t position)
+{
+    // символ занимает не больше 4 байтов: ищем его первый байт
+    char s[4];
+    uint32_t from = position >= 4 ? position-4 : 0;
+    uint32_t n = m_pData->Read(from, position-from, s);
+    while(n > 0 && (s[n-1] & 0xc0) == 0x80)
+    {
+        --n;
+    }
+    return n > 0 ? from+n-1 : from;
+}
+
+uint32_t TextEdit::GetColumn(uint32_t position)
+{
+    uint32_t start = GetLineStart(GetLineOf(position));
+    return UTF8Count(GetLine(GetLineOf(position), position), position-start);
+}
+
+uint32_t TextEdit::GetPosition(uint32_t line, uint32_t column)
+{
+    uint32_t start = GetLineStart(line), end = GetLineEnd(line);
+    return start + UTF8Offset(GetLine(line, end), end-start, column);
+}
+
+// строка line до положения end в буфере m_line: табуляция заменяется пробелом
+const char *TextEdit::GetLine(uint32_t line, uint32_t end)
+{
+    uint32_t start = GetLineStart(line);
+    uint32_t length = end > start ? end-start : 0;
+    if(length+1 > m_lineSize)
+    {
+        m_lineSize = length+1;
+        m_line = (char *) realloc(m_line, m_lineSize);
+        assert(m_line);
+    }
+    length = m_pData->Read(start, length, m_line);
+    for(uint32_t i=0; i<length; i++)
+    {
+        if(m_line[i] == '\t')
+        {
+            m_line[i] = ' ';
+        }
+    }
+    m_line[length] = 0;
+    return m_line;
+}
+
+uint32_t TextEdit::GetVisibleRows()
+{
+    return max(GetInteriorSize().GetHeight()/m_rowHeight, 1);
+}
+
+void TextEdit::SetTop(int64_t top)
+{
+    int64_t maxTop = (int64_t) GetLineCount() - GetVisibleRows();
+    top = min(top, maxTop);
+    m_top = max(top, 0);
+    m_pVBar->SetDataOrigin(m_top*m_rowHeight);
+}
+
+void TextEdit::ScrollToPointer()
+{
+    uint32_t line = GetLineOf(m_pointer);
+    uint32_t nVisible = GetVisibleRows();
+    if(line < m_top)
+    {
+        SetTop(line);
+    }
+    else if(line >= m_top + nVisible)
+    {
+        SetTop((int64_t) line - nVisible + 1);
+    }
+}
+
+void TextEdit::OnCreate()
+{
+    Rect is = GetInteriorSize();
+    AddChild(m_pVBar, Point(is.GetWidth()-SCROLLBAR_SIZE,0), Rect(SCROLLBAR_SIZE,is.GetHeight()));
+    m_pVBar->SetTotal(GetLineCount()*m_rowHeight);
+    m_pVBar->SetDataOrigin(0);
+}
+
+void TextEdit::OnSizeChanged()
+{
+    Rect is = GetInteriorSize();
+    m_pVBar->SetSize(Rect(SCROLLBAR_SIZE,is.GetHeight()));
+    m_pVBar->SetPosition(Point(is.GetWidth()-SCROLLBAR_SIZE,0));
+    SetTop(m_top);
+}
+
+static uint16_t GetAdvance(Context *cr, const char *text, const char *fontface, uint16_t fontsize)
+{
+    uint16_t temp, advance;
+    cr->GetTextInfo(text, fontface, fontsize, 0, &temp, &temp, &advance);
+    return advance;
+}
+
+void TextEdit::OnDraw(Context *cr)
+{
+    Rect is = GetInteriorSize();
+    uint16_t w = is.GetWidth() > SCROLLBAR_SIZE ? is.GetWidth()-SCROLLBAR_SIZE : 0;
+
+    cr->SetColor(m_backColor);
+    cr->FillRectangle(Point(0,0), Rect(w,is.GetHeight()));
+
+    int16_t ascent, descent;
+    uint16_t ls, adv;
+    cr->GetFontInfo(m_fontFace, m_fontSize, 0, &ascent, &descent, &ls, &adv);
+    if(ls > 0 && ls != m_rowHeight)
+    {
+        m_rowHeight = ls;
+        m_pVBar->SetTotal(GetLineCount()*m_rowHeight);
+        SetTop(m_top);
+    }
+    uint16_t gap = adv/5;
+
+    if(m_bStoredClick)
+    {
+        // строка - по высоте, символ - по ширине начала строки (двоичный поиск)
+        uint32_t line = min(m_top + m_StoredClick.GetY()/m_rowHeight, GetLineCount()-1);
+        uint32_t start = GetLineStart(line), length = GetLineEnd(line)-start;
+        int32_t x = m_StoredClick.GetX() + m_left - gap;
+        GetLine(line, start+length);
+        uint32_t lo = 0, hi = UTF8Count(m_line, length);
+        auto prefix = [&](uint32_t n)
+        {
+            uint32_t b = UTF8Offset(m_line, length, n);
+            char c = m_line[b];
+            m_line[b] = 0;
+            uint16_t a = GetAdvance(cr, m_line, m_fontFace, m_fontSize);
+            m_line[b] = c;
+            return (int32_t) a;
+        };
+        uint32_t n = hi;
+        while(lo < hi)
+        {
+            uint32_t mid = (lo+hi+1)/2;
+            if(prefix(mid) <= x)
+            {
+                lo = mid;
+            }
+            else
+            {
+                hi = mid-1;
+            }
+        }
+        // ближайшая к щелчку граница символов
+        if(lo < n && x - prefix(lo) > prefix(lo+1) - x)
+        {
+            ++lo;
+        }
+        m_pointer = start + UTF8Offset(m_line, length, lo);
+        m_column = lo;
+        m_bCoalesce = false;
+        m_bStoredClick = false;
+    }
+
+    // по горизонтали окно следует за указателем
+    uint32_t pointerLine = GetLineOf(m_pointer);
+    uint16_t px = GetAdvance(cr, GetLine(pointerLine, m_pointer), m_fontFace, m_fontSize);
+    uint16_t tw = w > 2*gap ? w-2*gap : 0;
+    if(px < m_left)
+    {
+        m_left = px;
+    }
+    else if(px > m_left + tw)
+    {
+        m_left = px - tw;
+    }
+
+    cr->Save();
+    cr->SetOrigin(Point(m_left,0));
+
+    // строки, попадающие в окно (последняя может быть видна частично)
+    cr->SetColor(m_textColor);
+    uint32_t nVisible = (is.GetHeight() + m_rowHeight-1)/m_rowHeight;
+    uint32_t last = min(GetLineCount(), m_top + nVisible);
+    for(uint32_t line=m_top; line<last; line++)
+    {
+        uint16_t y = (line - m_top)*m_rowHeight;
+        cr->Text(GetLine(line, GetLineEnd(line)), m_fontFace, m_fontSize, Point(gap, y + m_rowHeight/2),
+            TEXT_ALIGNH_LEFT|TEXT_ALIGNV_CENTER);
+    }
+
+    // мигающий указатель
+    if(m_bFocus && m_Pointer > 0 && pointerLine >= m_top && pointerLine < last)
+    {
+        uint16_t y = (pointerLine - m_top)*m_rowHeight;
+        cr->SetColor(m_pointerColor);
+        cr->SetLineWidth(1);
+        cr->Line(Point(gap+px, y + (m_rowHeight-(ascent+descent))/2), Point(gap+px, y + (m_rowHeight+ascent+descent)/2));
+    }
+    cr->Restore();
+}
+
+void TextEdit::OnNotify(Window *child, uint32_t type, const Point &position)
+{
+    if(child == m_pVBar && type == EVENT_SCROLLING)
+    {
+        m_top = m_pVBar->GetDataOrigin()/m_rowHeight;
+        ReDraw();
+    }
+}
+
+bool TextEdit::OnLeftMouseButtonClick(const Point &position)
+{
+    CaptureKeyboard(this);
+    m_StoredClick = position;
+    m_bStoredClick = true;
+    m_Pointer = 2;
+    ReDraw();
+    return true;
+}
+
+bool TextEdit::OnKeyPress(uint64_t value)
+{
+    uint32_t line = GetLineOf(m_pointer);
+    uint32_t nVisible = GetVisibleRows();
+    switch(value)
+    {
+    case KEY_Backspace:
+        if(m_pointer > 0)
+        {
+            Delete(PrevSymbol(m_pointer), m_pointer - PrevSymbol(m_pointer), true);
+            Changed();
+        }
+        return true;
+    case KEY_Delete:
+        if(m_pointer < GetTextSize())
+        {
+            Delete(m_pointer, NextSymbol(m_pointer) - m_pointer, false);
+            Changed();
+        }
+        return true;
+    case KEY_Return:
+    case KEY_Linefeed:
+        Insert("\n", 1);
+        Changed();
+        return true;
+    case KEY_Tab:
+        Insert("\t", 1);
+        Changed();
+        return true;
+    case TEXTEDIT_KEY_UNDO:
+        Undo();
+        return true;
+    case TEXTEDIT_KEY_REDO:
+        Redo();
+        return true;
+    case KEY_Esc:
+        CaptureKeyboard(GetParent());
+        return true;
+
+    // перемещение указателя: вверх и вниз - в тот же столбец
+    case KEY_Left:
+        m_pointer = PrevSymbol(m_pointer);
+        m_column = GetColumn(m_pointer);
+        break;
+    case KEY_Right:
+        m_pointer = NextSymbol(m_pointer);
+        m_column = GetColumn(m_pointer);
+        break;
+    case KEY_Home:
+        m_pointer = GetLineStart(line);
+        m_column = 0;
+        break;
+    case KEY_End:
+        m_pointer = GetLineEnd(line);
+        m_column = GetColumn(m_pointer);
+        break;
+    case KEY_Up:
+        m_pointer = line > 0 ? GetPosition(line-1, m_column) : 0;
+        break;
+    case KEY_Down:
+        m_pointer = line+1 < GetLineCount() ? GetPosition(line+1, m_column) : GetTextSize();
+        break;
+    case KEY_PgUp:
+        SetTop((int64_t) m_top - nVisible);
+        m_pointer = GetPosition(line > nVisible ? line-nVisible : 0, m_column);
+        break;
+    case KEY_PgDn:
+        SetTop((int64_t) m_top + nVisible);
+        m_pointer = GetPosition(min(line+nVisible, GetLineCount()-1), m_column);
+        break;
+    default:
+        if(value >= ' ' && value < 1<<7)
+        {
+            char c = value;
+            Insert(&c, 1);
+            Changed();
+        }
+        else if(value >= 1<<8 && value < ((uint64_t)1)<<32)
+        {
+            // символ UTF-8: байты от старшего к младшему
+            char s[4];
+            uint8_t n = value < 1<<16 ? 2 : value < 1<<24 ? 3 : 4;
+            for(uint8_t i=0; i<n; i++)
+            {
+                s[i] = value >> 8*(n-1-i);
+            }
+            Insert(s, n);
+            Changed();
+        }
+        else if(value < ' ')
+        {
+            NotifyParent(EVENT_TEXTEDIT_KEY, Point(value,0));
+        }
+        return true;
+    }
+
+    m_bCoalesce = false;
+    m_Pointer = 2;
+    ScrollToPointer();
+    ReDraw();
+    return true;
+}
+
+bool TextEdit::OnKeyboardCapture(bool bCapture)
+{
+    bool bSave = m_bFocus;
+    m_bFocus = bCapture;
+    if(!bSave && m_bFocus)
+    {
+        // указатель надо показать
+        CreateTimeout(this, TEXTEDIT_POINTER_TIMEOUT);
+        m_Pointer = 1;
+    }
+    if(bSave != m_bFocus)
+    {
+        ReDraw();
+    }
+    return true;
+}
+
+bool TextEdit::OnTimeout()
+{
+    if(!m_bFocus)
+    {
+        // гасим указатель
+        m_Pointer = 0;
+    }
+    if(m_Pointer>0)
+    {
+        --m_Pointer;
+    }
+    else
+    {
+        m_Pointer = 1;
+    }
+    ReDraw();
+    return m_bFocus;
+}
+
+bool TextEdit::OnScroll(uint64_t value)
+{
+    SCROLLINFO si = (SCROLLINFO) value;
+
+    switch(si->direction)
+    {
+    case _SCROLLINFO::SCROLL_UP:
+        m_dy -= SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_DOWN:
+        m_dy += SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_SMOOTH:
+        m_dy -= si->dy;
+        break;
+    default:
+        return true;
+    }
+
+    // прокрутка по целым строкам, остаток накапливается
+    int32_t nRows = (int32_t)(m_dy/m_rowHeight);
+    if(nRows)
+    {
+        m_dy -= nRows*m_rowHeight;
+        SetTop((int64_t) m_top + nRows);
+        ReDraw();
+    }
+    if(si->stop)
+    {
+        m_dy = 0;
+    }
+    return true;
+}
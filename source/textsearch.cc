@@ -0,0 +1,79 @@
+// textsearch.cc
+
+#include <cstring>
+#include <cstdint>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "textsearch.h"
+
+const char *SearchText(const char *text, size_t length, const char *pattern, size_t patternLength)
+{
+    if(patternLength == 0)
+    {
+        return text;
+    }
+    if(patternLength > length)
+    {
+        return nullptr;
+    }
+    if(patternLength == 1)
+    {
+        return (const char *) memchr(text, pattern[0], length);
+    }
+
+    size_t nStarts = length - patternLength + 1;    // возможных начал
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // начала i..i+15: последний прочитанный байт - text[i+15+patternLength-1]
+    const __m128i first = _mm_set1_epi8(pattern[0]);
+    const __m128i last = _mm_set1_epi8(pattern[patternLength-1]);
+    for(; i+16 <= nStarts; i+=16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(text + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(text + i + patternLength-1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while(mask)
+        {
+            uint32_t bit = __builtin_ctz(mask);
+            if(!memcmp(text + i + bit + 1, pattern + 1, patternLength - 2))
+            {
+                return text + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // оставшиеся начала
+    for(; i<nStarts; i++)
+    {
+        if(text[i] == pattern[0] && text[i+patternLength-1] == pattern[patternLength-1]
+            && !memcmp(text + i + 1, pattern + 1, patternLength - 2))
+        {
+            return text + i;
+        }
+    }
+    return nullptr;
+}
+
+size_t CountByte(const char *text, size_t length, char c)
+{
+    size_t n = 0, i = 0;
+
+#ifdef __SSE2__
+    const __m128i v = _mm_set1_epi8(c);
+    for(; i+16 <= length; i+=16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(text + i));
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(a, v)));
+    }
+#endif
+
+    for(; i<length; i++)
+    {
+        n += text[i] == c;
+    }
+    return n;
+}
@@ -0,0 +1,213 @@
+// threadpool.cc
+
+#include <functional>
+#include <memory>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstdint>
+#include "threadpool.h"
+
+// очередь одного рабочего потока
+struct WorkerQueue
+{
+    std::mutex mutex;
+    std::deque<std::function<void()>> jobs;
+};
+
+struct ThreadPoolData
+{
+    WorkerQueue *queues;
+    std::thread *threads;
+    std::atomic<uint32_t> next;                 // очередь для следующего задания извне пула
+    std::mutex sleepMutex;                      // ожидание заданий
+    std::condition_variable wakeup;
+    int32_t pending;                            // количество еще не взятых заданий (под sleepMutex)
+    bool bStop;
+};
+
+// пул и номер рабочего потока, в котором выполняется код
+static thread_local ThreadPool *tl_pPool = nullptr;
+static thread_local uint16_t tl_nWorker = 0;
+
+ThreadPool::ThreadPool(uint16_t nThreads)
+{
+    if(nThreads == 0)
+    {
+        const char *env = getenv("GUI_THREADS");
+        nThreads = env && atoi(env) > 0 ? atoi(env) : std::thread::hardware_concurrency();
+        nThreads = nThreads > 0 ? nThreads : 2;
+    }
+
+    m_nThreads = nThreads;
+    m_pData = new ThreadPoolData;
+    m_pData->queues = new WorkerQueue[m_nThreads];
+    m_pData->next = 0;
+    m_pData->pending = 0;
+    m_pData->bStop = false;
+
+    m_pData->threads = new std::thread[m_nThreads];
+    for(uint16_t i=0; i<m_nThreads; i++)
+    {
+        m_pData->threads[i] = std::thread(&ThreadPool::WorkerThread, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_pData->sleepMutex);
+        m_pData->bStop = true;
+    }
+    m_pData->wakeup.notify_all();
+
+    for(uint16_t i=0; i<m_nThreads; i++)
+    {
+        m_pData->threads[i].join();
+    }
+
+    delete [] m_pData->threads;
+    delete [] m_pData->queues;
+    delete m_pData;
+}
+
+ThreadPool *ThreadPool::Get()
+{
+    static ThreadPool pool;
+    return &pool;
+}
+
+bool ThreadPool::IsWorkerThread() const
+{
+    return tl_pPool == this;
+}
+
+void ThreadPool::Submit(std::function<void()> job)
+{
+    // из рабочего потока - в его собственную очередь, иначе - по кругу
+    uint16_t n = IsWorkerThread() ? tl_nWorker : m_pData->next.fetch_add(1, std::memory_order_relaxed) % m_nThreads;
+
+    {
+        std::lock_guard<std::mutex> lock(m_pData->queues[n].mutex);
+        m_pData->queues[n].jobs.push_back(std::move(job));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_pData->sleepMutex);
+        ++m_pData->pending;
+    }
+    m_pData->wakeup.notify_one();
+}
+
+// части ParallelFor
+struct ParallelJob
+{
+    std::function<void(uint32_t)> fn;
+    uint32_t n;
+    std::atomic<uint32_t> next;                 // следующая незанятая часть
+    std::atomic<uint32_t> done;                 // выполнено частей
+    std::mutex mutex;
+    std::condition_variable cv;
+};
+
+// части выполняет тот, кто успел их занять; задания, начатые после того, как заняты все части,
+// сразу завершаются - поэтому вызывающий поток не ждет очереди пула, и вызов возможен из рабочего потока
+static void RunParts(ParallelJob *job)
+{
+    for(;;)
+    {
+        uint32_t i = job->next.fetch_add(1);
+        if(i >= job->n)
+        {
+            break;
+        }
+        job->fn(i);
+        if(job->done.fetch_add(1) + 1 == job->n)
+        {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            job->cv.notify_all();
+        }
+    }
+}
+
+void ThreadPool::ParallelFor(uint32_t n, std::function<void(uint32_t)> fn)
+{
+    if(n == 0)
+    {
+        return;
+    }
+
+    std::shared_ptr<ParallelJob> job = std::make_shared<ParallelJob>();
+    job->fn = std::move(fn);
+    job->n = n;
+    job->next = 0;
+    job->done = 0;
+
+    uint32_t nHelpers = (n < m_nThreads ? n : m_nThreads) - 1;
+    for(uint32_t i=0; i<nHelpers; i++)
+    {
+        Submit([job]() { RunParts(job.get()); });
+    }
+    RunParts(job.get());
+
+    std::unique_lock<std::mutex> lock(job->mutex);
+    job->cv.wait(lock, [&job]() { return job->done == job->n; });
+}
+
+// взять задание: сначала последнее из своей очереди, затем первое из чужих
+bool ThreadPool::GetJob(uint16_t n, std::function<void()> &job)
+{
+    for(uint16_t i=0; i<m_nThreads; i++)
+    {
+        uint16_t k = (n+i) % m_nThreads;
+        WorkerQueue &q = m_pData->queues[k];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if(!q.jobs.empty())
+        {
+            if(k == n)
+            {
+                job = std::move(q.jobs.back());
+                q.jobs.pop_back();
+            }
+            else
+            {
+                job = std::move(q.jobs.front());
+                q.jobs.pop_front();
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerThread(uint16_t n)
+{
+    tl_pPool = this;
+    tl_nWorker = n;
+
+    std::function<void()> job;
+    while(true)
+    {
+        if(GetJob(n, job))
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_pData->sleepMutex);
+                --m_pData->pending;
+            }
+            job();
+            job = nullptr;
+            continue;
+        }
+
+        // заданий нет - ждем
+        std::unique_lock<std::mutex> lock(m_pData->sleepMutex);
+        m_pData->wakeup.wait(lock, [this] { return m_pData->pending > 0 || m_pData->bStop; });
+        if(m_pData->bStop && m_pData->pending <= 0)
+        {
+            break;
+        }
+    }
+}
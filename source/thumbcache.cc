@@ -0,0 +1,375 @@
+// thumbcache.cc
+
+#include <mutex>
+#include <unordered_map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cinttypes>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include "thumbcache.h"
+
+#define THUMB_MAGIC         "GUI3THM2"  // заголовок файла индекса
+#define THUMB_MAGIC_SIZE    8
+#define THUMB_HEADER_SIZE   16          // заголовок и поколение пакета (uint64_t)
+#define THUMB_MAX_MB        256         // наибольший размер пакета по умолчанию
+
+// запись индекса; индекс - заголовок и записи подряд, новые записи дописываются в конец
+typedef struct _THUMBENTRY
+{
+    uint64_t pathHash;
+    int64_t  mtime;         // время изменения файла, нс
+    uint64_t size;          // размер файла
+    uint64_t pathOffset;    // путь к файлу в пакете
+    uint64_t offset;        // точки образца в пакете (с начала страницы)
+    uint32_t width, height;
+    uint16_t maxWidth, maxHeight;
+    uint32_t pathLength;
+} THUMBENTRY;
+
+static std::mutex s_mutex;
+static bool       s_bInit = false;
+static bool       s_bEnabled = false;
+static int        s_index = -1, s_pack = -1;
+static uint64_t   s_generation;             // поколение открытого пакета
+static off_t      s_indexLoaded;            // прочитанная часть индекса
+static uint64_t   s_maxPack;
+static long       s_page;
+static char       s_dir[PATH_MAX];
+static std::unordered_map<uint64_t, THUMBENTRY> s_entries;
+
+static uint64_t HashPath(const char *path)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;     // FNV-1a
+    for(; *path; path++)
+    {
+        h = (h ^ (uint8_t) *path) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t Key(uint64_t pathHash, uint16_t maxWidth, uint16_t maxHeight)
+{
+    return pathHash ^ (((uint64_t) maxWidth << 16 | maxHeight) * 0x9e3779b97f4a7c15ULL);
+}
+
+static void PackName(char *name, uint64_t generation)
+{
+    snprintf(name, PATH_MAX, "%s/thumbs.%" PRIu64 ".pack", s_dir, generation);
+}
+
+// открытие пакета заданного поколения; прочитанный индекс к нему не относится
+static bool OpenPack(uint64_t generation, int flags)
+{
+    char name[PATH_MAX];
+    PackName(name, generation);
+    int pack = open(name, O_RDWR|O_CREAT|O_CLOEXEC|flags, 0644);
+    if(pack < 0)
+    {
+        return false;
+    }
+    if(s_pack >= 0)
+    {
+        close(s_pack);
+    }
+    s_pack = pack;
+    s_generation = generation;
+    s_entries.clear();
+    s_indexLoaded = THUMB_HEADER_SIZE;
+    return true;
+}
+
+// очистка кэша; вызывается под исключительной блокировкой индекса. Индекс усекается до заголовка
+// с новым поколением, вместо пакета создается новый файл. Индекс остается тем же файлом, поэтому
+// другие процессы видят очистку при следующем обращении; прежний пакет удаляется, но уже
+// отображенные из него образцы остаются действительными
+static bool Reset()
+{
+    char name[PATH_MAX];
+    PackName(name, s_generation);
+    uint64_t generation = s_generation + 1;
+    if(!OpenPack(generation, O_TRUNC))
+    {
+        return false;
+    }
+    unlink(name);
+
+    char header[THUMB_HEADER_SIZE];
+    memcpy(header, THUMB_MAGIC, THUMB_MAGIC_SIZE);
+    memcpy(header+THUMB_MAGIC_SIZE, &generation, sizeof(generation));
+    return ftruncate(s_index, 0) == 0 && write(s_index, header, THUMB_HEADER_SIZE) == THUMB_HEADER_SIZE;
+}
+
+// дочитывание записей, добавленных в индекс (в том числе другими процессами)
+static void LoadIndex()
+{
+    struct stat st;
+    if(fstat(s_index, &st) != 0)
+    {
+        return;
+    }
+
+    THUMBENTRY entries[256];
+    while(s_indexLoaded + (off_t) sizeof(THUMBENTRY) <= st.st_size)
+    {
+        ssize_t n = pread(s_index, entries, sizeof(entries), s_indexLoaded);
+        n /= sizeof(THUMBENTRY);
+        if(n <= 0)
+        {
+            break;
+        }
+        for(ssize_t i=0; i<n; i++)
+        {
+            s_entries[Key(entries[i].pathHash, entries[i].maxWidth, entries[i].maxHeight)] = entries[i];
+        }
+        s_indexLoaded += n*sizeof(THUMBENTRY);
+    }
+}
+
+// переход на пакет, указанный в индексе (если кэш очистил другой процесс), и дочитывание индекса;
+// вызывается под блокировкой индекса
+static bool Sync()
+{
+    uint64_t generation;
+    if(pread(s_index, &generation, sizeof(generation), THUMB_MAGIC_SIZE) != sizeof(generation))
+    {
+        return false;
+    }
+    if((generation != s_generation || s_pack < 0) && !OpenPack(generation, 0))
+    {
+        return false;
+    }
+    LoadIndex();
+    return true;
+}
+
+// открытие кэша при первом обращении; вызывается под s_mutex
+static bool Init()
+{
+    if(s_bInit)
+    {
+        return s_bEnabled;
+    }
+    s_bInit = true;
+
+    const char *env = getenv("GUI_THUMBCACHE");
+    if(env && !strcmp(env, "0"))
+    {
+        return false;
+    }
+    // GUI_THUMBCACHE_MAX=0 - размер не ограничен
+    env = getenv("GUI_THUMBCACHE_MAX");
+    s_maxPack = env ? strtoull(env, nullptr, 10) : THUMB_MAX_MB;
+    s_maxPack = s_maxPack ? s_maxPack << 20 : UINT64_MAX;
+    s_page = sysconf(_SC_PAGESIZE);
+
+    // каталог кэша
+    env = getenv("XDG_CACHE_HOME");
+    if(env && *env)
+    {
+        snprintf(s_dir, sizeof(s_dir), "%s", env);
+    }
+    else if((env = getenv("HOME")) != nullptr)
+    {
+        snprintf(s_dir, sizeof(s_dir), "%s/.cache", env);
+    }
+    else
+    {
+        return false;
+    }
+    mkdir(s_dir, 0755);
+    strncat(s_dir, "/gui3", sizeof(s_dir)-strlen(s_dir)-1);
+    mkdir(s_dir, 0755);
+
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s/thumbs.idx", s_dir);
+    s_index = open(name, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    if(s_index < 0)
+    {
+        fprintf(stderr, "Кэш миниатюр %s недоступен\n", s_dir);
+        return false;
+    }
+
+    // новый индекс или индекс другого формата - очищаем
+    char magic[THUMB_MAGIC_SIZE];
+    flock(s_index, LOCK_EX);
+    bool bValid = pread(s_index, magic, THUMB_MAGIC_SIZE, 0) == THUMB_MAGIC_SIZE && !memcmp(magic, THUMB_MAGIC, THUMB_MAGIC_SIZE);
+    bool bOpen = bValid ? Sync() : Reset();
+    if(!bValid)
+    {
+        snprintf(name, sizeof(name), "%s/thumbs.pack", s_dir);     // пакет прежнего формата
+        unlink(name);
+    }
+    flock(s_index, LOCK_UN);
+    if(!bOpen)
+    {
+        fprintf(stderr, "Кэш миниатюр %s недоступен\n", s_dir);
+        return false;
+    }
+
+    s_bEnabled = true;
+    return true;
+}
+
+bool ThumbCacheKey(const char *filename, THUMBKEY *key)
+{
+    struct stat st;
+    if(!realpath(filename, key->path) || stat(key->path, &st) != 0)
+    {
+        return false;
+    }
+    key->mtime = (int64_t) st.st_mtim.tv_sec*1000000000 + st.st_mtim.tv_nsec;
+    key->size = st.st_size;
+    return true;
+}
+
+// поиск образца; вызывается под s_mutex и блокировкой индекса
+static THUMB Lookup(const THUMBKEY *key, uint16_t maxWidth, uint16_t maxHeight)
+{
+    if(!Sync())
+    {
+        return nullptr;
+    }
+    uint64_t pathHash = HashPath(key->path);
+    auto it = s_entries.find(Key(pathHash, maxWidth, maxHeight));
+    if(it == s_entries.end())
+    {
+        return nullptr;
+    }
+
+    // файл изменился или запись относится к другому файлу
+    const THUMBENTRY &e = it->second;
+    if(e.pathHash != pathHash || e.mtime != key->mtime || e.size != key->size
+        || e.maxWidth != maxWidth || e.maxHeight != maxHeight || e.pathLength != strlen(key->path))
+    {
+        return nullptr;
+    }
+    char stored[PATH_MAX];
+    if(pread(s_pack, stored, e.pathLength, e.pathOffset) != (ssize_t) e.pathLength || memcmp(stored, key->path, e.pathLength))
+    {
+        return nullptr;
+    }
+
+    // отображение за пределами файла привело бы к SIGBUS
+    size_t mapSize = (size_t) e.width*e.height*4;
+    struct stat st;
+    if(fstat(s_pack, &st) != 0 || e.offset + mapSize > (uint64_t) st.st_size)
+    {
+        return nullptr;
+    }
+
+    // MAP_PRIVATE: запись в поверхность не попадет в пакет
+    void *map = mmap(nullptr, mapSize, PROT_READ|PROT_WRITE, MAP_PRIVATE, s_pack, e.offset);
+    if(map == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    THUMB thumb = (THUMB) malloc(sizeof(struct _THUMB));
+    thumb->pixels = (uint32_t *) map;
+    thumb->width = e.width;
+    thumb->height = e.height;
+    thumb->map = map;
+    thumb->mapSize = mapSize;
+    return thumb;
+}
+
+THUMB ThumbCacheLookup(const char *filename, uint16_t maxWidth, uint16_t maxHeight, THUMBKEY *key)
+{
+    if(!ThumbCacheKey(filename, key))
+    {
+        key->path[0] = 0;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if(!Init())
+    {
+        return nullptr;
+    }
+    // разделяемая блокировка: другой процесс не очистит кэш между чтением индекса и отображением
+    flock(s_index, LOCK_SH);
+    THUMB thumb = Lookup(key, maxWidth, maxHeight);
+    flock(s_index, LOCK_UN);
+    return thumb;
+}
+
+void ThumbCacheStore(const THUMBKEY *key, uint16_t maxWidth, uint16_t maxHeight,
+                     const uint32_t *pixels, uint32_t width, uint32_t height)
+{
+    if(!key->path[0])
+    {
+        return;
+    }
+    THUMBENTRY e;
+    memset(&e, 0, sizeof(e));
+    e.mtime = key->mtime;
+    e.size = key->size;
+    e.pathHash = HashPath(key->path);
+    e.pathLength = strlen(key->path);
+    e.width = width;
+    e.height = height;
+    e.maxWidth = maxWidth;
+    e.maxHeight = maxHeight;
+    size_t bytes = (size_t) width*height*4;
+
+    std::lock_guard<std::mutex> lock(s_mutex);
+    if(!Init())
+    {
+        return;
+    }
+
+    flock(s_index, LOCK_EX);
+
+    struct stat st;
+    if(!Sync() || fstat(s_pack, &st) != 0)
+    {
+        flock(s_index, LOCK_UN);
+        return;
+    }
+    if((uint64_t) st.st_size + bytes > s_maxPack)
+    {
+        // пакет переполнен - начинаем заново
+        if(!Reset())
+        {
+            s_bEnabled = false;
+            flock(s_index, LOCK_UN);
+            return;
+        }
+        st.st_size = 0;
+    }
+
+    e.pathOffset = st.st_size;
+    e.offset = (e.pathOffset + e.pathLength + s_page - 1) / s_page * s_page;
+
+    bool bWritten = pwrite(s_pack, key->path, e.pathLength, e.pathOffset) == (ssize_t) e.pathLength
+        && pwrite(s_pack, pixels, bytes, e.offset) == (ssize_t) bytes;
+
+    if(bWritten)
+    {
+        // недописанная при сбое запись сдвинула бы все последующие - отрезаем ее
+        struct stat is;
+        if(fstat(s_index, &is) == 0 && (is.st_size - THUMB_HEADER_SIZE) % sizeof(THUMBENTRY))
+        {
+            ftruncate(s_index, is.st_size - (is.st_size - THUMB_HEADER_SIZE) % sizeof(THUMBENTRY));
+        }
+        if(write(s_index, &e, sizeof(e)) == sizeof(e))
+        {
+            s_entries[Key(e.pathHash, maxWidth, maxHeight)] = e;
+        }
+    }
+
+    flock(s_index, LOCK_UN);
+}
+
+void ThumbCacheRelease(THUMB thumb)
+{
+    munmap(thumb->map, thumb->mapSize);
+    free(thumb);
+}
@@ -0,0 +1,621 @@
+// tiledimage.cc
+
+#include <string>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <fcntl.h>
+#include <unistd.h>
+#include "window.h"
+#include "mainloop.h"
+#include "pngread.h"
+#include "imagecache.h"
+#include "tiledimage.h"
+
+typedef struct _TILELEVEL
+{
+    uint32_t width, height;     // размер уровня, точки
+    uint32_t columns, rows;     // количество плиток
+    uint64_t first;             // номер первой плитки уровня
+} TILELEVEL;
+
+// плитки картинки; разделяются окном и заданиями пула потоков, которые могут пережить окно
+struct _TILEPYRAMID
+{
+    int       fd;               // временный файл плиток (удален из каталога сразу после создания)
+    uint8_t   nLevels;
+    TILELEVEL levels[TILE_LEVELS];
+    uint64_t  nTiles;
+
+    _TILEPYRAMID() : fd(-1), nLevels(0), nTiles(0) {}
+    ~_TILEPYRAMID()
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+    }
+};
+typedef struct _TILEPYRAMID TILEPYRAMID;
+
+// построение уровня: полоса из TILE_SIZE строк и строка, ожидающая пары для уменьшения
+typedef struct _LEVELBUILD
+{
+    uint32_t *band;
+    uint32_t *pending;
+    uint32_t *half;             // уменьшенная строка для следующего уровня
+    uint32_t bandRow;           // заполнено строк полосы
+    uint32_t bandIndex;         // номер полосы
+    uint32_t y;                 // получено строк
+    bool     bPending;
+} LEVELBUILD;
+
+// размер плитки (крайние плитки уровня меньше TILE_SIZE)
+static inline uint32_t TileWidth(const TILELEVEL &l, uint32_t column)
+{
+    return min((uint32_t) TILE_SIZE, l.width - column*TILE_SIZE);
+}
+
+static inline uint32_t TileHeight(const TILELEVEL &l, uint32_t row)
+{
+    return min((uint32_t) TILE_SIZE, l.height - row*TILE_SIZE);
+}
+
+// среднее четырех точек ARGB32: два канала за одно сложение
+static inline uint32_t Average4(uint32_t p, uint32_t q, uint32_t r, uint32_t s)
+{
+    uint32_t rb = (((p & 0x00ff00ff) + (q & 0x00ff00ff) + (r & 0x00ff00ff) + (s & 0x00ff00ff) + 0x00020002) >> 2) & 0x00ff00ff;
+    uint32_t ag = ((((p >> 8) & 0x00ff00ff) + ((q >> 8) & 0x00ff00ff) + ((r >> 8) & 0x00ff00ff) + ((s >> 8) & 0x00ff00ff) + 0x00020002) >> 2) & 0x00ff00ff;
+    return rb | (ag << 8);
+}
+
+// строка следующего уровня из двух строк; последний нечетный столбец усредняется сам с собой
+static void Halve(const uint32_t *a, const uint32_t *b, uint32_t width, uint32_t *out)
+{
+    for(uint32_t x=0; x<width; x+=2)
+    {
+        uint32_t x1 = x+1 < width ? x+1 : x;
+        *out++ = Average4(a[x], a[x1], b[x], b[x1]);
+    }
+}
+
+// запись полосы плиток уровня; строки плитки во временном файле идут подряд (шаг - ширина плитки)
+static bool FlushBand(TILEPYRAMID *p, uint8_t level, LEVELBUILD &lb, uint32_t *tile)
+{
+    const TILELEVEL &l = p->levels[level];
+    for(uint32_t c=0; c<l.columns; c++)
+    {
+        uint32_t tw = TileWidth(l, c);
+        for(uint32_t y=0; y<lb.bandRow; y++)
+        {
+            memcpy(tile + (size_t) y*tw, lb.band + (size_t) y*l.width + c*TILE_SIZE, tw*4);
+        }
+        size_t bytes = (size_t) tw*lb.bandRow*4;
+        off_t offset = (off_t)(l.first + (uint64_t) lb.bandIndex*l.columns + c)*TILE_BYTES;
+        if(pwrite(p->fd, tile, bytes, offset) != (ssize_t) bytes)
+        {
+            return false;
+        }
+    }
+    ++lb.bandIndex;
+    lb.bandRow = 0;
+    return true;
+}
+
+// очередная строка уровня; каждые две строки дают строку следующего уровня
+static bool PushRow(TILEPYRAMID *p, LEVELBUILD *b, uint8_t level, const uint32_t *row, uint32_t *tile)
+{
+    const TILELEVEL &l = p->levels[level];
+    LEVELBUILD &lb = b[level];
+
+    memcpy(lb.band + (size_t) lb.bandRow*l.width, row, (size_t) l.width*4);
+    ++lb.bandRow;
+    ++lb.y;
+    if((lb.bandRow == TILE_SIZE || lb.y == l.height) && !FlushBand(p, level, lb, tile))
+    {
+        return false;
+    }
+
+    if(level+1 >= p->nLevels)
+    {
+        return true;
+    }
+    if(!lb.bPending && lb.y < l.height)
+    {
+        memcpy(lb.pending, row, (size_t) l.width*4);
+        lb.bPending = true;
+        return true;
+    }
+
+    // последняя нечетная строка усредняется сама с собой
+    Halve(lb.bPending ? lb.pending : row, row, l.width, lb.half);
+    lb.bPending = false;
+    return PushRow(p, b, level+1, lb.half, tile);
+}
+
+// чтение PNG и раскладка на плитки всех уровней; выполняется в пуле потоков
+static std::shared_ptr<TILEPYRAMID> BuildPyramid(const char *filename)
+{
+    uint32_t w, h;
+    PNGREADER r = PNGOpen(filename, &w, &h);
+    if(!r)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<TILEPYRAMID> p = std::make_shared<TILEPYRAMID>();
+    for(uint32_t lw=w, lh=h; ; lw=(lw+1)/2, lh=(lh+1)/2)
+    {
+        TILELEVEL &l = p->levels[p->nLevels++];
+        l.width = lw;
+        l.height = lh;
+        l.columns = (lw + TILE_SIZE-1)/TILE_SIZE;
+        l.rows = (lh + TILE_SIZE-1)/TILE_SIZE;
+        l.first = p->nTiles;
+        p->nTiles += (uint64_t) l.columns*l.rows;
+        if((lw <= TILE_SIZE && lh <= TILE_SIZE) || p->nLevels == TILE_LEVELS)
+        {
+            break;
+        }
+    }
+
+    // /var/tmp, а не /tmp: /tmp часто в памяти (tmpfs), и плитки заняли бы ту же память
+    const char *dir = getenv("TMPDIR");
+    char name[PATH_MAX];
+    snprintf(name, sizeof(name), "%s/gui3-tiles-XXXXXX", dir && *dir ? dir : "/var/tmp");
+    p->fd = mkstemp(name);
+    if(p->fd < 0)
+    {
+        fprintf(stderr, "Не удалось создать %s\n", name);
+        PNGClose(r);
+        return nullptr;
+    }
+    unlink(name);
+
+    // в памяти - по полосе плиток на уровень
+    LEVELBUILD b[TILE_LEVELS];
+    memset(b, 0, sizeof(b));
+    bool bOk = true;
+    for(uint8_t i=0; i<p->nLevels; i++)
+    {
+        b[i].band = (uint32_t *) malloc((size_t) p->levels[i].width*TILE_SIZE*4);
+        b[i].pending = (uint32_t *) malloc((size_t) p->levels[i].width*4);
+        b[i].half = (uint32_t *) malloc((size_t) (p->levels[i].width+1)/2*4);
+        bOk = bOk && b[i].band && b[i].pending && b[i].half;
+    }
+    uint32_t *row = (uint32_t *) malloc((size_t) w*4);
+    uint32_t *tile = (uint32_t *) malloc(TILE_BYTES);
+    bOk = bOk && row && tile;
+
+    for(uint32_t y=0; bOk && y<h; y++)
+    {
+        bOk = PNGReadRow(r, row) && PushRow(p.get(), b, 0, row, tile);
+    }
+
+    for(uint8_t i=0; i<p->nLevels; i++)
+    {
+        free(b[i].band);
+        free(b[i].pending);
+        free(b[i].half);
+    }
+    free(row);
+    free(tile);
+    PNGClose(r);
+    return bOk ? p : nullptr;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TiledImage::TiledImage()
+{
+    m_ClassName = __FUNCTION__;
+    SetFrameWidth(0);
+    m_tiles = nullptr;
+    m_bytes = 0;
+    m_budget = (uint64_t) TILE_CACHE_MB << 20;
+    m_nFrame = 0;
+    m_nLoad = 0;
+    m_nLoading = 0;
+    m_nChange = 0;
+    m_bInteractive = false;
+    m_bFailed = false;
+    m_zoom = 1.0;
+    m_x = 0;
+    m_y = 0;
+    m_bDrag = false;
+    m_dragX = 0;
+    m_dragY = 0;
+}
+
+TiledImage::~TiledImage()
+{
+    Close();
+}
+
+void TiledImage::Load(const char *filename)
+{
+    Close();
+    uint32_t nLoad = m_nLoad;
+    std::string name(filename);
+    RunInBackground([name]() { return BuildPyramid(name.c_str()); },
+        [this, nLoad](std::shared_ptr<TILEPYRAMID> &p)
+        {
+            if(nLoad != m_nLoad)
+            {
+                return;
+            }
+            if(!p)
+            {
+                m_bFailed = true;
+                ReDraw();
+                return;
+            }
+            m_pyramid = p;
+            m_tiles = (TILE *) calloc(p->nTiles, sizeof(TILE));
+            Fit();
+        });
+}
+
+void TiledImage::Close()
+{
+    // результаты начатых заданий отбрасываются по номеру загрузки
+    ++m_nLoad;
+    m_nLoading = 0;
+    if(m_tiles)
+    {
+        for(uint64_t i=0; i<m_pyramid->nTiles; i++)
+        {
+            ImageRelease(m_tiles[i].ii);
+        }
+        free(m_tiles);
+        m_tiles = nullptr;
+    }
+    m_pyramid = nullptr;
+    m_bytes = 0;
+    m_bFailed = false;
+    m_bDrag = false;
+}
+
+bool TiledImage::IsLoaded()
+{
+    return m_tiles != nullptr;
+}
+
+bool TiledImage::IsFailed()
+{
+    return m_bFailed;
+}
+
+void TiledImage::SetCacheBudget(uint64_t bytes)
+{
+    m_budget = bytes;
+    Evict();
+}
+
+void TiledImage::Fit()
+{
+    if(!m_pyramid)
+    {
+        return;
+    }
+    const TILELEVEL &l = m_pyramid->levels[0];
+    Rect ws = GetInteriorSize();
+    m_zoom = min((double) ws.GetWidth()/l.width, (double) ws.GetHeight()/l.height);
+    m_zoom = m_zoom > 0 ? min(m_zoom, 1.0) : 1.0;     // окно еще без размера
+    m_x = l.width/2.0;
+    m_y = l.height/2.0;
+    Changed();
+}
+
+void TiledImage::Zoom(double factor)
+{
+    if(!m_pyramid)
+    {
+        return;
+    }
+
+    // уменьшать дальше половины вписанного в окно размера незачем
+    const TILELEVEL &l = m_pyramid->levels[0];
+    Rect ws = GetInteriorSize();
+    double minZoom = min(min((double) ws.GetWidth()/l.width, (double) ws.GetHeight()/l.height), 1.0)/2;
+    m_zoom = min(max(m_zoom*factor, minZoom), TILE_MAX_ZOOM);
+    Changed();
+}
+
+void TiledImage::Pan(double dx, double dy)
+{
+    if(!m_pyramid)
+    {
+        return;
+    }
+    const TILELEVEL &l = m_pyramid->levels[0];
+    m_x = min(max(m_x + dx/m_zoom, 0.0), (double) l.width);
+    m_y = min(max(m_y + dy/m_zoom, 0.0), (double) l.height);
+    Changed();
+}
+
+void TiledImage::Changed()
+{
+    // во время прокрутки рисуем быстрым фильтром, после паузы - перерисовываем качественно
+    m_bInteractive = true;
+    uint32_t nChange = ++m_nChange;
+    std::shared_ptr<Window*> self = GetLifetime();
+    InvokeAfter(TILE_SETTLE_MS, [this, self, nChange]()
+    {
+        if(*self && nChange == m_nChange)
+        {
+            m_bInteractive = false;
+            ReDraw();
+        }
+    });
+    ReDraw();
+}
+
+void TiledImage::LoadTile(Context *cr, uint64_t index, uint8_t level, uint32_t column, uint32_t row)
+{
+    m_tiles[index].state = TILE_LOADING;
+    ++m_nLoading;
+
+    // если окно уничтожено до окончания загрузки, плитка освобождается вместе с result
+    std::shared_ptr<TILEPYRAMID> p = m_pyramid;
+    uint32_t nLoad = m_nLoad;
+    uint16_t tw = TileWidth(p->levels[level], column), th = TileHeight(p->levels[level], row);
+    std::shared_ptr<IMAGEINFO> result(new IMAGEINFO(nullptr), [](IMAGEINFO *ii) { ImageRelease(*ii); delete ii; });
+    RunInBackground([cr, p, index, tw, th, result]()
+        {
+            size_t bytes = (size_t) tw*th*4;
+            uint32_t *pixels = (uint32_t *) malloc(bytes);
+            if(pixels && pread(p->fd, pixels, bytes, (off_t) index*TILE_BYTES) == (ssize_t) bytes)
+            {
+                *result = cr->CreateImage(pixels, tw, th);
+            }
+            else
+            {
+                free(pixels);
+            }
+        },
+        [this, nLoad, index, result]()
+        {
+            if(nLoad != m_nLoad)
+            {
+                return;
+            }
+            --m_nLoading;
+            TILE &t = m_tiles[index];
+            t.ii = *result;
+            *result = nullptr;
+            t.state = t.ii ? TILE_READY : TILE_FAILED;
+            if(t.ii)
+            {
+                m_bytes += (uint64_t) t.ii->width*t.ii->height*4;
+                Evict();
+            }
+            ReDraw();
+        });
+}
+
+void TiledImage::Evict()
+{
+    if(!m_tiles)
+    {
+        return;
+    }
+
+    // плитка последнего уровня остается всегда - ею закрываются незагруженные места
+    uint64_t nTiles = m_pyramid->levels[m_pyramid->nLevels-1].first;
+    while(m_bytes > m_budget)
+    {
+        // давно не отображавшаяся плитка; отображаемые в текущем кадре не выгружаются
+        TILE *pOldest = nullptr;
+        for(uint64_t i=0; i<nTiles; i++)
+        {
+            TILE &t = m_tiles[i];
+            if(t.state == TILE_READY && t.used != m_nFrame && (!pOldest || t.used < pOldest->used))
+            {
+                pOldest = &t;
+            }
+        }
+        if(!pOldest)
+        {
+            break;
+        }
+        m_bytes -= (uint64_t) pOldest->ii->width*pOldest->ii->height*4;
+        ImageRelease(pOldest->ii);
+        pOldest->ii = nullptr;
+        pOldest->state = TILE_EMPTY;
+    }
+}
+
+// x0, y0 - точка картинки (уровня 0) в левом верхнем углу окна; края соседних плиток
+// вычисляются по одной формуле и совпадают до точки
+void TiledImage::DrawTile(Context *cr, uint8_t level, uint32_t column, uint32_t row, double x0, double y0, uint8_t filter)
+{
+    const TILELEVEL &l = m_pyramid->levels[level];
+    TILE &t = m_tiles[l.first + (uint64_t) row*l.columns + column];
+    t.used = m_nFrame;
+
+    double s = m_zoom*(1 << level);     // точек экрана на точку уровня
+    int32_t left = (int32_t) floor(((double) column*TILE_SIZE)*s - x0*m_zoom + 0.5);
+    int32_t top = (int32_t) floor(((double) row*TILE_SIZE)*s - y0*m_zoom + 0.5);
+    int32_t right = (int32_t) floor(((double) column*TILE_SIZE + t.ii->width)*s - x0*m_zoom + 0.5);
+    int32_t bottom = (int32_t) floor(((double) row*TILE_SIZE + t.ii->height)*s - y0*m_zoom + 0.5);
+    if(right > left && bottom > top)
+    {
+        cr->StretchImage(t.ii, left, top, right-left, bottom-top, filter);
+    }
+}
+
+void TiledImage::OnDraw(Context *cr)
+{
+    Rect ws = GetInteriorSize();
+    cr->SetColor(m_backColor);
+    cr->FillRectangle(Point(0,0), ws);
+    if(!m_tiles)
+    {
+        return;
+    }
+    ++m_nFrame;
+
+    // уровень, точка которого не меньше точки экрана: мельче - лишние точки, крупнее - размытость
+    uint8_t level = 0;
+    while(level+1 < m_pyramid->nLevels && m_zoom*(2 << level) <= 1.0)
+    {
+        ++level;
+    }
+    uint8_t filter = m_bInteractive ? IMAGE_FILTER_FAST : IMAGE_FILTER_GOOD;
+
+    // видимая часть картинки в точках уровня 0
+    double x0 = m_x - ws.GetWidth()/2.0/m_zoom;
+    double y0 = m_y - ws.GetHeight()/2.0/m_zoom;
+    double x1 = x0 + ws.GetWidth()/m_zoom;
+    double y1 = y0 + ws.GetHeight()/m_zoom;
+
+    const TILELEVEL &l = m_pyramid->levels[level];
+    double ts = (double) TILE_SIZE*(1 << level);   // сторона плитки уровня в точках уровня 0
+    uint32_t c0 = (uint32_t) max(floor(x0/ts), 0.0), r0 = (uint32_t) max(floor(y0/ts), 0.0);
+    uint32_t c1 = (uint32_t) min(max(floor(x1/ts), 0.0), (double) l.columns-1);
+    uint32_t r1 = (uint32_t) min(max(floor(y1/ts), 0.0), (double) l.rows-1);
+
+    // плитка последнего уровня нужна всегда
+    uint8_t top = m_pyramid->nLevels-1;
+    uint64_t iTop = m_pyramid->levels[top].first;
+    if(m_tiles[iTop].state == TILE_EMPTY)
+    {
+        LoadTile(cr, iTop, top, 0, 0);
+    }
+
+    // незагруженные плитки: запрос загрузки, на их месте - загруженная плитка более крупного уровня
+    for(uint32_t r=r0; r<=r1; r++)
+    {
+        for(uint32_t c=c0; c<=c1; c++)
+        {
+            uint64_t i = l.first + (uint64_t) r*l.columns + c;
+            if(m_tiles[i].state == TILE_READY)
+            {
+                continue;
+            }
+            if(m_tiles[i].state == TILE_EMPTY && m_nLoading < TILE_LOADS)
+            {
+                LoadTile(cr, i, level, c, r);
+            }
+            for(uint8_t k=level+1; k<m_pyramid->nLevels; k++)
+            {
+                const TILELEVEL &lk = m_pyramid->levels[k];
+                uint32_t ck = c >> (k-level), rk = r >> (k-level);
+                TILE &t = m_tiles[lk.first + (uint64_t) rk*lk.columns + ck];
+                if(t.state == TILE_READY)
+                {
+                    if(t.used != m_nFrame)
+                    {
+                        DrawTile(cr, k, ck, rk, x0, y0, filter);
+                    }
+                    break;
+                }
+            }
+        }
+    }
+
+    // загруженные плитки нужного уровня - поверх
+    for(uint32_t r=r0; r<=r1; r++)
+    {
+        for(uint32_t c=c0; c<=c1; c++)
+        {
+            if(m_tiles[l.first + (uint64_t) r*l.columns + c].state == TILE_READY)
+            {
+                DrawTile(cr, level, c, r, x0, y0, filter);
+            }
+        }
+    }
+}
+
+bool TiledImage::OnKeyPress(uint64_t keyval)
+{
+    switch(keyval)
+    {
+    case '+':
+    case '=':
+        Zoom(TILE_ZOOM_STEP);
+        return true;
+    case '-':
+    case '_':
+        Zoom(1/TILE_ZOOM_STEP);
+        return true;
+    case '0':
+        Fit();
+        return true;
+    case KEY_Left:
+        Pan(-TILE_PAN_STEP, 0);
+        return true;
+    case KEY_Right:
+        Pan(TILE_PAN_STEP, 0);
+        return true;
+    case KEY_Up:
+        Pan(0, -TILE_PAN_STEP);
+        return true;
+    case KEY_Down:
+        Pan(0, TILE_PAN_STEP);
+        return true;
+    default:
+        ;
+    }
+    return false;
+}
+
+bool TiledImage::OnLeftMouseButtonClick(const Point &position)
+{
+    // начало буксировки
+    m_bDrag = true;
+    m_dragX = (int16_t) position.GetX();
+    m_dragY = (int16_t) position.GetY();
+    CaptureMouse(this);
+    return true;
+}
+
+bool TiledImage::OnMouseMove(const Point &position)
+{
+    if(m_bDrag)
+    {
+        // за пределами окна координаты отрицательные
+        int32_t x = (int16_t) position.GetX(), y = (int16_t) position.GetY();
+        Pan(m_dragX - x, m_dragY - y);
+        m_dragX = x;
+        m_dragY = y;
+    }
+    return m_bDrag;
+}
+
+bool TiledImage::OnLeftMouseButtonRelease(const Point &position)
+{
+    m_bDrag = false;
+    CaptureMouse(nullptr);
+    return true;
+}
+
+bool TiledImage::OnScroll(uint64_t value)
+{
+    SCROLLINFO si = (SCROLLINFO) value;
+
+    switch(si->direction)
+    {
+    case _SCROLLINFO::SCROLL_UP:
+        Zoom(TILE_ZOOM_STEP);
+        break;
+    case _SCROLLINFO::SCROLL_DOWN:
+        Zoom(1/TILE_ZOOM_STEP);
+        break;
+    case _SCROLLINFO::SCROLL_LEFT:
+        Pan(-TILE_PAN_STEP, 0);
+        break;
+    case _SCROLLINFO::SCROLL_RIGHT:
+        Pan(TILE_PAN_STEP, 0);
+        break;
+    case _SCROLLINFO::SCROLL_SMOOTH:
+        Pan(si->dx, si->dy);
+        break;
+    default:
+        ;
+    }
+    return true;
+}
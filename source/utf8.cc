@@ -0,0 +1,384 @@
+// utf8.cc
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define UTF8_X86
+#endif
+#include "utf8.h"
+
+uint8_t UTF8SymbolSize(uint8_t lead)
+{
+    if(lead < 0x80)
+    {
+        return 1;
+    }
+    if(lead < 0xc2)
+    {
+        // продолжение символа или лишне длинная форма двухбайтового
+        return 0;
+    }
+    if(lead < 0xe0)
+    {
+        return 2;
+    }
+    if(lead < 0xf0)
+    {
+        return 3;
+    }
+    return lead < 0xf5 ? 4 : 0;
+}
+
+uint32_t UTF8Decode(const char *s, uint8_t *size)
+{
+    const uint8_t *u = (const uint8_t *) s;
+    uint8_t n = UTF8SymbolSize(u[0]);
+    uint32_t code;
+    switch(n)
+    {
+    case 2:
+        code = (u[0] & 0x1f) << 6 | (u[1] & 0x3f);
+        break;
+    case 3:
+        code = (u[0] & 0x0f) << 12 | (u[1] & 0x3f) << 6 | (u[2] & 0x3f);
+        break;
+    case 4:
+        code = (u[0] & 0x07) << 18 | (u[1] & 0x3f) << 12 | (u[2] & 0x3f) << 6 | (u[3] & 0x3f);
+        break;
+    default:
+        // ASCII; недопустимый байт считается отдельным символом
+        code = u[0];
+        n = 1;
+    }
+    *size = n;
+    return code;
+}
+
+uint8_t UTF8Encode(uint32_t code, char *s)
+{
+    if(code < 0x80)
+    {
+        s[0] = code;
+        return 1;
+    }
+    if(code < 0x800)
+    {
+        s[0] = 0xc0 | code >> 6;
+        s[1] = 0x80 | (code & 0x3f);
+        return 2;
+    }
+    if(code < 0x10000)
+    {
+        s[0] = 0xe0 | code >> 12;
+        s[1] = 0x80 | (code >> 6 & 0x3f);
+        s[2] = 0x80 | (code & 0x3f);
+        return 3;
+    }
+    s[0] = 0xf0 | code >> 18;
+    s[1] = 0x80 | (code >> 12 & 0x3f);
+    s[2] = 0x80 | (code >> 6 & 0x3f);
+    s[3] = 0x80 | (code & 0x3f);
+    return 4;
+}
+
+// длина допустимого символа в начале s; 0 - символ недопустим или обрезан
+static uint8_t CheckSymbol(const uint8_t *s, size_t length)
+{
+    uint8_t size = UTF8SymbolSize(s[0]);
+    if(size == 0 || size > length)
+    {
+        return 0;
+    }
+
+    // второй байт ограничен сильнее: лишне длинные формы, суррогаты, коды выше U+10FFFF
+    uint8_t lo = 0x80, hi = 0xbf;
+    switch(s[0])
+    {
+    case 0xe0:
+        lo = 0xa0;
+        break;
+    case 0xed:
+        hi = 0x9f;
+        break;
+    case 0xf0:
+        lo = 0x90;
+        break;
+    case 0xf4:
+        hi = 0x8f;
+        break;
+    }
+    if(size > 1 && (s[1] < lo || s[1] > hi))
+    {
+        return 0;
+    }
+    for(uint8_t k=2; k<size; k++)
+    {
+        if((s[k] & 0xc0) != 0x80)
+        {
+            return 0;
+        }
+    }
+    return size;
+}
+
+static bool ValidateDefault(const uint8_t *s, size_t length)
+{
+    size_t i = 0;
+    while(i < length)
+    {
+#ifdef __SSE2__
+        // 16 байтов ASCII
+        if(i + 16 <= length && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i))))
+        {
+            i += 16;
+            continue;
+        }
+#endif
+        uint8_t size = CheckSymbol(s + i, length - i);
+        if(!size)
+        {
+            return false;
+        }
+        i += size;
+    }
+    return true;
+}
+
+static size_t CountDefault(const uint8_t *s, size_t length)
+{
+    size_t n = 0, i = 0;
+#ifdef __SSE2__
+    // первые байты символов - все, кроме 10xxxxxx, то есть больше 0xbf как знаковые
+    const __m128i cont = _mm_set1_epi8((char) 0xbf);
+    for(; i+16 <= length; i+=16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        n += __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, cont)));
+    }
+#endif
+    for(; i<length; i++)
+    {
+        n += (s[i] & 0xc0) != 0x80;
+    }
+    return n;
+}
+
+static size_t OffsetDefault(const uint8_t *s, size_t length, size_t index)
+{
+    size_t n = 0, i = 0;    // n - символов до i
+#ifdef __SSE2__
+    // блоки, в которых нужный символ не начинается, пропускаются целиком
+    const __m128i cont = _mm_set1_epi8((char) 0xbf);
+    for(; i+16 <= length; i+=16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        size_t c = __builtin_popcount(_mm_movemask_epi8(_mm_cmpgt_epi8(v, cont)));
+        if(n + c > index)
+        {
+            break;
+        }
+        n += c;
+    }
+#endif
+    for(; i<length; i++)
+    {
+        if((s[i] & 0xc0) != 0x80)
+        {
+            if(n == index)
+            {
+                return i;
+            }
+            ++n;
+        }
+    }
+    return length;
+}
+
+#ifdef UTF8_X86
+
+// Проверка по 32 байта (Keiser, Lemire. Validating UTF-8 in less than one instruction per byte, 2021).
+// Для каждого байта и предыдущего три таблицы (по старшему полубайту предыдущего, младшему полубайту
+// предыдущего и старшему полубайту текущего) дают маски возможных ошибок; ошибка есть, если бит
+// установлен во всех трех. Третий и четвертый байты символа проверяются отдельно по байтам за 2 и 3 до них.
+#define TOO_SHORT       (1<<0)  // 11xxxxxx 0xxxxxxx или 11xxxxxx 11xxxxxx
+#define TOO_LONG        (1<<1)  // 0xxxxxxx 10xxxxxx
+#define OVERLONG_3      (1<<2)  // 11100000 100xxxxx
+#define TOO_LARGE       (1<<3)  // 11110100 1001xxxx, 11110100 101xxxxx, 11110101-11111111
+#define SURROGATE       (1<<4)  // 11101101 101xxxxx
+#define OVERLONG_2      (1<<5)  // 1100000x 10xxxxxx
+#define TOO_LARGE_1000  (1<<6)  // 11110101-11111111 1000xxxx
+#define OVERLONG_4      (1<<6)  // 11110000 1000xxxx
+#define TWO_CONTS       (1<<7)  // 10xxxxxx 10xxxxxx: продолжение без первого байта, если не третий или четвертый байт
+#define CARRY           (TOO_SHORT|TOO_LONG|TWO_CONTS)
+
+// байты input, сдвинутые на n назад, с последними байтами предыдущего блока
+#define PREV(input, prev, n)    _mm256_alignr_epi8(input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - (n))
+
+#define TABLE(a0,a1,a2,a3,a4,a5,a6,a7,a8,a9,a10,a11,a12,a13,a14,a15) \
+    _mm256_setr_epi8(a0,a1,a2,a3,a4,a5,a6,a7,a8,a9,a10,a11,a12,a13,a14,a15, \
+                     a0,a1,a2,a3,a4,a5,a6,a7,a8,a9,a10,a11,a12,a13,a14,a15)
+
+__attribute__((target("avx2")))
+static bool ValidateAVX2(const uint8_t *s, size_t length)
+{
+    const __m256i high1 = TABLE(
+        TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,   // 0xxxxxxx
+        TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,                                         // 10xxxxxx
+        TOO_SHORT|OVERLONG_2,                                                               // 1100xxxx
+        TOO_SHORT,                                                                          // 1101xxxx
+        TOO_SHORT|OVERLONG_3|SURROGATE,                                                     // 1110xxxx
+        TOO_SHORT|TOO_LARGE|TOO_LARGE_1000|OVERLONG_4);                                     // 1111xxxx
+    const __m256i low1 = TABLE(
+        CARRY|OVERLONG_3|OVERLONG_2|OVERLONG_4,                                             // xxxx0000
+        CARRY|OVERLONG_2,                                                                   // xxxx0001
+        CARRY, CARRY,                                                                       // xxxx001x
+        CARRY|TOO_LARGE,                                                                    // xxxx0100
+        CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000,                     // xxxx0101, xxxx0110
+        CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000,                     // xxxx0111, xxxx1000
+        CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000,
+        CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000,
+        CARRY|TOO_LARGE|TOO_LARGE_1000|SURROGATE,                                           // xxxx1101
+        CARRY|TOO_LARGE|TOO_LARGE_1000, CARRY|TOO_LARGE|TOO_LARGE_1000);
+    const __m256i high2 = TABLE(
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,   // 0xxxxxxx
+        TOO_LONG|OVERLONG_2|TWO_CONTS|OVERLONG_3|TOO_LARGE_1000|OVERLONG_4,                 // 1000xxxx
+        TOO_LONG|OVERLONG_2|TWO_CONTS|OVERLONG_3|TOO_LARGE,                                 // 1001xxxx
+        TOO_LONG|OVERLONG_2|TWO_CONTS|SURROGATE|TOO_LARGE,                                  // 101xxxxx
+        TOO_LONG|OVERLONG_2|TWO_CONTS|SURROGATE|TOO_LARGE,
+        TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);                                        // 11xxxxxx
+
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    // последний блок не может кончаться первым байтом многобайтового символа
+    const __m256i maxLast = _mm256_setr_epi8(-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+        -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1, (char)(0xf0-1), (char)(0xe0-1), (char)(0xc0-1));
+
+    __m256i prev = _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    uint8_t tail[32];
+    for(size_t i=0; i<length; i+=32)
+    {
+        __m256i input;
+        if(i + 32 <= length)
+        {
+            input = _mm256_loadu_si256((const __m256i *)(s + i));
+        }
+        else
+        {
+            // хвост дополняется нулями (ASCII)
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, length - i);
+            input = _mm256_loadu_si256((const __m256i *) tail);
+        }
+
+        if(!_mm256_movemask_epi8(input))
+        {
+            // ASCII: ошибка, только если предыдущий блок оборвал символ
+            error = _mm256_or_si256(error, incomplete);
+            incomplete = _mm256_setzero_si256();
+        }
+        else
+        {
+            __m256i prev1 = PREV(input, prev, 1);
+            __m256i special = _mm256_and_si256(_mm256_and_si256(
+                _mm256_shuffle_epi8(high1, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+                _mm256_shuffle_epi8(low1, _mm256_and_si256(prev1, nibble))),
+                _mm256_shuffle_epi8(high2, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble)));
+
+            // третий или четвертый байт символа (после 1110xxxx за два байта или 11110xxx за три)
+            // должен быть продолжением - для него TWO_CONTS не ошибка, а его отсутствие - ошибка
+            __m256i must23 = _mm256_or_si256(
+                _mm256_subs_epu8(PREV(input, prev, 2), _mm256_set1_epi8((char)(0xe0-0x80))),
+                _mm256_subs_epu8(PREV(input, prev, 3), _mm256_set1_epi8((char)(0xf0-0x80))));
+            __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8((char) 0x80));
+            error = _mm256_or_si256(error, _mm256_xor_si256(must23_80, special));
+            incomplete = _mm256_subs_epu8(input, maxLast);
+        }
+        prev = input;
+    }
+    error = _mm256_or_si256(error, incomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+__attribute__((target("avx2")))
+static size_t CountAVX2(const uint8_t *s, size_t length)
+{
+    size_t n = 0, i = 0;
+    const __m256i cont = _mm256_set1_epi8((char) 0xbf);
+    for(; i+32 <= length; i+=32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, cont)));
+    }
+    return n + CountDefault(s + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t OffsetAVX2(const uint8_t *s, size_t length, size_t index)
+{
+    size_t n = 0, i = 0;
+    const __m256i cont = _mm256_set1_epi8((char) 0xbf);
+    for(; i+32 <= length; i+=32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        size_t c = __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, cont)));
+        if(n + c > index)
+        {
+            break;
+        }
+        n += c;
+    }
+    return i + OffsetDefault(s + i, length - i, index - n);
+}
+
+#endif
+
+static bool UseAVX2()
+{
+#ifdef UTF8_X86
+    static const bool bAVX2 = []()
+    {
+        const char *env = getenv("GUI_AVX2");
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2") && !(env && !strcmp(env, "0"));
+    }();
+    return bAVX2;
+#else
+    return false;
+#endif
+}
+
+bool UTF8Validate(const char *s, size_t length)
+{
+#ifdef UTF8_X86
+    if(UseAVX2())
+    {
+        return ValidateAVX2((const uint8_t *) s, length);
+    }
+#endif
+    return ValidateDefault((const uint8_t *) s, length);
+}
+
+size_t UTF8Count(const char *s, size_t length)
+{
+#ifdef UTF8_X86
+    if(UseAVX2())
+    {
+        return CountAVX2((const uint8_t *) s, length);
+    }
+#endif
+    return CountDefault((const uint8_t *) s, length);
+}
+
+size_t UTF8Offset(const char *s, size_t length, size_t index)
+{
+#ifdef UTF8_X86
+    if(UseAVX2())
+    {
+        return OffsetAVX2((const uint8_t *) s, length, index);
+    }
+#endif
+    return OffsetDefault((const uint8_t *) s, length, index);
+}
@@ -0,0 +1,254 @@
+// class VirtualList
+
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include "window.h"
+#include "list.h"
+#include "scroll.h"
+#include "virtuallist.h"
+
+VirtualList::VirtualList()
+{
+    m_ClassName = __FUNCTION__;
+    m_nRows = 0;
+    m_top = 0;
+    m_dy = 0;
+    m_rowHeight = 18;
+    m_nSelection = -1;
+    m_selbackColor = RGB(0.8,1.0,0.8);
+    m_textColor = RGB(0.0, 0.0, 0.0);
+    m_fontSize = 12;
+    strcpy(m_fontFace,"Cantarel");
+    m_pVBar = new VerticalScrollBar;
+}
+
+VirtualList::~VirtualList()
+{
+}
+
+void VirtualList::OnCreate()
+{
+    Rect is = GetInteriorSize();
+    AddChild(m_pVBar, Point(is.GetWidth()-SCROLLBAR_SIZE,0), Rect(SCROLLBAR_SIZE,is.GetHeight()));
+    m_pVBar->SetTotal(m_nRows*m_rowHeight);
+    m_pVBar->SetDataOrigin(0);
+}
+
+void VirtualList::SetSource(LISTSOURCE source)
+{
+    m_source = std::move(source);
+}
+
+void VirtualList::SetRowCount(uint32_t nRows)
+{
+    m_nRows = nRows;
+    if(m_nSelection >= 0 && (uint32_t) m_nSelection >= m_nRows)
+    {
+        m_nSelection = -1;
+    }
+    m_pVBar->SetTotal(m_nRows*m_rowHeight);
+    SetTop(m_top);
+    ReDraw();
+}
+
+void VirtualList::InsertRows(uint32_t row, uint32_t n)
+{
+    if(m_nSelection >= 0 && (uint32_t) m_nSelection >= row)
+    {
+        m_nSelection += n;
+    }
+    if(m_top > row)
+    {
+        m_top += n;
+    }
+    SetRowCount(m_nRows + n);
+}
+
+void VirtualList::DeleteRows(uint32_t row, uint32_t n)
+{
+    if(row >= m_nRows)
+    {
+        return;
+    }
+    n = min(n, m_nRows - row);
+    if(m_nSelection >= 0 && (uint32_t) m_nSelection >= row)
+    {
+        m_nSelection = (uint32_t) m_nSelection < row+n ? -1 : m_nSelection-n;
+    }
+    if(m_top > row)
+    {
+        m_top = m_top >= row+n ? m_top-n : row;
+    }
+    SetRowCount(m_nRows - n);
+}
+
+void VirtualList::SetSelection(int32_t row)
+{
+    m_nSelection = row >= 0 && (uint32_t) row < m_nRows ? row : -1;
+    ReDraw();
+}
+
+void VirtualList::SetRowHeight(uint16_t height)
+{
+    m_rowHeight = max(height, 1);
+    m_pVBar->SetTotal(m_nRows*m_rowHeight);
+    SetTop(m_top);
+}
+
+void VirtualList::SetFont(const char *FontFace, const int16_t FontSize)
+{
+    if(FontFace)
+    {
+        assert(strlen(FontFace)<=VLIST_FONTFACE_SIZE);
+        strcpy(m_fontFace,FontFace);
+    }
+    if(FontSize >= 0)
+    {
+        m_fontSize = FontSize;
+    }
+}
+
+uint32_t VirtualList::GetVisibleRows()
+{
+    return max(GetInteriorSize().GetHeight()/m_rowHeight, 1);
+}
+
+void VirtualList::SetTop(int64_t top)
+{
+    // последняя страница заполнена целиком
+    int64_t maxTop = (int64_t) m_nRows - GetVisibleRows();
+    top = min(top, maxTop);
+    m_top = max(top, 0);
+    m_pVBar->SetDataOrigin(m_top*m_rowHeight);
+}
+
+void VirtualList::ScrollTo(uint32_t row)
+{
+    uint32_t nVisible = GetVisibleRows();
+    if(row < m_top)
+    {
+        SetTop(row);
+    }
+    else if(row >= m_top + nVisible)
+    {
+        SetTop((int64_t) row - nVisible + 1);
+    }
+    ReDraw();
+}
+
+void VirtualList::OnSizeChanged()
+{
+    Rect is = GetInteriorSize();
+    m_pVBar->SetSize(Rect(SCROLLBAR_SIZE,is.GetHeight()));
+    m_pVBar->SetPosition(Point(is.GetWidth()-SCROLLBAR_SIZE,0));
+    SetTop(m_top);
+}
+
+void VirtualList::OnDraw(Context *cr)
+{
+    Rect is = GetInteriorSize();
+    uint16_t w = is.GetWidth() > SCROLLBAR_SIZE ? is.GetWidth()-SCROLLBAR_SIZE : 0;
+
+    cr->SetColor(m_backColor);
+    cr->FillRectangle(Point(0,0), Rect(w,is.GetHeight()));
+
+    int16_t ascent, descent;
+    uint16_t ls, adv;
+    cr->GetFontInfo(m_fontFace, m_fontSize, 0, &ascent, &descent, &ls, &adv);
+
+    // строки, попадающие в окно (последняя может быть видна частично)
+    uint32_t nVisible = (is.GetHeight() + m_rowHeight-1)/m_rowHeight;
+    uint32_t last = min(m_nRows, m_top + nVisible);
+    for(uint32_t row=m_top; row<last && m_source; row++)
+    {
+        uint16_t y = (row - m_top)*m_rowHeight;
+        if(m_nSelection >= 0 && (uint32_t) m_nSelection == row)
+        {
+            cr->SetColor(m_selbackColor);
+            cr->FillRectangle(Point(0,y), Rect(w,m_rowHeight));
+        }
+
+        LISTROW r;
+        r.text = nullptr;
+        r.style = 0;
+        m_source(row, &r);
+        if(r.text)
+        {
+            cr->SetColor(m_textColor);
+            cr->Text(r.text, m_fontFace, m_fontSize, Point(adv/5, y + m_rowHeight/2),
+                (r.style & (TEXT_STYLE_BOLD|TEXT_STYLE_ITALIC))|TEXT_ALIGNH_LEFT|TEXT_ALIGNV_CENTER);
+        }
+    }
+}
+
+void VirtualList::OnNotify(Window *child, uint32_t type, const Point &position)
+{
+    if(child == m_pVBar && type == EVENT_SCROLLING)
+    {
+        m_top = m_pVBar->GetDataOrigin()/m_rowHeight;
+        ReDraw();
+    }
+}
+
+int32_t VirtualList::RowAt(const Point &position)
+{
+    uint32_t row = m_top + position.GetY()/m_rowHeight;
+    return row < m_nRows ? row : -1;
+}
+
+bool VirtualList::OnLeftMouseButtonClick(const Point &position)
+{
+    int32_t row = RowAt(position);
+    if(row >= 0)
+    {
+        SetSelection(row);
+        NotifyParent(EVENT_LIST_LMB_CLICK,position);
+    }
+    return true;
+}
+
+bool VirtualList::OnLeftMouseButtonDoubleClick(const Point &position)
+{
+    int32_t row = RowAt(position);
+    if(row >= 0)
+    {
+        SetSelection(row);
+        NotifyParent(EVENT_LIST_LMB_DOUBLECLICK,position);
+    }
+    return true;
+}
+
+bool VirtualList::OnScroll(uint64_t value)
+{
+    SCROLLINFO si = (SCROLLINFO) value;
+
+    switch(si->direction)
+    {
+    case _SCROLLINFO::SCROLL_UP:
+        m_dy -= SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_DOWN:
+        m_dy += SCROLL_DELTA;
+        break;
+    case _SCROLLINFO::SCROLL_SMOOTH:
+        m_dy -= si->dy;
+        break;
+    default:
+        return true;
+    }
+
+    // прокрутка по целым строкам, остаток накапливается
+    int32_t nRows = (int32_t)(m_dy/m_rowHeight);
+    if(nRows)
+    {
+        m_dy -= nRows*m_rowHeight;
+        SetTop((int64_t) m_top + nRows);
+        ReDraw();
+    }
+    if(si->stop)
+    {
+        m_dy = 0;
+    }
+    return true;
+}
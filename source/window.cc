@@ -1,6 +1,9 @@
 #include <cassert>
 #include <iostream>
 #include "window.h"
+#include "threadpool.h"
+#include "mainloop.h"
+#include "idle.h"
 
 Window::Window()
 {
@@ -15,10 +18,13 @@ Window::Window()
     m_frameWidth = 0;
     m_origin = Point(0,0);
     m_bShow = true;
+    m_pSelf = std::make_shared<Window*>(this);
 }
 
 Window::~Window()
 {
+    // незавершенные фоновые задания и события больше не обращаются к окну
+    *m_pSelf = nullptr;
 }
 
 bool Window::WindowProc(uint32_t type, const Point &pos, uint64_t value)
@@ -117,6 +123,11 @@ bool Window::WindowProc(uint32_t type, const Point &pos, uint64_t value)
     {
         return OnKeyboardCapture(false);
     }
+    // событие приложения ?
+    else if(type >= EVENT_USER)
+    {
+        return OnUserEvent(type, pos, value);
+    }
     // других событий мы не знаем
     else
     {
@@ -330,6 +341,49 @@ bool Window::HasKeyboard(Window *pWindow)
     return m_pParent->HasKeyboard(pWindow);
 }
 
+// состояние фонового задания; освобождается в главном потоке
+struct BackgroundJob
+{
+    std::function<void()> job;
+    std::function<void()> done;
+    std::shared_ptr<Window*> self;
+};
+
+void Window::RunInBackground(std::function<void()> job, std::function<void()> done)
+{
+    std::shared_ptr<BackgroundJob> bj = std::make_shared<BackgroundJob>();
+    bj->job = std::move(job);
+    bj->done = std::move(done);
+    bj->self = m_pSelf;
+
+    ThreadPool::Get()->Submit([bj]()
+    {
+        bj->job();
+        bj->job = nullptr;
+
+        InvokeOnMainThread([bj]()
+        {
+            // переносим обработчик в локальную переменную, чтобы его захваченные
+            // значения уничтожались в главном потоке
+            std::function<void()> done = std::move(bj->done);
+            if(done && *bj->self)
+            {
+                done();
+            }
+        });
+    });
+}
+
+std::shared_ptr<Window*> Window::GetLifetime()
+{
+    return m_pSelf;
+}
+
+void Window::RunWhenIdle(std::function<bool()> step)
+{
+    ScheduleIdle(std::move(step), m_pSelf);
+}
+
 RGB  Window::GetBackColor()
 {
     return m_backColor;
@@ -388,7 +442,12 @@ void Window::OnDataRectChanged(const Window *pWindow, const Rect &rect)
 
 void Window::SetOrigin(Point origin)
 {
+    if(origin.GetX() == m_origin.GetX() && origin.GetY() == m_origin.GetY())
+    {
+        return;
+    }
     m_origin = origin;
+    OnOriginChanged();
 }
 
 Point Window::GetOrigin()